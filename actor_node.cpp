@@ -0,0 +1,49 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "remote_actor.hpp"
+
+#include "envs/g2048/g2048_env.hpp"
+
+int main(int argc, char** argv)
+{
+	using namespace impala;
+
+	std::string host;
+	std::uint16_t port = 0;
+	std::size_t num_envs = 256;
+	std::size_t report_interval = 100000;
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+				throw std::invalid_argument("usage: actor_node --learner=HOST:PORT [--envs=N] [--report-interval=STEPS]");
+			}
+			auto key = arg.substr(2, eq - 2);
+			auto value = arg.substr(eq + 1);
+			if (key == "learner") {
+				auto colon = value.rfind(':');
+				if (colon == std::string::npos) {
+					throw std::invalid_argument("learner must be HOST:PORT");
+				}
+				host = value.substr(0, colon);
+				port = static_cast<std::uint16_t>(std::stoul(value.substr(colon + 1)));
+			} else if (key == "envs") {
+				num_envs = std::stoull(value);
+			} else if (key == "report-interval") {
+				report_interval = std::stoull(value);
+			} else {
+				throw std::invalid_argument("unknown option " + key);
+			}
+		}
+		if (host.empty() || num_envs == 0) {
+			throw std::invalid_argument("--learner=HOST:PORT and a positive number of environments are required");
+		}
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return runRemoteActorNode<G2048Env>(host, port, num_envs, report_interval);
+}
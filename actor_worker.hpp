@@ -0,0 +1,290 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include "action.hpp"
+#include "affinity.hpp"
+#include "environment.hpp"
+#include "shm_ring.hpp"
+#include "worker_process.hpp"
+
+namespace impala
+{
+
+// command line flag that makes train2048 run as an actor worker on the given shared memory object
+inline constexpr const char* ACTOR_WORKER_FLAG = "--actor-worker=";
+
+// Messages exchanged between the server and an actor worker process. A worker steps num_envs environments;
+// every environment has at most one request in flight, and a retry replaces the previous request of its slot.
+template <class Observation, class Reward>
+struct ActorWorkerProtocol
+{
+	static_assert(std::is_trivially_copyable_v<Observation> && std::is_trivially_copyable_v<Reward>, "observations and rewards are copied through shared memory");
+
+	struct Request
+	{
+		std::uint32_t slot;
+		// the previous action was invalid for the environment
+		std::uint32_t retry;
+		Observation observation;
+	};
+	struct Response
+	{
+		std::uint32_t slot;
+		std::int64_t action_id;
+		float policy;
+		std::uint64_t model_version;
+	};
+	// followed by num_steps Steps
+	struct RolloutHeader
+	{
+		std::uint32_t slot;
+		std::uint32_t num_steps;
+		Observation terminal;
+	};
+	struct Step
+	{
+		Observation observation;
+		std::int64_t action_id;
+		Reward reward;
+		float policy;
+		std::uint64_t model_version;
+		bool next_goal;
+	};
+};
+
+struct alignas(64) ActorWorkerHeader
+{
+	static inline constexpr std::uint64_t MAGIC = 0x696d70616c617771ull;
+
+	std::uint64_t magic;
+	// sizeof(Request), so that a worker built for another environment is rejected
+	std::uint64_t request_bytes;
+	std::uint64_t num_envs;
+	std::uint64_t t_max;
+	// 0 means no limit
+	std::uint64_t max_episode_length;
+	std::uint64_t request_capacity;
+	std::uint64_t response_capacity;
+	std::uint64_t rollout_capacity;
+	std::atomic<std::uint32_t> exit_flag;
+};
+
+// The shared memory object of one worker: the header followed by the request, response and rollout rings.
+// requests and rollouts are written by the worker, responses by the server.
+template <class Observation, class Reward>
+class ActorWorkerChannels
+{
+public:
+	using Protocol = ActorWorkerProtocol<Observation, Reward>;
+
+	static ActorWorkerChannels create(const std::string& name, std::size_t num_envs, std::size_t t_max, std::size_t max_episode_length)
+	{
+		// room for every environment twice over, a record that does not fit at the end of a ring skips the rest of it
+		const auto request_capacity = roundUp(2 * num_envs * (sizeof(typename Protocol::Request) + 8));
+		const auto response_capacity = roundUp(2 * num_envs * (sizeof(typename Protocol::Response) + 8));
+		const auto rollout_capacity = roundUp(2 * num_envs * (sizeof(typename Protocol::RolloutHeader) + t_max * sizeof(typename Protocol::Step) + 8));
+		auto memory = SharedMemory::create(name, sizeof(ActorWorkerHeader) + SpscRing::requiredBytes(request_capacity) + SpscRing::requiredBytes(response_capacity) + SpscRing::requiredBytes(rollout_capacity));
+		auto* header = new (memory.data()) ActorWorkerHeader{};
+		header->magic = ActorWorkerHeader::MAGIC;
+		header->request_bytes = sizeof(typename Protocol::Request);
+		header->num_envs = num_envs;
+		header->t_max = t_max;
+		header->max_episode_length = max_episode_length;
+		header->request_capacity = request_capacity;
+		header->response_capacity = response_capacity;
+		header->rollout_capacity = rollout_capacity;
+		header->exit_flag.store(0, std::memory_order_relaxed);
+		return ActorWorkerChannels{std::move(memory), true};
+	}
+
+	static ActorWorkerChannels open(const std::string& name)
+	{
+		auto memory = SharedMemory::open(name);
+		const auto* header = static_cast<const ActorWorkerHeader*>(memory.data());
+		if (memory.size() < sizeof(ActorWorkerHeader) || header->magic != ActorWorkerHeader::MAGIC || header->request_bytes != sizeof(typename Protocol::Request)) {
+			throw SharedMemoryError(name + " is not an actor worker channel of this environment");
+		}
+		return ActorWorkerChannels{std::move(memory), false};
+	}
+
+	ActorWorkerHeader& header() const noexcept
+	{
+		return *static_cast<ActorWorkerHeader*>(m_memory.data());
+	}
+	SpscRing& requests() noexcept
+	{
+		return m_requests;
+	}
+	SpscRing& responses() noexcept
+	{
+		return m_responses;
+	}
+	SpscRing& rollouts() noexcept
+	{
+		return m_rollouts;
+	}
+	const std::string& name() const noexcept
+	{
+		return m_memory.name();
+	}
+
+	// only while no worker is attached
+	void reset() noexcept
+	{
+		m_requests.reset();
+		m_responses.reset();
+		m_rollouts.reset();
+		header().exit_flag.store(0, std::memory_order_release);
+	}
+
+private:
+	static std::size_t roundUp(std::size_t bytes) noexcept
+	{
+		return (bytes + 63) / 64 * 64;
+	}
+
+	ActorWorkerChannels(SharedMemory&& memory, bool initialize) noexcept
+	    : m_memory(std::move(memory)),
+	      m_requests(ringAt(0), header().request_capacity, initialize),
+	      m_responses(ringAt(SpscRing::requiredBytes(header().request_capacity)), header().response_capacity, initialize),
+	      m_rollouts(ringAt(SpscRing::requiredBytes(header().request_capacity) + SpscRing::requiredBytes(header().response_capacity)), header().rollout_capacity, initialize)
+	{}
+
+	void* ringAt(std::size_t offset) const noexcept
+	{
+		return static_cast<std::byte*>(m_memory.data()) + sizeof(ActorWorkerHeader) + offset;
+	}
+
+	SharedMemory m_memory;
+	SpscRing m_requests;
+	SpscRing m_responses;
+	SpscRing m_rollouts;
+};
+
+// Entry point of an actor worker process. Steps the environments on a single thread, on the given cpus
+// (any cpu if empty), until the server sets the exit flag or dies, and returns the process exit code.
+template <class Environment>
+int runActorWorker(const std::string& name, const std::vector<int>& cpus)
+{
+	using Observation = typename Environment::Observation;
+	using Reward = typename Environment::Reward;
+	using Action = typename Environment::Action;
+	using Protocol = ActorWorkerProtocol<Observation, Reward>;
+	static_assert(IsEnvironmentV<Environment>);
+
+	pinCurrentProcess(cpus);
+	if (!bindToParentProcess()) {
+		return 1;
+	}
+	std::optional<ActorWorkerChannels<Observation, Reward>> channels;
+	try {
+		channels.emplace(ActorWorkerChannels<Observation, Reward>::open(name));
+	} catch (const SharedMemoryError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	auto& header = channels->header();
+	const auto num_envs = static_cast<std::size_t>(header.num_envs);
+	const auto t_max = static_cast<std::size_t>(header.t_max);
+	const auto max_episode_length = static_cast<std::size_t>(header.max_episode_length);
+
+	struct Slot
+	{
+		Environment env;
+		Observation observation;
+		std::size_t t = 0;
+		std::vector<typename Protocol::Step> steps;
+	};
+	std::vector<Slot> slots(num_envs);
+	std::vector<std::byte> rollout;
+
+	auto exiting = [&] { return header.exit_flag.load(std::memory_order_acquire) != 0; };
+	auto waitForRoom = [&] {
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+		return !exiting();
+	};
+	auto sendRequest = [&](std::uint32_t slot, bool retry) {
+		const typename Protocol::Request request{slot, retry ? 1u : 0u, slots[slot].observation};
+		while (!channels->requests().tryPush(request)) {
+			if (!waitForRoom()) {
+				return false;
+			}
+		}
+		return true;
+	};
+	auto sendRollout = [&](Slot& slot, std::uint32_t index, const Observation& terminal) {
+		const typename Protocol::RolloutHeader rollout_header{index, static_cast<std::uint32_t>(slot.steps.size()), terminal};
+		rollout.resize(sizeof(rollout_header) + slot.steps.size() * sizeof(typename Protocol::Step));
+		std::memcpy(rollout.data(), &rollout_header, sizeof(rollout_header));
+		std::memcpy(rollout.data() + sizeof(rollout_header), slot.steps.data(), slot.steps.size() * sizeof(typename Protocol::Step));
+		slot.steps.clear();
+		while (!channels->rollouts().tryPush(rollout.data(), rollout.size())) {
+			if (!waitForRoom()) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	for (auto i = 0u; i < num_envs; ++i) {
+		slots[i].observation = slots[i].env.reset();
+		slots[i].steps.reserve(t_max);
+		if (!sendRequest(i, false)) {
+			return 0;
+		}
+	}
+	typename Protocol::Response response;
+	while (!exiting()) {
+		if (!channels->responses().tryPop(response)) {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			if (::getppid() == 1) {
+				return 1;
+			}
+			continue;
+		}
+		auto& slot = slots[response.slot];
+		const auto action = DiscreteActionTraits<Action>::convertFromID(response.action_id);
+		if (!slot.env.isValidAction(action)) {
+			if (!sendRequest(response.slot, true)) {
+				break;
+			}
+			continue;
+		}
+		auto&& [next_obs, reward, status] = slot.env.step(action);
+		++slot.t;
+		slot.steps.push_back({slot.observation, response.action_id, reward, response.policy, response.model_version, status == EnvState::FINISHED});
+		// as in the in-process actors, a finished episode keeps filling the rollout after the reset
+		const bool truncated = (status != EnvState::FINISHED && max_episode_length > 0 && slot.t >= max_episode_length);
+		if (slot.steps.size() == t_max || truncated) {
+			if (!sendRollout(slot, response.slot, next_obs)) {
+				break;
+			}
+		}
+		if (status == EnvState::FINISHED || truncated) {
+			slot.observation = slot.env.reset();
+			slot.t = 0;
+		} else {
+			slot.observation = std::move(next_obs);
+		}
+		if (!sendRequest(response.slot, false)) {
+			break;
+		}
+	}
+	return 0;
+}
+
+}  // namespace impala
@@ -0,0 +1,215 @@
+#include "affinity.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+#include <pthread.h>
+#include <sched.h>
+
+namespace impala
+{
+
+namespace
+{
+
+std::vector<int> allowedCpus()
+{
+	std::vector<int> cpus;
+	::cpu_set_t set;
+	CPU_ZERO(&set);
+	if (::sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &set)) {
+				cpus.push_back(cpu);
+			}
+		}
+	}
+	if (cpus.empty()) {
+		for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); ++cpu) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+std::vector<int> readCpuListFile(const boost::filesystem::path& path)
+{
+	std::ifstream ifs{path.string()};
+	std::string line;
+	if (!ifs || !std::getline(ifs, line)) {
+		return {};
+	}
+	return parseCpuList(line);
+}
+
+bool pinThreadHandle(::pthread_t handle, const std::vector<int>& cpus)
+{
+	if (cpus.empty()) {
+		return false;
+	}
+	::cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto cpu : cpus) {
+		CPU_SET(cpu, &set);
+	}
+	return ::pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+}
+
+}  // namespace
+
+std::vector<int> parseCpuList(const std::string& cpu_list)
+{
+	std::vector<int> cpus;
+	std::istringstream iss{cpu_list};
+	std::string range;
+	while (std::getline(iss, range, ',')) {
+		if (range.empty() || range == "\n") {
+			continue;
+		}
+		auto dash = range.find('-');
+		try {
+			if (dash == std::string::npos) {
+				cpus.push_back(std::stoi(range));
+			} else {
+				auto first = std::stoi(range.substr(0, dash));
+				auto last = std::stoi(range.substr(dash + 1));
+				for (int cpu = first; cpu <= last; ++cpu) {
+					cpus.push_back(cpu);
+				}
+			}
+		} catch (const std::logic_error&) {
+			return {};
+		}
+	}
+	return cpus;
+}
+
+std::string formatCpuList(const std::vector<int>& cpus)
+{
+	std::ostringstream oss;
+	for (std::size_t i = 0; i < cpus.size();) {
+		auto j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+			++j;
+		}
+		if (i != 0) {
+			oss << ',';
+		}
+		oss << cpus[i];
+		if (j != i) {
+			oss << '-' << cpus[j];
+		}
+		i = j + 1;
+	}
+	return oss.str();
+}
+
+CpuTopology CpuTopology::load()
+{
+	CpuTopology topology;
+	auto allowed = allowedCpus();
+	const boost::filesystem::path node_root{"/sys/devices/system/node"};
+	boost::system::error_code ec;
+	std::vector<std::pair<int, std::vector<int>>> nodes;
+	if (boost::filesystem::is_directory(node_root, ec)) {
+		for (auto&& entry : boost::filesystem::directory_iterator(node_root, ec)) {
+			auto name = entry.path().filename().string();
+			if (name.size() <= 4 || name.compare(0, 4, "node") != 0 || !std::all_of(name.begin() + 4, name.end(), [](char c) { return '0' <= c && c <= '9'; })) {
+				continue;
+			}
+			std::vector<int> cpus;
+			for (auto cpu : readCpuListFile(entry.path() / "cpulist")) {
+				if (std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+					cpus.push_back(cpu);
+				}
+			}
+			if (!cpus.empty()) {
+				nodes.emplace_back(std::stoi(name.substr(4)), std::move(cpus));
+			}
+		}
+	}
+	std::sort(nodes.begin(), nodes.end());
+	for (auto&& node : nodes) {
+		topology.nodes.push_back(std::move(node.second));
+	}
+	if (topology.nodes.empty()) {
+		topology.nodes.push_back(std::move(allowed));
+	}
+	return topology;
+}
+
+std::size_t CpuTopology::numCpus() const
+{
+	std::size_t count = 0;
+	for (auto&& node : nodes) {
+		count += node.size();
+	}
+	return count;
+}
+
+ThreadPlacement::ThreadPlacement(const CpuTopology& topology, std::size_t num_learner_cpus, std::size_t num_inference_cpus) : m_num_nodes(topology.nodes.size())
+{
+	auto&& learner_node = topology.nodes.front();
+	// the learner gets at most half of its node so the actors are never starved of cpus
+	auto learner_limit = std::max<std::size_t>(learner_node.size() / 2, 1);
+	auto num_learner = std::clamp<std::size_t>(num_learner_cpus, 1, learner_limit);
+	auto num_inference = std::min(num_inference_cpus, learner_limit - num_learner);
+	m_learner_cpus.assign(learner_node.begin(), learner_node.begin() + static_cast<std::ptrdiff_t>(num_learner));
+	m_inference_cpus.assign(learner_node.begin() + static_cast<std::ptrdiff_t>(num_learner), learner_node.begin() + static_cast<std::ptrdiff_t>(num_learner + num_inference));
+	for (auto&& node : topology.nodes) {
+		for (auto cpu : node) {
+			if (std::find(m_learner_cpus.begin(), m_learner_cpus.end(), cpu) == m_learner_cpus.end() && std::find(m_inference_cpus.begin(), m_inference_cpus.end(), cpu) == m_inference_cpus.end()) {
+				m_actor_cpus.push_back(cpu);
+			}
+		}
+	}
+	if (m_actor_cpus.empty()) {
+		m_actor_cpus = m_learner_cpus;
+	}
+}
+
+void ThreadPlacement::report(std::ostream& os, std::size_t num_predictors, std::size_t num_trainers, std::size_t num_inference_workers, std::size_t num_actors) const
+{
+	os << "cpu placement : " << m_num_nodes << " numa node(s)" << std::endl;
+	os << "  server, " << num_predictors << " predictor(s), " << num_trainers << " trainer(s) and python threads on cpus " << formatCpuList(m_learner_cpus) << std::endl;
+	if (num_inference_workers > 0) {
+		os << "  " << num_inference_workers << " inference worker(s) on cpus " << formatCpuList(inferenceCpus()) << std::endl;
+	}
+	os << "  " << num_actors << " actor(s) on cpus " << formatCpuList(m_actor_cpus) << " (" << (num_actors + m_actor_cpus.size() - 1) / m_actor_cpus.size() << " per cpu)" << std::endl;
+}
+
+bool pinCurrentThread(const std::vector<int>& cpus)
+{
+	return pinThreadHandle(::pthread_self(), cpus);
+}
+
+bool pinThread(std::thread& thread, const std::vector<int>& cpus)
+{
+	return pinThreadHandle(thread.native_handle(), cpus);
+}
+
+bool pinCurrentProcess(const std::vector<int>& cpus)
+{
+	if (cpus.empty()) {
+		return false;
+	}
+	::cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto cpu : cpus) {
+		CPU_SET(cpu, &set);
+	}
+	return ::sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+void limitPythonThreads(std::size_t num_threads)
+{
+	auto value = std::to_string(std::max<std::size_t>(num_threads, 1));
+	for (auto name : {"OMP_NUM_THREADS", "MKL_NUM_THREADS", "OPENBLAS_NUM_THREADS"}) {
+		::setenv(name, value.data(), 0);
+	}
+}
+
+}  // namespace impala
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace impala
+{
+
+struct CpuTopology
+{
+	// cpus usable by this process, grouped by NUMA node
+	std::vector<std::vector<int>> nodes;
+
+	static CpuTopology load();
+
+	std::size_t numCpus() const;
+};
+
+class ThreadPlacement
+{
+public:
+	// learner threads (server loop, predictors, trainers and the Python intra-op pool) share the first
+	// num_learner_cpus cpus of the first node, the inference workers the next num_inference_cpus, together at
+	// most half of the node; actors are spread over the remaining cpus
+	ThreadPlacement(const CpuTopology& topology, std::size_t num_learner_cpus, std::size_t num_inference_cpus = 0);
+
+	const std::vector<int>& learnerCpus() const
+	{
+		return m_learner_cpus;
+	}
+	// the actor cpus if the node has no room left for the inference workers
+	const std::vector<int>& inferenceCpus() const
+	{
+		return m_inference_cpus.empty() ? m_actor_cpus : m_inference_cpus;
+	}
+	const std::vector<int>& actorCpus() const
+	{
+		return m_actor_cpus;
+	}
+	int actorCpu(std::size_t actor_index) const
+	{
+		return m_actor_cpus[actor_index % m_actor_cpus.size()];
+	}
+
+	void report(std::ostream& os, std::size_t num_predictors, std::size_t num_trainers, std::size_t num_inference_workers, std::size_t num_actors) const;
+
+private:
+	std::size_t m_num_nodes;
+	std::vector<int> m_learner_cpus;
+	std::vector<int> m_inference_cpus;
+	std::vector<int> m_actor_cpus;
+};
+
+std::vector<int> parseCpuList(const std::string& cpu_list);
+std::string formatCpuList(const std::vector<int>& cpus);
+
+bool pinCurrentThread(const std::vector<int>& cpus);
+bool pinThread(std::thread& thread, const std::vector<int>& cpus);
+// the threads started afterwards inherit the cpus, so call it first thing in a worker process
+bool pinCurrentProcess(const std::vector<int>& cpus);
+
+// must be called before the Python interpreter imports torch
+void limitPythonThreads(std::size_t num_threads);
+
+}  // namespace impala
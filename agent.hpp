@@ -1,10 +1,14 @@
 #pragma once
 
 #include <cstdint>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <range/v3/span.hpp>
 
+#include "checkpoint_writer.hpp"
 #include "environment.hpp"
 #include "loss.hpp"
 
@@ -25,10 +29,14 @@ template <class T, class Environment,
             IsEnvironment<Environment>,
             IsLossType<typename T::Loss>,
             std::is_same<void, decltype(std::declval<T&>().template predict<DiscreteActionTraits<typename Environment::Action>::num_actions>(std::declval<std::add_lvalue_reference_t<typename Environment::ObsBatch>>(), std::declval<ranges::span<float>>(), dummyPredictCallback))>,
-            std::is_same<void, decltype(std::declval<T&>().train(std::declval<std::add_lvalue_reference_t<typename Environment::ObsBatch>>(), std::declval<ranges::span<std::int64_t>>(), std::declval<ranges::span<typename Environment::Reward>>(), std::declval<ranges::span<float>>(), std::declval<ranges::span<float>>(), std::declval<ranges::span<float>>(), std::declval<ranges::span<std::int64_t>>(), dummyTrainCallback<typename T::Loss>))>,
+            std::is_same<void, decltype(std::declval<T&>().train(std::declval<std::add_lvalue_reference_t<typename Environment::ObsBatch>>(), std::declval<ranges::span<std::int64_t>>(), std::declval<ranges::span<typename Environment::Reward>>(), std::declval<ranges::span<float>>(), std::declval<ranges::span<float>>(), std::declval<ranges::span<std::int64_t>>(), dummyTrainCallback<typename T::Loss>))>,
             std::is_same<void, decltype(std::declval<T&>().sync())>,
             std::is_same<void, decltype(std::declval<T&>().save(std::declval<std::int64_t>()))>,
-            std::is_same<void, decltype(std::declval<T&>().load(std::declval<std::int64_t>()))>>,
+            std::is_same<void, decltype(std::declval<T&>().load(std::declval<std::int64_t>()))>,
+            std::is_same<void, decltype(std::declval<T&>().snapshot(std::declval<std::int64_t>(), std::declval<std::vector<CheckpointFile>&>()))>,
+            std::is_convertible<decltype(std::declval<const T&>().outputDirectory()), std::string>,
+            std::is_same<void, decltype(std::declval<T&>().exportWeights(std::declval<std::vector<float>&>()))>,
+            std::is_same<void, decltype(std::declval<T&>().importWeights(std::declval<ranges::span<float>>()))>>,
         std::nullptr_t> = nullptr>
 inline constexpr std::true_type isAgentForGivenEnvironmentHelper(const volatile T*, const volatile Environment*);
 
@@ -47,4 +55,52 @@ struct IsAgentForGivenEnvironment
 template <class T, class Environment>
 inline constexpr bool IsAgentForGivenEnvironmentV = IsAgentForGivenEnvironment<T, Environment>::value;
 
+class InferenceModelError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+// An agent may name an InferenceModel that the predictors run on their own threads instead of predict when
+// native_inference is set. The model has
+//   a nested Weights type, constructible from ranges::span<const float> in the layout of exportWeights, which may
+//     throw InferenceModelError, and shared read-only by the predictors
+//   void predict(const Weights&, const std::vector<std::reference_wrapper<const Observation>>&, ranges::span<float>)
+//     that writes the policies of the observations, with scratch buffers of its own per predictor
+//   optionally static void prepare(Agent&), called with the first learner before the first Weights are made
+struct NoInferenceModel
+{
+	struct Weights
+	{
+		explicit Weights(ranges::span<const float>) noexcept {}
+	};
+
+	template <class Observations>
+	void predict(const Weights&, const Observations&, ranges::span<float>) noexcept
+	{}
+};
+
+template <class T, class = void>
+struct AgentInferenceModel
+{
+	using type = NoInferenceModel;
+};
+
+template <class T>
+struct AgentInferenceModel<T, std::void_t<typename T::InferenceModel>>
+{
+	using type = typename T::InferenceModel;
+};
+
+template <class T>
+using AgentInferenceModelT = typename AgentInferenceModel<T>::type;
+
+template <class Model, class Agent, class = void>
+struct HasInferenceModelPrepare : std::false_type
+{};
+
+template <class Model, class Agent>
+struct HasInferenceModelPrepare<Model, Agent, std::void_t<decltype(Model::prepare(std::declval<Agent&>()))>> : std::true_type
+{};
+
 }  // namespace impala
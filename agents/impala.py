@@ -1,10 +1,23 @@
+import io
 import torch
 from pathlib import Path
 
 
+class TracedPolicy(torch.nn.Module):
+    # the policy of a model on the [batch, -1] observation tensors of TorchScriptModel
+    def __init__(self, model):
+        super(TracedPolicy, self).__init__()
+        self.model = model
+
+    def forward(self, *observation):
+        device = next(self.model.parameters()).device
+        return self.model.probs_for_trace(self.model.convert_obs_to_tensor(observation, device))
+
+
 class Impala:
-    def __init__(self, model, optimizer_maker, use_cuda):
+    def __init__(self, model, optimizer_maker, use_cuda, output_dir="output"):
         self.use_cuda = use_cuda
+        self.output_dir = output_dir
         if self.use_cuda:
             self.device = torch.device("cuda:0")
             self.transfer_stream = torch.cuda.Stream(device=self.device.index)
@@ -25,8 +38,30 @@ class Impala:
             probs = self.model.probs(observations)
             torch.from_numpy(policies_out).copy_(probs)
 
+    def make_packed_indices(self, data_sizes):
+        # rollouts are sorted by length and packed time-major, followed by one bootstrap
+        # observation per rollout. returns the positions of the packed steps and of the
+        # bootstrap observations in the padded (t_max + 1, batch_size) layout
+        t_max = len(data_sizes)
+        batch_size = data_sizes[0]
+        step_index = torch.cat([torch.arange(n) + t * batch_size
+                                for t, n in enumerate(data_sizes)])
+        lengths = torch.zeros(batch_size, dtype=torch.int64)
+        for n in data_sizes:
+            lengths[:n] += 1
+        bootstrap_index = lengths * batch_size + torch.arange(batch_size)
+        return (t_max, batch_size, step_index.to(self.device),
+                bootstrap_index.to(self.device))
+
+    def pad(self, packed, index, length, fill):
+        padded = torch.full((length, ) + packed.shape[1:], fill, dtype=packed.dtype,
+                            device=self.device)
+        return padded.index_copy_(0, index, packed)
+
     def calc_vs_and_pg_advantages(self, probs, values, actions, rewards, behaviour_policies,
                                   discounts):
+        # padded steps have zero rewards, discounts and ratios,
+        # so that their deltas vanish and vs at the padding equals the bootstrap value
         t_max = actions.shape[0]
         batch_size = actions.shape[1]
 
@@ -48,32 +83,41 @@ class Impala:
 
         return vs.detach(), pg_advantages.detach()
 
-    def calc_loss(self, log_probs, probs, values, actions, vs, pg_advantages, loss_coefs,
-                  data_size):
-        v_loss = 0.5 * ((values - vs).pow(2) * loss_coefs).sum() / data_size
-        pi_loss = -((log_probs.gather(2, actions) * pg_advantages) * loss_coefs).sum() / data_size
-        entropy_loss = ((log_probs * probs).sum(2, keepdim=True) * loss_coefs).sum() / data_size
+    def calc_loss(self, log_probs, probs, values, actions, vs, pg_advantages, data_size):
+        v_loss = 0.5 * (values - vs).pow(2).sum() / data_size
+        pi_loss = -(log_probs.gather(1, actions) * pg_advantages).sum() / data_size
+        entropy_loss = (log_probs * probs).sum() / data_size
         return v_loss, pi_loss, entropy_loss
 
-    def train_impl(self, observations, actions, rewards, behaviour_policies, discounts, loss_coefs,
-                   data_size):
+    def train_impl(self, observations, actions, rewards, behaviour_policies, discounts,
+                   data_sizes):
         self.model.train()
-        t_max = actions.shape[0]
-        batch_size = actions.shape[1]
+        num_steps = actions.shape[0]
+        t_max, batch_size, step_index, bootstrap_index = self.make_packed_indices(data_sizes)
+        num_padded = t_max * batch_size
 
         self.optimizer.zero_grad()
         hidden = self.model.convert_obs_to_hidden(observations)
         probs, log_probs = self.model.probs_and_log_probs_from_hidden(
-            self.model.slice_hidden(hidden, t_max * batch_size))
-        probs = probs.reshape(t_max, batch_size, -1)
-        log_probs = log_probs.reshape(t_max, batch_size, -1)
+            self.model.slice_hidden(hidden, num_steps))
         values = self.model.v_from_hidden(hidden)
-        values = values.reshape(t_max + 1, batch_size, 1)
         with torch.no_grad():
+            padded_values = self.pad(values[:num_steps].detach(), step_index,
+                                     num_padded + batch_size, 0.0)
+            padded_values.index_copy_(0, bootstrap_index, values[num_steps:].detach())
             vs, pg_advantages = self.calc_vs_and_pg_advantages(
-                probs.detach(), values.detach(), actions, rewards, behaviour_policies, discounts)
+                self.pad(probs.detach(), step_index, num_padded, 0.0).reshape(
+                    t_max, batch_size, -1),
+                padded_values.reshape(t_max + 1, batch_size, 1),
+                self.pad(actions, step_index, num_padded, 0).reshape(t_max, batch_size, 1),
+                self.pad(rewards, step_index, num_padded, 0.0).reshape(t_max, batch_size, 1),
+                self.pad(behaviour_policies, step_index, num_padded, 1.0).reshape(
+                    t_max, batch_size, 1),
+                self.pad(discounts, step_index, num_padded, 0.0).reshape(t_max, batch_size, 1))
+            vs = vs.reshape(num_padded, 1).index_select(0, step_index)
+            pg_advantages = pg_advantages.reshape(num_padded, 1).index_select(0, step_index)
         v_loss, pi_loss, entropy_loss = self.calc_loss(
-            log_probs, probs, values[:t_max], actions, vs, pg_advantages, loss_coefs, data_size)
+            log_probs, probs, values[:num_steps], actions, vs, pg_advantages, num_steps)
         loss = (0.5 * v_loss + pi_loss + 1e-3 * entropy_loss)
         loss.backward()
         self.optimizer.step()
@@ -97,7 +141,7 @@ class Impala:
         return None
 
     def train(self, observations_in, actions_in, rewards_in, behaviour_policies_in, discounts_in,
-              loss_coefs_in, data_sizes):
+              data_sizes):
         if self.use_cuda:
             self.transfer_stream.synchronize()
             with torch.cuda.stream(self.transfer_stream):
@@ -107,19 +151,16 @@ class Impala:
                 behaviour_policies = torch.from_numpy(behaviour_policies_in).to(
                     device=self.device, non_blocking=True)
                 discounts = torch.from_numpy(discounts_in).to(device=self.device, non_blocking=True)
-                loss_coefs = torch.from_numpy(loss_coefs_in).to(
-                    device=self.device, non_blocking=True)
         else:
             observations = self.model.convert_obs_to_tensor(observations_in, self.device)
             actions = torch.from_numpy(actions_in)
             rewards = torch.from_numpy(rewards_in)
             behaviour_policies = torch.from_numpy(behaviour_policies_in)
             discounts = torch.from_numpy(discounts_in)
-            loss_coefs = torch.from_numpy(loss_coefs_in)
 
         def train_operation():
             return self.train_impl(observations, actions, rewards, behaviour_policies, discounts,
-                                   loss_coefs, sum(data_sizes))
+                                   list(data_sizes))
 
         operation = self.prev_operation
         self.prev_operation = train_operation
@@ -136,13 +177,55 @@ class Impala:
             return operation()
         return None
 
+    def num_weights(self):
+        return sum(p.numel() for p in self.model.parameters())
+
+    def get_weights(self, weights_out):
+        # the parameters flattened in the order of model.parameters(), for inference workers
+        with torch.no_grad():
+            vector = torch.nn.utils.parameters_to_vector(self.model.parameters())
+            torch.from_numpy(weights_out).copy_(vector)
+
+    def set_weights(self, weights_in):
+        with torch.no_grad():
+            torch.nn.utils.vector_to_parameters(
+                torch.from_numpy(weights_in).to(self.device), self.model.parameters())
+
+    # the get_weights vector as little endian float32, read by native inference models
+    def weights_bytes(self):
+        with torch.no_grad():
+            vector = torch.nn.utils.parameters_to_vector(self.model.parameters())
+            return vector.detach().to("cpu", torch.float32).numpy().astype("<f4").tobytes()
+
+    # traces the policy for TorchScriptModel, whose weights are then replaced with the ones of get_weights
+    def export_torchscript(self, path, observations_in):
+        observations = tuple(torch.from_numpy(o).reshape(o.shape[0], -1).to(self.device) for o in observations_in)
+        self.model.eval()
+        with torch.no_grad():
+            traced = torch.jit.trace(TracedPolicy(self.model), observations, check_trace=False)
+        path = Path(path)
+        path.parent.mkdir(parents=True, exist_ok=True)
+        traced.save(str(path))
+
     def save_model(self, index):
-        output_dir = Path(f"output/{index}").resolve()
+        output_dir = Path(f"{self.output_dir}/{index}").resolve()
         output_dir.mkdir(parents=True, exist_ok=True)
         torch.save(self.model.state_dict(), output_dir / "model.pth")
         torch.save(self.optimizer.state_dict(), output_dir / "optimizer.pth")
+        (output_dir / "weights.bin").write_bytes(self.weights_bytes())
+
+    # the (path, bytes) of the files of save_model, written by the caller on another thread
+    def snapshot_model(self, index):
+        output_dir = Path(f"{self.output_dir}/{index}").resolve()
+        files = []
+        for name, state in (("model.pth", self.model.state_dict()), ("optimizer.pth", self.optimizer.state_dict())):
+            buffer = io.BytesIO()
+            torch.save(state, buffer)
+            files.append((str(output_dir / name), buffer.getvalue()))
+        files.append((str(output_dir / "weights.bin"), self.weights_bytes()))
+        return files
 
     def load_model(self, index):
-        model_dir = Path(f"output/{index}").resolve()
+        model_dir = Path(f"{self.output_dir}/{index}").resolve()
         self.model.load_state_dict(torch.load(model_dir / "model.pth", map_location="cpu"))
         self.optimizer.load_state_dict(torch.load(model_dir / "optimizer.pth", map_location="cpu"))
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "train_config.hpp"
+
+namespace impala
+{
+
+// Sweeps batch sizes and thread counts one knob at a time (keeping the best value of the knobs already swept)
+// and returns the configuration with the highest trained steps per second.
+template <class ServerType, class AgentFactory>
+TrainConfig autotune(const TrainConfig& base_config, std::chrono::steady_clock::duration budget, AgentFactory&& make_agent)
+{
+	struct Knob
+	{
+		const char* name;
+		std::function<void(TrainConfig&, std::size_t)> apply;
+		std::vector<std::size_t> candidates;
+	};
+	const std::vector<Knob> knobs = {
+	    {"prediction_batch_size", [](TrainConfig& config, std::size_t value) { config.min_prediction_batch_size = config.max_prediction_batch_size = value; }, {256, 512, 1024, 2048}},
+	    {"training_batch_size", [](TrainConfig& config, std::size_t value) { config.min_training_batch_size = config.max_training_batch_size = value; }, {64, 128, 256, 512}},
+	    {"num_predictors", [](TrainConfig& config, std::size_t value) { config.num_predictors = value; }, {1, 2, 4, 8}},
+	    {"num_trainers", [](TrainConfig& config, std::size_t value) { config.num_trainers = value; }, {4, 8, 16, 32}}};
+
+	std::size_t num_trials = 1;
+	for (auto&& knob : knobs) {
+		num_trials += knob.candidates.size();
+	}
+	const auto trial_time = budget / num_trials;
+
+	auto run_trial = [&](TrainConfig config) {
+		config.save_interval_steps = std::nullopt;
+		double steps_per_second = 0.0;
+		try {
+			config.validate();
+			ServerType server{make_agent(), config};
+			steps_per_second = server.train(std::numeric_limits<std::size_t>::max(), trial_time).steps_per_second;
+		} catch (const ConfigError& e) {
+			std::cout << "autotune : skip (" << e.what() << ")" << std::endl;
+			return 0.0;
+		}
+		std::cout << "autotune : " << steps_per_second << " steps/sec with" << std::endl;
+		std::cout << config;
+		return steps_per_second;
+	};
+
+	TrainConfig best_config = base_config;
+	double best_steps_per_second = run_trial(best_config);
+	for (auto&& knob : knobs) {
+		auto knob_base = best_config;
+		for (auto value : knob.candidates) {
+			auto config = knob_base;
+			knob.apply(config, value);
+			auto steps_per_second = run_trial(config);
+			if (steps_per_second > best_steps_per_second) {
+				best_steps_per_second = steps_per_second;
+				best_config = config;
+			}
+		}
+		std::cout << "autotune : best so far " << best_steps_per_second << " steps/sec after sweeping " << knob.name << std::endl;
+	}
+	best_config.save_interval_steps = base_config.save_interval_steps;
+	return best_config;
+}
+
+}  // namespace impala
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/container/vector.hpp>
+
+namespace impala
+{
+
+template <class T, class Allocator>
+std::size_t bufferBytes(const boost::container::vector<T, Allocator>& buffer) noexcept
+{
+	return buffer.capacity() * sizeof(T);
+}
+template <class T, class Allocator>
+std::size_t bufferBytes(const std::vector<T, Allocator>& buffer) noexcept
+{
+	return buffer.capacity() * sizeof(T);
+}
+template <class... Ts>
+std::size_t bufferBytes(const std::tuple<Ts...>& buffers) noexcept
+{
+	return std::apply([](const auto&... buffer) { return (std::size_t{0} + ... + bufferBytes(buffer)); }, buffers);
+}
+
+template <class Func, class Batch, class... Batches>
+void forEachBuffer(Func&& func, Batch& batch, Batches&... batches);
+
+namespace detail
+{
+
+template <class T>
+struct IsTuple : std::false_type
+{};
+template <class... Ts>
+struct IsTuple<std::tuple<Ts...>> : std::true_type
+{};
+
+template <std::size_t I, class Func, class... Batches>
+void forEachBufferAt(Func& func, Batches&... batches)
+{
+	forEachBuffer(func, std::get<I>(batches)...);
+}
+template <class Func, std::size_t... Is, class... Batches>
+void forEachBufferHelper(Func& func, std::index_sequence<Is...>, Batches&... batches)
+{
+	(forEachBufferAt<Is>(func, batches...), ...);
+}
+
+}  // namespace detail
+
+// calls func with the corresponding buffers of batches that are a buffer or a (nested) tuple of buffers, e.g. ObsBatch
+template <class Func, class Batch, class... Batches>
+void forEachBuffer(Func&& func, Batch& batch, Batches&... batches)
+{
+	if constexpr (detail::IsTuple<std::remove_const_t<Batch>>::value) {
+		detail::forEachBufferHelper(func, std::make_index_sequence<std::tuple_size_v<std::remove_const_t<Batch>>>{}, batch, batches...);
+	} else {
+		func(batch, batches...);
+	}
+}
+
+// A buffer handed out by BatchPool. bytes is what the pool has accounted for it.
+template <class Buffer>
+struct BatchLease
+{
+	std::unique_ptr<Buffer> buffer;
+	std::size_t bytes = 0;
+
+	explicit operator bool() const noexcept
+	{
+		return static_cast<bool>(buffer);
+	}
+	Buffer& operator*() const noexcept
+	{
+		return *buffer;
+	}
+	Buffer* operator->() const noexcept
+	{
+		return buffer.get();
+	}
+};
+
+// Batch buffers shared by all predictors and trainers under one memory budget.
+// Released buffers keep their capacity and are reused. A new buffer is created only while the resident bytes
+// (buffers in use and idle ones) stay within the budget, so that the resident memory follows the number of
+// batches in flight rather than the number of threads. min_in_flight buffers are always granted, because the
+// agent only finishes an operation when the next one is issued. Shared buffers of a type count against that
+// exemption for their type, so that the owners of shared buffers, which do not hold them in flight, cannot keep
+// adding buffers beyond the budget. A new buffer is charged as much as the largest buffer of its type seen so
+// far, or the expected bytes of its type if that is larger, so that the first batches count as well.
+// bufferBytes(const Buffer&) must be found for every buffer type.
+template <class... Buffers>
+class BatchPool
+{
+public:
+	BatchPool(std::optional<std::size_t> budget_bytes, std::size_t min_in_flight) noexcept : m_budget_bytes(budget_bytes), m_min_in_flight(min_in_flight) {}
+
+	// blocks until a buffer can be granted, returns an empty lease after exit()
+	template <class Buffer>
+	BatchLease<Buffer> acquire()
+	{
+		std::unique_lock lock{m_mutex};
+		auto& pool = std::get<Pool<Buffer>>(m_pools);
+		while (true) {
+			if (m_exit_flag) {
+				return {};
+			}
+			if (!pool.idle.empty()) {
+				auto lease = std::move(pool.idle.back());
+				pool.idle.pop_back();
+				++m_num_in_use;
+				return lease;
+			}
+			// a new buffer is assumed to grow as large as the largest one seen so far (or the expected bytes)
+			if (m_num_in_use + pool.num_shared < m_min_in_flight || fitsBudget(pool.largest_bytes)) {
+				++m_num_in_use;
+				m_resident_bytes += pool.largest_bytes;
+				return {std::make_unique<Buffer>(), pool.largest_bytes};
+			}
+			if (!freeIdleBuffer()) {
+				m_event.wait(lock);
+			}
+		}
+	}
+
+	// e.g. from the configured batch shape, before the first buffer of the type is acquired
+	template <class Buffer>
+	void expectBytes(std::size_t bytes)
+	{
+		std::lock_guard lock{m_mutex};
+		auto& pool = std::get<Pool<Buffer>>(m_pools);
+		pool.largest_bytes = std::max(pool.largest_bytes, bytes);
+	}
+
+	template <class Buffer>
+	void release(BatchLease<Buffer>&& lease)
+	{
+		giveBack(std::move(lease), true);
+	}
+
+	// hands a granted buffer to several read-only owners, it returns to the pool when the last one drops it.
+	// shared buffers stay resident but do not count as in flight
+	template <class Buffer>
+	std::shared_ptr<const Buffer> share(BatchLease<Buffer>&& lease)
+	{
+		const auto bytes = bufferBytes(*lease);
+		{
+			std::lock_guard lock{m_mutex};
+			auto& pool = std::get<Pool<Buffer>>(m_pools);
+			--m_num_in_use;
+			++m_num_shared;
+			++pool.num_shared;
+			m_resident_bytes = m_resident_bytes - lease.bytes + bytes;
+			m_shared_bytes += bytes;
+			pool.largest_bytes = std::max(pool.largest_bytes, bytes);
+		}
+		m_event.notify_all();
+		return std::shared_ptr<Buffer>(lease.buffer.release(), [this, bytes](Buffer* buffer) {
+			giveBack(BatchLease<Buffer>{std::unique_ptr<Buffer>(buffer), bytes}, false);
+		});
+	}
+
+	void exit()
+	{
+		{
+			std::lock_guard lock{m_mutex};
+			m_exit_flag = true;
+		}
+		m_event.notify_all();
+	}
+
+	std::size_t residentBytes() const
+	{
+		std::lock_guard lock{m_mutex};
+		return m_resident_bytes;
+	}
+	std::size_t numInUse() const
+	{
+		std::lock_guard lock{m_mutex};
+		return m_num_in_use;
+	}
+	std::size_t numShared() const
+	{
+		std::lock_guard lock{m_mutex};
+		return m_num_shared;
+	}
+	std::size_t sharedBytes() const
+	{
+		std::lock_guard lock{m_mutex};
+		return m_shared_bytes;
+	}
+
+private:
+	template <class Buffer>
+	struct Pool
+	{
+		std::vector<BatchLease<Buffer>> idle;
+		std::size_t largest_bytes = 0;
+		std::size_t num_shared = 0;
+	};
+
+	template <class Buffer>
+	void giveBack(BatchLease<Buffer>&& lease, bool in_use)
+	{
+		if (!lease) {
+			return;
+		}
+		const auto bytes = bufferBytes(*lease);
+		{
+			std::lock_guard lock{m_mutex};
+			auto& pool = std::get<Pool<Buffer>>(m_pools);
+			if (in_use) {
+				--m_num_in_use;
+			} else {
+				--m_num_shared;
+				--pool.num_shared;
+				m_shared_bytes -= lease.bytes;
+			}
+			m_resident_bytes = m_resident_bytes - lease.bytes + bytes;
+			pool.largest_bytes = std::max(pool.largest_bytes, bytes);
+			if (fitsBudget(0)) {
+				lease.bytes = bytes;
+				pool.idle.emplace_back(std::move(lease));
+			} else {
+				m_resident_bytes -= bytes;
+			}
+		}
+		// the buffer is freed outside of the lock
+		lease.buffer.reset();
+		m_event.notify_all();
+	}
+
+	bool fitsBudget(std::size_t additional_bytes) const noexcept
+	{
+		return !m_budget_bytes.has_value() || m_resident_bytes + additional_bytes <= m_budget_bytes.value();
+	}
+
+	// makes room by dropping an idle buffer of any type
+	bool freeIdleBuffer()
+	{
+		return std::apply([this](auto&... pools) { return (freeIdleBuffer(pools) || ...); }, m_pools);
+	}
+	template <class Buffer>
+	bool freeIdleBuffer(Pool<Buffer>& pool)
+	{
+		if (pool.idle.empty()) {
+			return false;
+		}
+		m_resident_bytes -= pool.idle.back().bytes;
+		pool.idle.pop_back();
+		return true;
+	}
+
+	std::optional<std::size_t> m_budget_bytes;
+	std::size_t m_min_in_flight;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_event;
+	std::tuple<Pool<Buffers>...> m_pools;
+	std::size_t m_num_in_use = 0;
+	std::size_t m_num_shared = 0;
+	std::size_t m_shared_bytes = 0;
+	std::size_t m_resident_bytes = 0;
+	bool m_exit_flag = false;
+};
+
+}  // namespace impala
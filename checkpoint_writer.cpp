@@ -0,0 +1,159 @@
+#include "checkpoint_writer.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+namespace impala
+{
+
+namespace
+{
+
+void syncDirectory(const boost::filesystem::path& directory)
+{
+	int fd = ::open(directory.string().data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0) {
+		::fsync(fd);
+		::close(fd);
+	}
+}
+
+}  // namespace
+
+CheckpointWriter::CheckpointWriter(std::size_t max_pending) : m_max_pending(max_pending)
+{
+	m_thread = std::thread{[this] {
+		run();
+	}};
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard lock{m_mutex};
+		m_exit_flag = true;
+	}
+	m_event.notify_all();
+	m_thread.join();
+}
+
+void CheckpointWriter::write(std::vector<CheckpointFile>&& files)
+{
+	{
+		std::unique_lock lock{m_mutex};
+		m_space_event.wait(lock, [this] { return m_queue.size() < m_max_pending; });
+		m_queue.emplace_back(std::move(files));
+	}
+	m_event.notify_all();
+}
+
+void CheckpointWriter::writeFile(const CheckpointFile& file)
+{
+	const boost::filesystem::path path{file.path};
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(path.parent_path(), ec);
+	if (ec) {
+		throw CheckpointError("create_directories " + path.parent_path().string() + " : " + ec.message());
+	}
+	const auto temp_path = file.path + ".tmp";
+	int fd = ::open(temp_path.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		throw CheckpointError("open " + temp_path + " : " + std::strerror(errno));
+	}
+	const auto* bytes = reinterpret_cast<const char*>(file.data.data());
+	auto size = file.data.size();
+	while (size > 0) {
+		const auto written = ::write(fd, bytes, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			auto message = std::string(std::strerror(errno));
+			::close(fd);
+			throw CheckpointError("write " + temp_path + " : " + message);
+		}
+		bytes += written;
+		size -= static_cast<std::size_t>(written);
+	}
+	if (::fsync(fd) != 0) {
+		auto message = std::string(std::strerror(errno));
+		::close(fd);
+		throw CheckpointError("fsync " + temp_path + " : " + message);
+	}
+	::close(fd);
+	if (::rename(temp_path.data(), file.path.data()) != 0) {
+		throw CheckpointError("rename " + temp_path + " : " + std::strerror(errno));
+	}
+	syncDirectory(path.parent_path());
+}
+
+void CheckpointWriter::run()
+{
+	while (true) {
+		std::vector<CheckpointFile> files;
+		{
+			std::unique_lock lock{m_mutex};
+			m_event.wait(lock, [this] { return !m_queue.empty() || m_exit_flag; });
+			if (m_queue.empty()) {
+				break;
+			}
+			files = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+		m_space_event.notify_all();
+		const auto start = std::chrono::steady_clock::now();
+		try {
+			for (auto&& file : files) {
+				writeFile(file);
+			}
+			m_written.fetch_add(1, std::memory_order_relaxed);
+			m_write_nanoseconds.fetch_add(static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+		} catch (const CheckpointError& e) {
+			std::cerr << "checkpoint failed : " << e.what() << std::endl;
+			m_failed.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+std::optional<std::int64_t> latestCheckpoint(const std::string& directory, const std::string& name)
+{
+	std::optional<std::int64_t> latest;
+	boost::system::error_code ec;
+	for (boost::filesystem::directory_iterator it{directory, ec}, end; !ec && it != end; it.increment(ec)) {
+		const auto index_name = it->path().filename().string();
+		if (index_name.empty() || index_name.find_first_not_of("0123456789") != std::string::npos || index_name.size() > 18) {
+			continue;
+		}
+		const auto index = std::stoll(index_name);
+		if ((!latest.has_value() || index > latest.value()) && boost::filesystem::is_regular_file(it->path() / name)) {
+			latest = index;
+		}
+	}
+	return latest;
+}
+
+std::vector<std::byte> readCheckpointFile(const std::string& path)
+{
+	std::ifstream ifs{path, std::ios::binary};
+	if (!ifs) {
+		throw CheckpointError("cannot open " + path);
+	}
+	std::vector<char> bytes{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+	if (ifs.bad()) {
+		throw CheckpointError("cannot read " + path);
+	}
+	std::vector<std::byte> data(bytes.size());
+	std::memcpy(data.data(), bytes.data(), bytes.size());
+	return data;
+}
+
+}  // namespace impala
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace impala
+{
+
+class CheckpointError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+// a file of a checkpoint, already serialized by the agent
+struct CheckpointFile
+{
+	std::string path;
+	std::vector<std::byte> data;
+};
+
+// Writes checkpoints on its own thread. Every file is written to a temporary name, synced and renamed, so that a
+// checkpoint file is either complete or absent. A failed checkpoint is reported and training goes on.
+class CheckpointWriter
+{
+public:
+	// write waits while max_pending checkpoints are queued, which bounds the memory they take
+	explicit CheckpointWriter(std::size_t max_pending);
+	CheckpointWriter(const CheckpointWriter&) = delete;
+	CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+	// writes the queued checkpoints
+	~CheckpointWriter();
+
+	// the files are written in order
+	void write(std::vector<CheckpointFile>&& files);
+
+	// writes a file the same way on the calling thread, throws CheckpointError
+	static void writeFile(const CheckpointFile& file);
+
+	std::size_t writtenCheckpoints() const noexcept
+	{
+		return m_written.load(std::memory_order_relaxed);
+	}
+	std::size_t failedCheckpoints() const noexcept
+	{
+		return m_failed.load(std::memory_order_relaxed);
+	}
+	// of the checkpoints written so far
+	double meanWriteSeconds() const noexcept
+	{
+		const auto written = m_written.load(std::memory_order_relaxed);
+		return written > 0 ? static_cast<double>(m_write_nanoseconds.load(std::memory_order_relaxed)) * 1e-9 / static_cast<double>(written) : 0.0;
+	}
+
+private:
+	void run();
+
+	const std::size_t m_max_pending;
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	std::condition_variable m_space_event;
+	std::deque<std::vector<CheckpointFile>> m_queue;
+	bool m_exit_flag = false;
+	std::atomic<std::size_t> m_written{0};
+	std::atomic<std::size_t> m_failed{0};
+	std::atomic<std::size_t> m_write_nanoseconds{0};
+	std::thread m_thread;
+};
+
+// the highest numbered subdirectory DIRECTORY/INDEX that has the file name, i.e. the latest checkpoint that was
+// completely written if name is written last
+std::optional<std::int64_t> latestCheckpoint(const std::string& directory, const std::string& name);
+// throws CheckpointError
+std::vector<std::byte> readCheckpointFile(const std::string& path);
+
+}  // namespace impala
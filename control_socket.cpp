@@ -0,0 +1,120 @@
+#include "control_socket.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace impala
+{
+
+namespace
+{
+
+bool writeAll(int fd, const std::string& data)
+{
+	std::size_t written = 0;
+	while (written < data.size()) {
+		auto ret = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		written += static_cast<std::size_t>(ret);
+	}
+	return true;
+}
+
+}  // namespace
+
+ControlSocket::ControlSocket(std::string path, Handler handler) : m_path(std::move(path)), m_handler(std::move(handler))
+{
+	::sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (m_path.size() >= sizeof(address.sun_path)) {
+		throw ControlSocketError("control socket path is too long : " + m_path);
+	}
+	std::strcpy(address.sun_path, m_path.data());
+	m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listen_fd < 0) {
+		throw ControlSocketError("socket failed : " + std::string(std::strerror(errno)));
+	}
+	::unlink(m_path.data());
+	if (::bind(m_listen_fd, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_listen_fd, 4) != 0) {
+		auto message = std::string(std::strerror(errno));
+		::close(m_listen_fd);
+		throw ControlSocketError("cannot listen on " + m_path + " : " + message);
+	}
+	m_thread = std::thread{[this] {
+		run();
+	}};
+}
+
+ControlSocket::~ControlSocket()
+{
+	m_exit_flag = true;
+	m_thread.join();
+	::close(m_listen_fd);
+	::unlink(m_path.data());
+}
+
+void ControlSocket::run()
+{
+	while (!m_exit_flag) {
+		::pollfd pfd{m_listen_fd, POLLIN, 0};
+		if (::poll(&pfd, 1, 200) <= 0) {
+			continue;
+		}
+		int connection_fd = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (connection_fd < 0) {
+			continue;
+		}
+		serve(connection_fd);
+		::close(connection_fd);
+	}
+}
+
+void ControlSocket::serve(int connection_fd)
+{
+	std::string buffer;
+	char chunk[1024];
+	while (!m_exit_flag) {
+		::pollfd pfd{connection_fd, POLLIN, 0};
+		auto ready = ::poll(&pfd, 1, 200);
+		if (ready == 0 || (ready < 0 && errno == EINTR)) {
+			continue;
+		}
+		if (ready < 0) {
+			return;
+		}
+		auto received = ::recv(connection_fd, chunk, sizeof(chunk), 0);
+		if (received <= 0) {
+			return;
+		}
+		buffer.append(chunk, static_cast<std::size_t>(received));
+		std::size_t newline;
+		while ((newline = buffer.find('\n')) != std::string::npos) {
+			auto line = buffer.substr(0, newline);
+			buffer.erase(0, newline + 1);
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			std::string response;
+			try {
+				response = m_handler(line);
+			} catch (const std::exception& e) {
+				response = std::string("error ") + e.what() + "\n";
+			}
+			if (!writeAll(connection_fd, response)) {
+				return;
+			}
+		}
+	}
+}
+
+}  // namespace impala
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace impala
+{
+
+class ControlSocketError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+// Listens on a Unix-domain stream socket and answers each received line with handler(line).
+// Connections are served one at a time on a background thread.
+class ControlSocket
+{
+public:
+	using Handler = std::function<std::string(const std::string&)>;
+
+	ControlSocket(std::string path, Handler handler);
+	~ControlSocket();
+
+	ControlSocket(const ControlSocket&) = delete;
+	ControlSocket& operator=(const ControlSocket&) = delete;
+
+private:
+	void run();
+	void serve(int connection_fd);
+
+	std::string m_path;
+	Handler m_handler;
+	int m_listen_fd = -1;
+	std::atomic<bool> m_exit_flag{false};
+	std::thread m_thread;
+};
+
+}  // namespace impala
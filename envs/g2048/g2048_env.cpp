@@ -31,6 +31,23 @@ G2048Env::Observation G2048Env::reset()
 	return m_state.clone();
 }
 
+G2048Env::State G2048Env::state() const
+{
+	return State{m_state, m_random_engine.state()};
+}
+
+G2048Env::Observation G2048Env::restore(const State& state)
+{
+	m_state = state.board;
+	m_random_engine = FastRandomEngine{state.random_state};
+	return m_state.clone();
+}
+
+void G2048Env::seed(std::uint64_t seed)
+{
+	m_random_engine = FastRandomEngine{seed};
+}
+
 namespace
 {
 
@@ -181,7 +198,12 @@ bool G2048Env::isValidAction(Action action) const
 		std::cerr << "2048 error: there are some logic errors!!" << std::endl;
 		std::terminate();
 	}
-	auto temp = m_state;
+	return isValidActionFor(m_state, action);
+}
+
+bool G2048Env::isValidActionFor(const Observation& observation, Action action)
+{
+	auto temp = observation;
 	if (action == FourDirections::LEFT) {
 		moveLeft<0>(temp);
 	} else if (action == FourDirections::RIGHT) {
@@ -191,7 +213,7 @@ bool G2048Env::isValidAction(Action action) const
 	} else if (action == FourDirections::DOWN) {
 		moveLeft<1>(temp);
 	}
-	return (temp != m_state);
+	return (temp != observation);
 }
 
 void G2048Env::writeRawData(const Observation& obs, RawObsTraits::TensorRefType& dest)
@@ -219,6 +241,15 @@ void G2048Env::writeInvalidMaskData(const Observation& obs, InvalidMaskTraits::T
 	dest[3] = (temp == obs ? 1 : 0);
 }
 
+void G2048CompactEnv::writeBoardData(const Observation& obs, BoardTraits::TensorRefType& dest)
+{
+	for (auto y : ranges::view::indices(BOARD_SIZE)) {
+		for (auto x : ranges::view::indices(BOARD_SIZE)) {
+			dest[y * BOARD_SIZE + x] = obs[y][x];
+		}
+	}
+}
+
 int G2048Env::countEmpty() const
 {
 	int count = 0;
@@ -8,6 +8,7 @@
 #include "action.hpp"
 #include "environment.hpp"
 #include "python_util.hpp"
+#include "sampling.hpp"
 #include "tensor.hpp"
 
 namespace impala
@@ -29,10 +30,21 @@ public:
 	using Reward = float;
 	using Action = FourDirections;
 
+	// the board and the random engine, enough to continue the game in another process
+	struct State
+	{
+		Observation board;
+		std::uint64_t random_state;
+	};
+
 	G2048Env() : m_random_engine{std::random_device{}()} {}
 	~G2048Env();
 
 	Observation reset();
+	State state() const;
+	Observation restore(const State& state);
+	// fixes the tiles spawned from here on, e.g. for reproducible runs
+	void seed(std::uint64_t seed);
 	std::tuple<Observation, Reward, EnvState> step(const Action& action);
 	void render() const;
 
@@ -50,12 +62,16 @@ public:
 	}
 
 	bool isValidAction(Action action) const;
+	// for a board that is not the state of an environment, e.g. in serving mode; false for every action of a finished game
+	static bool isValidActionFor(const Observation& observation, Action action);
 
-private:
+protected:
 	static void writeRawData(const Observation& obs, RawObsTraits::TensorRefType& dest);
 	static void writeConvData(const Observation& obs, ConvObsTraits::TensorRefType& dest);
 	static void writeInvalidMaskData(const Observation& obs, InvalidMaskTraits::TensorRefType& dest);
 
+private:
+
 	int countEmpty() const;
 	std::uint8_t maxNumber() const;
 	bool isGameOver() const;
@@ -63,7 +79,7 @@ private:
 	void randomGen();
 
 	Observation m_state;
-	std::mt19937 m_random_engine;
+	FastRandomEngine m_random_engine;
 #ifdef IMPALA_USE_GUI_VIEWER
 	class RenderData;
 	mutable RenderData* m_render_data = nullptr;
@@ -72,4 +88,31 @@ private:
 
 static_assert(IsEnvironmentV<G2048Env>);
 
+// Same game, but batches carry only the boards and the invalid action masks (20 bytes per observation).
+// The model expands them to the one-hot encodings of G2048Env.
+class G2048CompactEnv : public G2048Env
+{
+public:
+	using BoardTraits = NdArrayTraits<std::uint8_t, BOARD_SIZE * BOARD_SIZE>;
+
+	using ObsBatch = std::tuple<BoardTraits::BufferType, InvalidMaskTraits::BufferType>;
+
+	template <class ForwardIterator,
+	    std::enable_if_t<
+	        std::conjunction_v<
+	            std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<ForwardIterator>::iterator_category>,
+	            std::is_convertible<typename std::iterator_traits<ForwardIterator>::reference, const Observation&>>,
+	        std::nullptr_t> = nullptr>
+	static void makeBatch(ForwardIterator first, ForwardIterator last, ObsBatch& output)
+	{
+		BoardTraits::makeBufferForBatch(first, last, std::get<0>(output), writeBoardData);
+		InvalidMaskTraits::makeBufferForBatch(first, last, std::get<1>(output), writeInvalidMaskData);
+	}
+
+private:
+	static void writeBoardData(const Observation& obs, BoardTraits::TensorRefType& dest);
+};
+
+static_assert(IsEnvironmentV<G2048CompactEnv>);
+
 }  // namespace impala
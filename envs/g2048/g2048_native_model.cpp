@@ -0,0 +1,227 @@
+#include "g2048_native_model.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#include "agent.hpp"
+
+namespace impala
+{
+
+namespace
+{
+
+constexpr std::size_t BOARD_SIZE = G2048Env::BOARD_SIZE;
+constexpr std::size_t CELLS = BOARD_SIZE * BOARD_SIZE;
+constexpr std::size_t ORIENTATIONS = 8;
+
+// cell y * 4 + x of orientation d reads this cell of the board, as in G2048Env and G2048A3CModel.expand_boards
+constexpr std::array<std::array<std::uint8_t, CELLS>, ORIENTATIONS> makeOrientationIndex()
+{
+	std::array<std::array<std::uint8_t, CELLS>, ORIENTATIONS> index{};
+	for (std::size_t y = 0; y < BOARD_SIZE; ++y) {
+		for (std::size_t x = 0; x < BOARD_SIZE; ++x) {
+			const auto cell = y * BOARD_SIZE + x;
+			const auto last = BOARD_SIZE - 1;
+			index[0][cell] = static_cast<std::uint8_t>(y * BOARD_SIZE + x);
+			index[1][cell] = static_cast<std::uint8_t>((last - x) * BOARD_SIZE + y);
+			index[2][cell] = static_cast<std::uint8_t>((last - y) * BOARD_SIZE + last - x);
+			index[3][cell] = static_cast<std::uint8_t>(x * BOARD_SIZE + last - y);
+			index[4][cell] = static_cast<std::uint8_t>(x * BOARD_SIZE + y);
+			index[5][cell] = static_cast<std::uint8_t>(y * BOARD_SIZE + last - x);
+			index[6][cell] = static_cast<std::uint8_t>((last - x) * BOARD_SIZE + last - y);
+			index[7][cell] = static_cast<std::uint8_t>((last - y) * BOARD_SIZE + x);
+		}
+	}
+	return index;
+}
+
+constexpr auto ORIENTATION_INDEX = makeOrientationIndex();
+
+// the rot_matrix of G2048A3CModel as permutations: action a of the board is action ROTATION[d][a] of orientation d
+constexpr std::uint8_t ROTATION[ORIENTATIONS][4] = {
+    {0, 1, 2, 3},
+    {3, 2, 0, 1},
+    {1, 0, 3, 2},
+    {2, 3, 1, 0},
+    {2, 3, 0, 1},
+    {0, 1, 3, 2},
+    {3, 2, 1, 0},
+    {1, 0, 2, 3},
+};
+
+// the inputs of a convolution as an overlapping row of the (position, channel) activations: input j * channels + c of
+// the packed layer is the column c * kernel_size + j of the Conv1d weight
+std::vector<std::size_t> convInputOrder(std::size_t channels, std::size_t kernel_size)
+{
+	std::vector<std::size_t> order(channels * kernel_size);
+	for (std::size_t j = 0; j < kernel_size; ++j) {
+		for (std::size_t c = 0; c < channels; ++c) {
+			order[j * channels + c] = c * kernel_size + j;
+		}
+	}
+	return order;
+}
+
+// the conv_2 output is flattened by channel in the model, but kept by position here
+std::vector<std::size_t> transposedInputOrder(std::size_t channels, std::size_t length)
+{
+	std::vector<std::size_t> order(channels * length);
+	for (std::size_t t = 0; t < length; ++t) {
+		for (std::size_t c = 0; c < channels; ++c) {
+			order[t * channels + c] = c * length + t;
+		}
+	}
+	return order;
+}
+
+}  // namespace
+
+G2048NativeModel::Weights::Weights(ranges::span<const float> weights)
+{
+	if (static_cast<std::size_t>(weights.size()) != NUM_WEIGHTS) {
+		throw InferenceModelError("G2048NativeModel needs " + std::to_string(NUM_WEIGHTS) + " weights, got " + std::to_string(weights.size()));
+	}
+	const float* next = weights.data();
+	auto take = [&next](std::size_t size) {
+		const float* data = next;
+		next += size;
+		return data;
+	};
+	// in the order of model.parameters(): every layer in the order of __init__, weight before bias
+	const float* l_1_weight = take(HIDDEN * RAW_INPUTS);
+	const float* l_1_bias = take(HIDDEN);
+	const float* l_2_weight = take(HIDDEN * HIDDEN);
+	const float* l_2_bias = take(HIDDEN);
+	const float* l_3_weight = take(CONV_HIDDEN * CONV_INPUTS);
+	const float* l_3_bias = take(CONV_HIDDEN);
+	const float* l_4_weight = take(CHANNELS * CONV_HIDDEN);
+	const float* l_4_bias = take(CHANNELS);
+	const float* l_5_weight = take(HIDDEN * POSITIONS * CHANNELS);
+	const float* l_5_bias = take(HIDDEN);
+	const float* l_6_weight = take(HIDDEN * CONV_2_LENGTH * CHANNELS);
+	const float* l_6_bias = take(HIDDEN);
+	const float* conv_1_weight = take(CHANNELS * CHANNELS * 3);
+	const float* conv_1_bias = take(CHANNELS);
+	const float* conv_2_weight = take(CHANNELS * CHANNELS * 2);
+	const float* conv_2_bias = take(CHANNELS);
+	const float* l_pi_weight = take(NUM_ACTIONS * 3 * HIDDEN);
+	const float* l_pi_bias = take(NUM_ACTIONS);
+	// l_v is left out
+	take(3 * HIDDEN + 1);
+	assert(next == weights.data() + weights.size());
+
+	m_l_1 = OneHotLinear{l_1_weight, l_1_bias, HIDDEN, RAW_INPUTS};
+	m_l_2 = PackedLinear{l_2_weight, l_2_bias, HIDDEN, HIDDEN};
+	m_l_3 = OneHotLinear{l_3_weight, l_3_bias, CONV_HIDDEN, CONV_INPUTS};
+	m_l_4 = PackedLinear{l_4_weight, l_4_bias, CHANNELS, CONV_HIDDEN};
+	m_l_5 = PackedLinear{l_5_weight, l_5_bias, HIDDEN, POSITIONS * CHANNELS};
+	m_l_6 = PackedLinear{l_6_weight, l_6_bias, HIDDEN, CONV_2_LENGTH * CHANNELS, transposedInputOrder(CHANNELS, CONV_2_LENGTH)};
+	m_conv_1 = PackedLinear{conv_1_weight, conv_1_bias, CHANNELS, CHANNELS * 3, convInputOrder(CHANNELS, 3)};
+	m_conv_2 = PackedLinear{conv_2_weight, conv_2_bias, CHANNELS, CHANNELS * 2, convInputOrder(CHANNELS, 2)};
+	m_l_pi_weight.assign(l_pi_weight, l_pi_weight + NUM_ACTIONS * 3 * HIDDEN);
+	m_l_pi_bias.assign(l_pi_bias, l_pi_bias + NUM_ACTIONS);
+}
+
+void G2048NativeModel::predict(const Weights& weights, const std::vector<std::reference_wrapper<const G2048Env::Observation>>& boards, ranges::span<float> policies)
+{
+	assert(static_cast<std::size_t>(policies.size()) == boards.size() * NUM_ACTIONS);
+	m_raw_active.resize(BOARD_BLOCK * ORIENTATIONS * CELLS);
+	m_conv_active.resize(BOARD_BLOCK * ORIENTATIONS * POSITIONS * CELLS);
+	m_h0_hidden.resize(BOARD_BLOCK * ORIENTATIONS * HIDDEN);
+	m_h0.resize(BOARD_BLOCK * ORIENTATIONS * HIDDEN);
+	m_h1_hidden.resize(BOARD_BLOCK * ORIENTATIONS * POSITIONS * CONV_HIDDEN);
+	m_h1.resize(BOARD_BLOCK * ORIENTATIONS * POSITIONS * CHANNELS);
+	m_conv_1_out.resize(BOARD_BLOCK * ORIENTATIONS * CONV_1_LENGTH * CHANNELS);
+	m_conv_2_out.resize(BOARD_BLOCK * ORIENTATIONS * CONV_2_LENGTH * CHANNELS);
+	m_h1_out.resize(BOARD_BLOCK * ORIENTATIONS * HIDDEN);
+	m_h2_out.resize(BOARD_BLOCK * ORIENTATIONS * HIDDEN);
+	m_logits.resize(BOARD_BLOCK * NUM_ACTIONS);
+	m_invalid.resize(BOARD_BLOCK * NUM_ACTIONS);
+	for (std::size_t first = 0; first < boards.size(); first += BOARD_BLOCK) {
+		const auto num_boards = std::min(BOARD_BLOCK, boards.size() - first);
+		predictBlock(weights, boards.data() + first, num_boards, policies.data() + first * NUM_ACTIONS);
+	}
+}
+
+void G2048NativeModel::predictBlock(const Weights& weights, const std::reference_wrapper<const G2048Env::Observation>* boards, std::size_t num_boards, float* policies)
+{
+	const auto rows = num_boards * ORIENTATIONS;
+	// the active inputs of l_1 (number * 16 + cell) and of l_3 (feature * 16 + cell) per orientation and position
+	for (std::size_t b = 0; b < num_boards; ++b) {
+		const auto& board = boards[b].get();
+		for (std::size_t d = 0; d < ORIENTATIONS; ++d) {
+			const auto row = b * ORIENTATIONS + d;
+			for (std::size_t cell = 0; cell < CELLS; ++cell) {
+				const auto source = ORIENTATION_INDEX[d][cell];
+				const std::size_t number = board[source / BOARD_SIZE][source % BOARD_SIZE];
+				m_raw_active[row * CELLS + cell] = static_cast<std::uint16_t>(number * CELLS + cell);
+				for (std::size_t n = 0; n < POSITIONS; ++n) {
+					// exact numbers n + 1 .. n + 3, then empty, smaller and larger
+					std::size_t feature;
+					if (number == 0) {
+						feature = G2048Env::CONV_KERNEL_SIZE;
+					} else if (number < n + 1) {
+						feature = G2048Env::CONV_KERNEL_SIZE + 1;
+					} else if (number >= n + 1 + G2048Env::CONV_KERNEL_SIZE) {
+						feature = G2048Env::CONV_KERNEL_SIZE + 2;
+					} else {
+						feature = number - n - 1;
+					}
+					m_conv_active[(row * POSITIONS + n) * CELLS + cell] = static_cast<std::uint16_t>(feature * CELLS + cell);
+				}
+			}
+		}
+		for (std::size_t a = 0; a < NUM_ACTIONS; ++a) {
+			m_invalid[b * NUM_ACTIONS + a] = (G2048Env::isValidActionFor(board, DiscreteActionTraits<G2048Env::Action>::convertFromID(static_cast<std::int64_t>(a))) ? 0 : 1);
+		}
+	}
+
+	// h0 = leaky_relu(l_2(leaky_relu(l_1(raw))))
+	for (std::size_t row = 0; row < rows; ++row) {
+		weights.m_l_1.forward(m_raw_active.data() + row * CELLS, CELLS, m_h0_hidden.data() + row * HIDDEN, Activation::LEAKY_RELU);
+	}
+	weights.m_l_2.forward(m_h0_hidden.data(), rows, HIDDEN, m_h0.data(), HIDDEN, Activation::LEAKY_RELU);
+
+	// h1 = leaky_relu(l_4(leaky_relu(l_3(conv)))), (position, channel) per orientation
+	for (std::size_t row = 0; row < rows * POSITIONS; ++row) {
+		weights.m_l_3.forward(m_conv_active.data() + row * CELLS, CELLS, m_h1_hidden.data() + row * CONV_HIDDEN, Activation::LEAKY_RELU);
+	}
+	weights.m_l_4.forward(m_h1_hidden.data(), rows * POSITIONS, CONV_HIDDEN, m_h1.data(), CHANNELS, Activation::LEAKY_RELU);
+
+	// the convolutions over the positions of an orientation: the kernel_size positions of an output are one
+	// contiguous run of the (position, channel) activations, so the rows overlap and nothing is copied
+	for (std::size_t row = 0; row < rows; ++row) {
+		weights.m_conv_1.forward(m_h1.data() + row * POSITIONS * CHANNELS, CONV_1_LENGTH, CHANNELS, m_conv_1_out.data() + row * CONV_1_LENGTH * CHANNELS, CHANNELS, Activation::LEAKY_RELU);
+		weights.m_conv_2.forward(m_conv_1_out.data() + row * CONV_1_LENGTH * CHANNELS, CONV_2_LENGTH, CHANNELS, m_conv_2_out.data() + row * CONV_2_LENGTH * CHANNELS, CHANNELS, Activation::LEAKY_RELU);
+	}
+	weights.m_l_5.forward(m_h1.data(), rows, POSITIONS * CHANNELS, m_h1_out.data(), HIDDEN, Activation::LEAKY_RELU);
+	weights.m_l_6.forward(m_conv_2_out.data(), rows, CONV_2_LENGTH * CHANNELS, m_h2_out.data(), HIDDEN, Activation::LEAKY_RELU);
+
+	// l_pi on cat(h0, h1, h2) per orientation, rotated back to the board and summed over the orientations
+	std::fill(m_logits.begin(), m_logits.end(), 0.0f);
+	for (std::size_t b = 0; b < num_boards; ++b) {
+		for (std::size_t d = 0; d < ORIENTATIONS; ++d) {
+			const auto row = b * ORIENTATIONS + d;
+			const float* hidden[3] = {m_h0.data() + row * HIDDEN, m_h1_out.data() + row * HIDDEN, m_h2_out.data() + row * HIDDEN};
+			float pi[NUM_ACTIONS];
+			for (std::size_t a = 0; a < NUM_ACTIONS; ++a) {
+				const float* w = weights.m_l_pi_weight.data() + a * 3 * HIDDEN;
+				float sum = weights.m_l_pi_bias[a];
+				for (std::size_t part = 0; part < 3; ++part) {
+					for (std::size_t i = 0; i < HIDDEN; ++i) {
+						sum += w[part * HIDDEN + i] * hidden[part][i];
+					}
+				}
+				pi[a] = sum;
+			}
+			for (std::size_t a = 0; a < NUM_ACTIONS; ++a) {
+				m_logits[b * NUM_ACTIONS + a] += pi[ROTATION[d][a]];
+			}
+		}
+	}
+	maskedSoftmax(m_logits.data(), m_invalid.data(), num_boards, NUM_ACTIONS, policies);
+}
+
+}  // namespace impala
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <range/v3/span.hpp>
+
+#include "native_kernels.hpp"
+#include "envs/g2048/g2048_env.hpp"
+
+namespace impala
+{
+
+// The policy of models/g2048_a3c_model.py computed in C++ on the calling thread, so that predictors do not wait for
+// the GIL. It reads the boards instead of the encodings of G2048Env: every cell has exactly one active input of l_1
+// and of l_3, so both layers are sums of weight columns, and the other layers run through the packed kernels of
+// native_kernels.hpp. The value head is not computed.
+class G2048NativeModel
+{
+	static inline constexpr std::size_t CELLS = G2048Env::BOARD_SIZE * G2048Env::BOARD_SIZE;
+	static inline constexpr std::size_t ORIENTATIONS = 8;
+	static inline constexpr std::size_t RAW_INPUTS = (G2048Env::MAX_NUMBER + 1) * CELLS;
+	static inline constexpr std::size_t POSITIONS = G2048Env::MAX_NUMBER - G2048Env::CONV_KERNEL_SIZE + 1;
+	static inline constexpr std::size_t CONV_INPUTS = (G2048Env::CONV_KERNEL_SIZE + 3) * CELLS;
+	static inline constexpr std::size_t HIDDEN = 512;
+	static inline constexpr std::size_t CONV_HIDDEN = 128;
+	static inline constexpr std::size_t CHANNELS = 64;
+	static inline constexpr std::size_t CONV_1_LENGTH = POSITIONS - 2;
+	static inline constexpr std::size_t CONV_2_LENGTH = CONV_1_LENGTH - 1;
+
+public:
+	static inline constexpr std::size_t NUM_ACTIONS = DiscreteActionTraits<G2048Env::Action>::num_actions;
+	// torch.nn.utils.parameters_to_vector(model.parameters()), the layout of PythonAgent::exportWeights and of the
+	// weights.bin file of a checkpoint
+	static inline constexpr std::size_t NUM_WEIGHTS = (RAW_INPUTS + 1) * HIDDEN + (HIDDEN + 1) * HIDDEN
+	    + (CONV_INPUTS + 1) * CONV_HIDDEN + (CONV_HIDDEN + 1) * CHANNELS
+	    + (POSITIONS * CHANNELS + 1) * HIDDEN + (CONV_2_LENGTH * CHANNELS + 1) * HIDDEN
+	    + (CHANNELS * 3 + 1) * CHANNELS + (CHANNELS * 2 + 1) * CHANNELS
+	    + (3 * HIDDEN + 1) * NUM_ACTIONS + (3 * HIDDEN + 1);
+
+	// the packed layers, shared read-only by every predictor that runs the model
+	class Weights
+	{
+	public:
+		// throws InferenceModelError if weights does not hold NUM_WEIGHTS values
+		explicit Weights(ranges::span<const float> weights);
+
+	private:
+		friend class G2048NativeModel;
+
+		OneHotLinear m_l_1;
+		PackedLinear m_l_2;
+		OneHotLinear m_l_3;
+		PackedLinear m_l_4;
+		PackedLinear m_l_5;
+		PackedLinear m_l_6;
+		PackedLinear m_conv_1;
+		PackedLinear m_conv_2;
+		// NUM_ACTIONS x 3 * HIDDEN
+		std::vector<float> m_l_pi_weight;
+		std::vector<float> m_l_pi_bias;
+	};
+
+	// writes NUM_ACTIONS probabilities per board to policies, 0 for the moves that do not change the board
+	void predict(const Weights& weights, const std::vector<std::reference_wrapper<const G2048Env::Observation>>& boards, ranges::span<float> policies);
+
+private:
+	void predictBlock(const Weights& weights, const std::reference_wrapper<const G2048Env::Observation>* boards, std::size_t num_boards, float* policies);
+
+	// boards per pass through the layers, so that the activations of a pass stay in L2
+	static inline constexpr std::size_t BOARD_BLOCK = 8;
+
+	// scratch buffers of one pass, reused between calls
+	std::vector<std::uint16_t> m_raw_active;
+	std::vector<std::uint16_t> m_conv_active;
+	std::vector<float> m_h0_hidden;
+	std::vector<float> m_h0;
+	std::vector<float> m_h1_hidden;
+	std::vector<float> m_h1;
+	std::vector<float> m_conv_1_out;
+	std::vector<float> m_conv_2_out;
+	std::vector<float> m_h1_out;
+	std::vector<float> m_h2_out;
+	std::vector<float> m_logits;
+	std::vector<std::uint8_t> m_invalid;
+};
+
+}  // namespace impala
@@ -1,5 +1,7 @@
 from .softmax import (softmax_and_log_softmax, masked_softmax,
-                      masked_log_softmax, masked_softmax_and_log_softmax)
+                      masked_log_softmax, masked_softmax_and_log_softmax,
+                      masked_softmax_for_trace)
 
 __all__ = ['softmax_and_log_softmax', 'masked_softmax',
-           'masked_log_softmax', 'masked_softmax_and_log_softmax', ]
+           'masked_log_softmax', 'masked_softmax_and_log_softmax',
+           'masked_softmax_for_trace', ]
@@ -59,6 +59,15 @@ def masked_softmax(input, invalid_target_mask, dim):
     return MaskedSoftMax.apply(input, invalid_target_mask, dim)
 
 
+def masked_softmax_for_trace(input, invalid_target_mask, dim):
+    # the forward of MaskedSoftMax with plain operations, which torch.jit.trace can save
+    invalid = invalid_target_mask.bool()
+    masked_input = input - invalid.to(input.dtype) * _very_large_value
+    max, _ = masked_input.max(dim=dim, keepdim=True)
+    exp = torch.exp(masked_input - max).masked_fill(invalid, 0)
+    return exp / exp.sum(dim=dim, keepdim=True)
+
+
 class MaskedLogSoftMax(torch.autograd.Function):
     @staticmethod
     def forward(ctx, input, invalid_target_mask, dim):
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+namespace impala
+{
+
+// bucket 0 holds the value 0, bucket i (i >= 1) holds values in [2^(i-1), 2^i)
+class Log2Histogram
+{
+public:
+	static inline constexpr std::size_t NUM_BUCKETS = 64;
+
+	void add(std::uint64_t value) noexcept
+	{
+		m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_sum.fetch_add(value, std::memory_order_relaxed);
+		auto current_max = m_max.load(std::memory_order_relaxed);
+		while (current_max < value && !m_max.compare_exchange_weak(current_max, value, std::memory_order_relaxed)) {
+		}
+	}
+
+	std::uint64_t count() const noexcept
+	{
+		return m_count.load(std::memory_order_relaxed);
+	}
+	double mean() const noexcept
+	{
+		auto n = count();
+		return n == 0 ? 0.0 : static_cast<double>(m_sum.load(std::memory_order_relaxed)) / static_cast<double>(n);
+	}
+	std::uint64_t max() const noexcept
+	{
+		return m_max.load(std::memory_order_relaxed);
+	}
+	// returns the upper bound of the bucket containing the given quantile
+	std::uint64_t quantile(double q) const noexcept
+	{
+		auto n = count();
+		if (n == 0) {
+			return 0;
+		}
+		auto threshold = static_cast<std::uint64_t>(q * static_cast<double>(n));
+		std::uint64_t accumulated = 0;
+		for (std::size_t i = 0; i < NUM_BUCKETS; ++i) {
+			accumulated += m_buckets[i].load(std::memory_order_relaxed);
+			if (accumulated > threshold) {
+				return i == 0 ? 0 : (std::uint64_t{1} << i) - 1;
+			}
+		}
+		return max();
+	}
+
+	void reset() noexcept
+	{
+		for (auto&& bucket : m_buckets) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+		m_count.store(0, std::memory_order_relaxed);
+		m_sum.store(0, std::memory_order_relaxed);
+		m_max.store(0, std::memory_order_relaxed);
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, const Log2Histogram& histogram)
+	{
+		os << "mean " << histogram.mean() << " p50 " << histogram.quantile(0.5) << " p90 " << histogram.quantile(0.9) << " p99 " << histogram.quantile(0.99) << " max " << histogram.max();
+		return os;
+	}
+
+private:
+	static std::size_t bucketOf(std::uint64_t value) noexcept
+	{
+		std::size_t bucket = 0;
+		while (value != 0 && bucket + 1 < NUM_BUCKETS) {
+			value >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+
+	std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> m_buckets{};
+	std::atomic<std::uint64_t> m_count{0};
+	std::atomic<std::uint64_t> m_sum{0};
+	std::atomic<std::uint64_t> m_max{0};
+};
+
+}  // namespace impala
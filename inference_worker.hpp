@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/container/vector.hpp>
+#include <range/v3/span.hpp>
+
+#include "action.hpp"
+#include "agent.hpp"
+#include "batch_pool.hpp"
+#include "environment.hpp"
+#include "shm_ring.hpp"
+#include "weight_snapshot.hpp"
+#include "worker_process.hpp"
+
+namespace impala
+{
+
+// command line flag that makes train2048 run as an inference worker on the given shared memory object
+inline constexpr const char* INFERENCE_WORKER_FLAG = "--inference-worker=";
+
+// A request is followed by every buffer of the ObsBatch, each as its byte count (std::uint64_t) and its data.
+struct InferenceRequestHeader
+{
+	std::uint64_t sequence;
+	std::uint64_t batch_size;
+};
+// followed by batch_size * num_actions policies
+struct InferenceResponseHeader
+{
+	std::uint64_t sequence;
+	// of the weights the batch was predicted with
+	std::uint64_t model_version;
+};
+
+struct alignas(64) InferenceWorkerHeader
+{
+	static inline constexpr std::uint64_t MAGIC = 0x696d70616c616977ull;
+
+	std::uint64_t magic;
+	std::uint64_t num_actions;
+	std::uint64_t request_capacity;
+	std::uint64_t response_capacity;
+	// the shared memory object the weights are published to, see weight_snapshot.hpp
+	char weight_snapshot[64];
+	std::atomic<std::uint32_t> exit_flag;
+};
+
+// The shared memory object of one inference worker: the header followed by the request ring, written by the
+// server, and the response ring, written by the worker.
+class InferenceWorkerChannels
+{
+public:
+	static InferenceWorkerChannels create(const std::string& name, const std::string& weight_snapshot, std::size_t num_actions, std::size_t request_capacity, std::size_t response_capacity)
+	{
+		if (weight_snapshot.size() >= sizeof(InferenceWorkerHeader::weight_snapshot)) {
+			throw SharedMemoryError("the name " + weight_snapshot + " is too long");
+		}
+		request_capacity = roundUp(request_capacity);
+		response_capacity = roundUp(response_capacity);
+		auto memory = SharedMemory::create(name, sizeof(InferenceWorkerHeader) + SpscRing::requiredBytes(request_capacity) + SpscRing::requiredBytes(response_capacity));
+		auto* header = new (memory.data()) InferenceWorkerHeader{};
+		header->magic = InferenceWorkerHeader::MAGIC;
+		header->num_actions = num_actions;
+		header->request_capacity = request_capacity;
+		header->response_capacity = response_capacity;
+		weight_snapshot.copy(header->weight_snapshot, weight_snapshot.size());
+		header->exit_flag.store(0, std::memory_order_relaxed);
+		return InferenceWorkerChannels{std::move(memory), true};
+	}
+
+	static InferenceWorkerChannels open(const std::string& name, std::size_t num_actions)
+	{
+		auto memory = SharedMemory::open(name);
+		const auto* header = static_cast<const InferenceWorkerHeader*>(memory.data());
+		if (memory.size() < sizeof(InferenceWorkerHeader) || header->magic != InferenceWorkerHeader::MAGIC || header->num_actions != num_actions) {
+			throw SharedMemoryError(name + " is not an inference worker channel of this environment");
+		}
+		return InferenceWorkerChannels{std::move(memory), false};
+	}
+
+	InferenceWorkerHeader& header() const noexcept
+	{
+		return *static_cast<InferenceWorkerHeader*>(m_memory.data());
+	}
+	SpscRing& requests() noexcept
+	{
+		return m_requests;
+	}
+	SpscRing& responses() noexcept
+	{
+		return m_responses;
+	}
+	const std::string& name() const noexcept
+	{
+		return m_memory.name();
+	}
+
+	// only while no worker is attached
+	void reset() noexcept
+	{
+		m_requests.reset();
+		m_responses.reset();
+		header().exit_flag.store(0, std::memory_order_release);
+	}
+
+private:
+	static std::size_t roundUp(std::size_t bytes) noexcept
+	{
+		return (bytes + 63) / 64 * 64;
+	}
+
+	InferenceWorkerChannels(SharedMemory&& memory, bool initialize) noexcept
+	    : m_memory(std::move(memory)),
+	      m_requests(ringAt(0), header().request_capacity, initialize),
+	      m_responses(ringAt(SpscRing::requiredBytes(header().request_capacity)), header().response_capacity, initialize)
+	{}
+
+	void* ringAt(std::size_t offset) const noexcept
+	{
+		return static_cast<std::byte*>(m_memory.data()) + sizeof(InferenceWorkerHeader) + offset;
+	}
+
+	SharedMemory m_memory;
+	SpscRing m_requests;
+	SpscRing m_responses;
+};
+
+// Entry point of an inference worker process. Predicts the batches of the request ring with its own copy of
+// the model, taking the latest weight snapshot before every batch, until the server sets the exit flag or dies.
+// Returns the process exit code.
+template <class Environment, class Agent>
+int runInferenceWorker(const std::string& name, Agent& agent)
+{
+	using Action = typename Environment::Action;
+	static constexpr auto NUM_ACTIONS = DiscreteActionTraits<Action>::num_actions;
+	static_assert(IsAgentForGivenEnvironmentV<Agent, Environment>);
+
+	if (!bindToParentProcess()) {
+		return 1;
+	}
+	std::optional<InferenceWorkerChannels> channels;
+	std::optional<WeightSnapshotReader> snapshot;
+	try {
+		channels.emplace(InferenceWorkerChannels::open(name, NUM_ACTIONS));
+		snapshot.emplace(channels->header().weight_snapshot);
+	} catch (const SharedMemoryError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	auto& header = channels->header();
+	auto exiting = [&] { return header.exit_flag.load(std::memory_order_acquire) != 0; };
+
+	typename Environment::ObsBatch states;
+	std::vector<float> weights;
+	std::vector<float> policies;
+	std::uint64_t model_version = 0;
+	while (!exiting()) {
+		std::size_t size = 0;
+		const auto* record = channels->requests().peek(size);
+		if (record == nullptr) {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			if (::getppid() == 1) {
+				return 1;
+			}
+			continue;
+		}
+		InferenceRequestHeader request;
+		std::memcpy(&request, record, sizeof(request));
+		const auto* data = record + sizeof(request);
+		forEachBuffer(
+		    [&](auto& buffer) {
+			    using T = typename std::decay_t<decltype(buffer)>::value_type;
+			    std::uint64_t bytes;
+			    std::memcpy(&bytes, data, sizeof(bytes));
+			    data += sizeof(bytes);
+			    buffer.resize(bytes / sizeof(T), boost::container::default_init);
+			    std::memcpy(buffer.data(), data, bytes);
+			    data += bytes;
+		    },
+		    states);
+		channels->requests().discard();
+
+		if (snapshot->tryRead(weights, model_version)) {
+			agent.importWeights({weights.data(), static_cast<std::ptrdiff_t>(weights.size())});
+		}
+		policies.resize(request.batch_size * NUM_ACTIONS);
+		agent.template predict<NUM_ACTIONS>(states, {policies.data(), static_cast<std::ptrdiff_t>(policies.size())}, [] {});
+		agent.sync();
+		const InferenceResponseHeader response{request.sequence, model_version};
+		const SpscRing::Piece pieces[] = {{&response, sizeof(response)}, {policies.data(), policies.size() * sizeof(float)}};
+		while (!channels->responses().tryPush(pieces, 2)) {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+			if (exiting()) {
+				return 0;
+			}
+		}
+	}
+	return 0;
+}
+
+}  // namespace impala
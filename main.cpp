@@ -1,18 +1,40 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <range/v3/view/indices.hpp>
 
 #include "action.hpp"
+#include "actor_worker.hpp"
+#include "autotune.hpp"
 #include "environment.hpp"
+#include "inference_worker.hpp"
+#include "policy_server.hpp"
 #include "python_agent.hpp"
 #include "python_util.hpp"
 #include "server.hpp"
 #include "tensor.hpp"
+#include "torch_script_model.hpp"
+#include "train_config.hpp"
+#include "trajectory_log.hpp"
 
 #ifdef IMPALA_USE_GUI_VIEWER
 #include "viewer/gl_util.hpp"
 #endif
 
 #include "envs/g2048/g2048_env.hpp"
+#include "envs/g2048/g2048_native_model.hpp"
 
 
 struct G2048TrainParams
@@ -29,6 +51,37 @@ struct G2048TrainParams
 	static inline constexpr std::size_t T_MAX = 12;
 	static inline constexpr std::optional<std::size_t> MAX_EPISODE_LENGTH = std::nullopt;
 	static inline constexpr float DISCOUNT = 0.99f;
+	static inline constexpr float LEARNING_RATE = 0.01f;
+
+	static inline constexpr std::size_t NUM_LEARNERS = 1;
+	static inline constexpr std::optional<std::size_t> ACTOR_REASSIGN_INTERVAL_STEPS = std::nullopt;
+
+	static inline constexpr std::optional<std::size_t> MAX_POLICY_LAG = 32;
+	static inline constexpr impala::StaleDataPolicy STALE_DATA_POLICY = impala::StaleDataPolicy::DEPRIORITIZE;
+
+	// about 28 bytes per replayed step
+	static inline constexpr std::size_t REPLAY_CAPACITY = 0;
+	static inline constexpr double REPLAY_FRACTION = 0.0;
+
+	static inline constexpr std::optional<double> SAMPLES_PER_INSERT = 1.0;
+	static inline constexpr double SAMPLES_PER_INSERT_TOLERANCE = 2.0 * NUM_TRAINERS * MAX_TRAINING_BATCH_SIZE * T_MAX;
+
+	static inline constexpr std::size_t NUM_ACTOR_WORKERS = 0;
+	static inline constexpr std::size_t ENVS_PER_ACTOR_WORKER = 512;
+
+	static inline constexpr std::size_t NUM_INFERENCE_WORKERS = 0;
+	static inline constexpr std::size_t WEIGHT_PUBLISH_INTERVAL = 4;
+
+	static inline constexpr bool PIN_THREADS = false;
+	static inline constexpr std::optional<std::size_t> NUM_PYTHON_THREADS = 4;
+
+	static inline constexpr std::size_t NUM_BATCH_THREADS = 8;
+	static inline constexpr std::size_t MIN_BATCH_CHUNK_SIZE = 128;
+
+	static inline constexpr bool REUSE_ENCODINGS = true;
+
+	// a training batch is about 180 MB and a prediction batch kept alive for REUSE_ENCODINGS about 56 MB
+	static inline constexpr std::optional<std::size_t> BATCH_MEMORY_BUDGET = std::size_t{4} << 30;
 
 	static inline constexpr double AVERAGE_LOSS_DECAY = 0.99;
 	static inline constexpr std::optional<std::size_t> LOG_INTERVAL_STEPS = 100000;
@@ -38,18 +91,36 @@ struct G2048TrainParams
 struct G2048AgentTraits : impala::FloatRewardTraits, impala::A3CLossTraits
 {
 	using Environment = impala::G2048Env;
+	// reads the boards, so it serves the compact observations as well
+	using InferenceModel = impala::G2048NativeModel;
 
 	static boost::python::object create(boost::python::object& main_ns)
 	{
 		boost::python::exec("from models.g2048_a3c_model import G2048A3CModel", main_ns);
 		boost::python::exec("from agents import Impala", main_ns);
 		boost::python::exec("import torch.optim as optim", main_ns);
+		// before the model initializes its weights
+		boost::python::exec("import os\n"
+		                    "import torch\n"
+		                    "if DETERMINISTIC:\n"
+		                    "    os.environ.setdefault('CUBLAS_WORKSPACE_CONFIG', ':4096:8')\n"
+		                    "    torch.use_deterministic_algorithms(True)\n"
+		                    "    torch.backends.cudnn.benchmark = False\n"
+		                    "if SEED is not None:\n"
+		                    "    torch.manual_seed(SEED + (LEARNER or 0))\n",
+		    main_ns);
+		const boost::python::object learning_rate = main_ns["LEARNING_RATE"];
+		if (learning_rate.is_none()) {
+			main_ns["LEARNING_RATE"] = G2048TrainParams::LEARNING_RATE;
+		}
 		boost::python::exec("def make_optimizer(parameters):\n"
-		                    "    return optim.RMSprop(parameters, lr=0.01, alpha=0.95, eps=0.1)\n",
+		                    "    return optim.RMSprop(parameters, lr=LEARNING_RATE, alpha=0.95, eps=0.1)\n"
+		                    "OUTPUT_DIR = 'output' if LEARNER is None else f'output/learner{LEARNER}'\n",
 		    main_ns);
 		auto model = main_ns["G2048A3CModel"]();
 		auto optimizer_maker = boost::python::eval("make_optimizer", main_ns);
-		return main_ns["Impala"](model, optimizer_maker, impala::USE_CUDA);
+		auto output_dir = boost::python::eval("OUTPUT_DIR", main_ns);
+		return main_ns["Impala"](model, optimizer_maker, impala::USE_CUDA, output_dir);
 	}
 
 	static boost::python::object convertObsBatch(Environment::ObsBatch& batch, std::size_t batch_size)
@@ -61,17 +132,431 @@ struct G2048AgentTraits : impala::FloatRewardTraits, impala::A3CLossTraits
 	}
 };
 
-int main()
+struct G2048CompactAgentTraits : G2048AgentTraits
 {
-#ifdef IMPALA_USE_GUI_VIEWER
-	viewer::GlfwInitializer glfw_initializer;
+	using Environment = impala::G2048CompactEnv;
+
+	static boost::python::object convertObsBatch(Environment::ObsBatch& batch, std::size_t batch_size)
+	{
+		return boost::python::make_tuple(
+		    Environment::BoardTraits::convertToBatchedNdArray(std::get<0>(batch), batch_size),
+		    Environment::InvalidMaskTraits::convertToBatchedNdArray(std::get<1>(batch), batch_size));
+	}
+};
+
+#ifdef IMPALA_USE_LIBTORCH
+// the predictors run a TorchScript trace of the Python model instead of G2048NativeModel
+struct G2048TorchScriptAgentTraits : G2048AgentTraits
+{
+	using InferenceModel = impala::TorchScriptModel<impala::G2048Env>;
+};
+
+struct G2048CompactTorchScriptAgentTraits : G2048CompactAgentTraits
+{
+	using InferenceModel = impala::TorchScriptModel<impala::G2048CompactEnv>;
+};
 #endif
+
+template <class AgentTraits>
+int train(const impala::TrainConfig& config, std::size_t training_steps, const std::optional<double>& autotune_seconds, const std::string& autotune_output, const std::optional<std::string>& inference_worker, const std::vector<int>& worker_cpus)
+{
 	using namespace impala;
+	using Agent = PythonAgent<AgentTraits>;
+	using TrainServer = Server<typename AgentTraits::Environment, Agent, G2048TrainParams>;
+
+	TrainServer::prepareProcess(config, inference_worker.has_value() ? std::optional{worker_cpus} : std::nullopt);
 	PythonInitializer py_initializer{false};
 
-	using Agent = PythonAgent<G2048AgentTraits>;
+	if (inference_worker.has_value()) {
+		Agent agent;
+		return runInferenceWorker<typename AgentTraits::Environment>(inference_worker.value(), agent);
+	}
+
+	if (autotune_seconds.has_value()) {
+		if (config.num_learners != 1 || config.offline_trajectories.has_value() || config.resume) {
+			std::cerr << "autotune needs num_learners = 1 and actors, and does not resume" << std::endl;
+			return 1;
+		}
+		auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(autotune_seconds.value()));
+		auto best_config = autotune<TrainServer>(config, budget, [&config] { return std::make_unique<Agent>(std::nullopt, std::nullopt, false, config.learning_rate); });
+		best_config.save(autotune_output);
+		std::cout << "autotune : best configuration written to " << autotune_output << std::endl;
+		return 0;
+	}
+
+	try {
+		if (config.num_learners == 1) {
+			auto server = std::make_unique<TrainServer>(std::make_unique<Agent>(std::nullopt, config.seed, config.deterministic, config.learning_rate), config);
+			server->train(training_steps);
+			return 0;
+		}
+		std::vector<std::unique_ptr<Agent>> agents;
+		for (auto&& i : ranges::view::indices(config.num_learners)) {
+			agents.push_back(std::make_unique<Agent>(i, config.seed, config.deterministic, config.learnerLearningRate(i)));
+		}
+		auto server = std::make_unique<TrainServer>(std::move(agents), config);
+		server->train(training_steps);
+	} catch (const TrajectoryLogError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	} catch (const CheckpointError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	} catch (const InferenceModelError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// answers moves for boards on a local socket with the model of a checkpoint
+template <class AgentTraits>
+int serve(const impala::ServingConfig& serving_config, std::int64_t checkpoint)
+{
+	using namespace impala;
+	using Agent = PythonAgent<AgentTraits>;
+
+	PythonInitializer py_initializer{false};
 	auto agent = std::make_unique<Agent>();
-	auto server = std::make_unique<Server<G2048Env, Agent, G2048TrainParams>>(std::move(agent));
-	server->train(4000000000);
+	agent->load(checkpoint);
+	try {
+		PolicyServer<typename AgentTraits::Environment, Agent> server{std::move(agent), serving_config};
+		server.run();
+	} catch (const SocketError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
 	return 0;
 }
+
+// the boards of random games
+std::vector<impala::G2048Env::Observation> playRandomGames(std::size_t num_boards)
+{
+	using namespace impala;
+	G2048Env env;
+	std::mt19937 random_engine{std::random_device{}()};
+	std::vector<G2048Env::Observation> boards;
+	boards.reserve(num_boards);
+	auto observation = env.reset();
+	while (boards.size() < num_boards) {
+		boards.push_back(observation.clone());
+		std::vector<G2048Env::Action> valid_actions;
+		for (auto id : ranges::view::indices(DiscreteActionTraits<G2048Env::Action>::num_actions)) {
+			auto action = DiscreteActionTraits<G2048Env::Action>::convertFromID(static_cast<std::int64_t>(id));
+			if (env.isValidAction(action)) {
+				valid_actions.push_back(action);
+			}
+		}
+		auto action = valid_actions.at(std::uniform_int_distribution<std::size_t>{0, valid_actions.size() - 1}(random_engine));
+		auto&& [next_obs, reward, status] = env.step(action);
+		observation = (status == EnvState::FINISHED ? env.reset() : std::move(next_obs));
+	}
+	return boards;
+}
+
+// plays random games and checks that the model expands compact batches to exactly the full encoding
+int verifyCompactEncoding(std::size_t num_boards)
+{
+	using namespace impala;
+	const auto boards = playRandomGames(num_boards);
+	G2048Env::ObsBatch full_batch;
+	G2048CompactEnv::ObsBatch compact_batch;
+	G2048Env::makeBatch(boards.cbegin(), boards.cend(), full_batch);
+	G2048CompactEnv::makeBatch(boards.cbegin(), boards.cend(), compact_batch);
+
+	PythonInitializer py_initializer{false};
+	try {
+		auto main_ns = makePythonMainNameSpace();
+		boost::python::exec("from models.g2048_a3c_model import G2048A3CModel", main_ns);
+		auto model = main_ns["G2048A3CModel"]();
+		long mismatches = boost::python::extract<long>(model.attr("count_encoding_mismatches")(
+		    G2048AgentTraits::convertObsBatch(full_batch, num_boards),
+		    G2048CompactAgentTraits::convertObsBatch(compact_batch, num_boards)));
+		std::cout << "compact encoding : " << mismatches << " mismatched elements in " << num_boards << " boards" << std::endl;
+		return mismatches == 0 ? 0 : 1;
+	} catch (const boost::python::error_already_set&) {
+		::PyErr_Print();
+		return 1;
+	}
+}
+
+// plays random games and compares the policies of the inference model of the traits (G2048NativeModel or
+// TorchScriptModel) with the ones of the Python model, with the weights of a checkpoint (its model.pth and
+// weights.bin) or of a new model
+template <class AgentTraits>
+int verifyInferenceModel(const std::string& name, std::size_t num_boards, const std::optional<std::int64_t>& checkpoint)
+{
+	using namespace impala;
+	using Agent = PythonAgent<AgentTraits>;
+	using InferenceModel = typename Agent::InferenceModel;
+	// float32 sums in another order
+	static constexpr float TOLERANCE = 1e-4f;
+
+	const auto boards = playRandomGames(num_boards);
+	PythonInitializer py_initializer{false};
+	try {
+		Agent agent;
+		std::vector<float> exported;
+		if (checkpoint.has_value()) {
+			agent.load(checkpoint.value());
+			const auto data = readCheckpointFile(agent.outputDirectory() + "/" + std::to_string(checkpoint.value()) + "/weights.bin");
+			exported.resize(data.size() / sizeof(float));
+			std::memcpy(exported.data(), data.data(), exported.size() * sizeof(float));
+		} else {
+			agent.exportWeights(exported);
+		}
+		if constexpr (HasInferenceModelPrepare<InferenceModel, Agent>::value) {
+			InferenceModel::prepare(agent);
+		}
+		const typename InferenceModel::Weights weights{{exported.data(), static_cast<std::ptrdiff_t>(exported.size())}};
+		constexpr auto num_actions = G2048NativeModel::NUM_ACTIONS;
+		G2048Env::ObsBatch batch;
+		G2048Env::makeBatch(boards.cbegin(), boards.cend(), batch);
+		std::vector<float> expected(num_boards * num_actions);
+		agent.template predict<num_actions>(batch, {expected.data(), static_cast<std::ptrdiff_t>(expected.size())}, [] {});
+		agent.sync();
+
+		InferenceModel model;
+		const std::vector<std::reference_wrapper<const G2048Env::Observation>> board_refs(boards.begin(), boards.end());
+		std::vector<float> actual(num_boards * num_actions);
+		model.predict(weights, board_refs, {actual.data(), static_cast<std::ptrdiff_t>(actual.size())});
+		float max_difference = 0.0f;
+		for (auto i : ranges::view::indices(expected.size())) {
+			max_difference = std::max(max_difference, std::abs(expected[i] - actual[i]));
+		}
+		std::cout << name << " inference : max difference " << max_difference << " of the policies of " << num_boards << " boards" << std::endl;
+		return max_difference <= TOLERANCE ? 0 : 1;
+	} catch (const CheckpointError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	} catch (const InferenceModelError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}
+
+// boards per second of num_threads threads that each call the predict of make_predictor() on batches of batch_size
+// boards until duration has passed
+template <class MakePredictor>
+double measureThroughput(std::size_t num_threads, std::size_t batch_size, std::chrono::duration<double> duration, MakePredictor make_predictor)
+{
+	std::atomic<std::size_t> num_batches{0};
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+	std::vector<std::thread> threads;
+	for (std::size_t i = 0; i < num_threads; ++i) {
+		threads.emplace_back([&] {
+			auto predict = make_predictor();
+			std::size_t batches = 0;
+			for (; std::chrono::steady_clock::now() < deadline; ++batches) {
+				predict();
+			}
+			num_batches += batches;
+		});
+	}
+	for (auto&& thread : threads) {
+		thread.join();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return static_cast<double>(num_batches.load() * batch_size) / elapsed.count();
+}
+
+// the boards per second of the policies of the Python model through PythonAgent::predict, on the calling thread as the
+// server runs it, and of the inference models of native_inference on num_predictors threads, at batch sizes 64 to 1024
+int benchmarkInference(double seconds, std::size_t num_predictors)
+{
+	using namespace impala;
+	using Agent = PythonAgent<G2048AgentTraits>;
+	static constexpr std::size_t BATCH_SIZES[] = {64, 128, 256, 512, 1024};
+	constexpr auto num_actions = G2048NativeModel::NUM_ACTIONS;
+	const std::chrono::duration<double> duration{seconds};
+
+	const auto boards = playRandomGames(BATCH_SIZES[std::size(BATCH_SIZES) - 1]);
+	const std::vector<std::reference_wrapper<const G2048Env::Observation>> board_refs(boards.begin(), boards.end());
+	PythonInitializer py_initializer{false};
+	try {
+		Agent agent;
+		std::vector<float> exported;
+		agent.exportWeights(exported);
+		const ranges::span<const float> exported_span{exported.data(), static_cast<std::ptrdiff_t>(exported.size())};
+		const G2048NativeModel::Weights native_weights{exported_span};
+#ifdef IMPALA_USE_LIBTORCH
+		using TorchScript = TorchScriptModel<G2048Env>;
+		TorchScript::prepare(agent);
+		const TorchScript::Weights torch_script_weights{exported_span};
+#endif
+
+		std::cout << "boards/s\tpython\tnative x" << num_predictors;
+#ifdef IMPALA_USE_LIBTORCH
+		std::cout << "\ttorchscript x" << num_predictors;
+#endif
+		std::cout << std::endl;
+		for (auto batch_size : BATCH_SIZES) {
+			const std::vector<std::reference_wrapper<const G2048Env::Observation>> batch_refs(board_refs.begin(), board_refs.begin() + static_cast<std::ptrdiff_t>(batch_size));
+			// encoded for every batch like the batches of the server; PythonAgent pipelines a prediction with the next
+			// one, so the buffers alternate
+			G2048Env::ObsBatch python_batches[2];
+			std::vector<float> python_policies[2];
+			const auto python_throughput = measureThroughput(1, batch_size, duration, [&] {
+				return [&, next = std::size_t{0}]() mutable {
+					auto& policies = python_policies[next];
+					policies.resize(batch_size * num_actions);
+					G2048Env::makeBatch(batch_refs.begin(), batch_refs.end(), python_batches[next]);
+					agent.predict<num_actions>(python_batches[next], {policies.data(), static_cast<std::ptrdiff_t>(policies.size())}, [] {});
+					next = 1 - next;
+				};
+			});
+			agent.sync();
+			std::cout << batch_size << "\t" << std::fixed << std::setprecision(0) << python_throughput;
+
+			const auto native_throughput = measureThroughput(num_predictors, batch_size, duration, [&] {
+				return [&, model = G2048NativeModel{}, out = std::vector<float>(batch_size * num_actions)]() mutable {
+					model.predict(native_weights, batch_refs, {out.data(), static_cast<std::ptrdiff_t>(out.size())});
+				};
+			});
+			std::cout << "\t" << native_throughput;
+#ifdef IMPALA_USE_LIBTORCH
+			const auto torch_script_throughput = measureThroughput(num_predictors, batch_size, duration, [&] {
+				return [&, model = TorchScript{}, out = std::vector<float>(batch_size * num_actions)]() mutable {
+					model.predict(torch_script_weights, batch_refs, {out.data(), static_cast<std::ptrdiff_t>(out.size())});
+				};
+			});
+			std::cout << "\t" << torch_script_throughput;
+#endif
+			std::cout << std::endl;
+		}
+		return 0;
+	} catch (const InferenceModelError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	// workers are started by the server with this flag (and their cpus) only, before anything else is set up
+	if ((argc == 2 || argc == 3) && std::string(argv[1]).compare(0, std::string(impala::ACTOR_WORKER_FLAG).size(), impala::ACTOR_WORKER_FLAG) == 0) {
+		std::vector<int> cpus;
+		if (argc == 3 && std::string(argv[2]).compare(0, std::string(impala::WORKER_CPUS_FLAG).size(), impala::WORKER_CPUS_FLAG) == 0) {
+			cpus = impala::parseCpuList(argv[2] + std::string(impala::WORKER_CPUS_FLAG).size());
+		}
+		return impala::runActorWorker<impala::G2048Env>(argv[1] + std::string(impala::ACTOR_WORKER_FLAG).size(), cpus);
+	}
+#ifdef IMPALA_USE_GUI_VIEWER
+	viewer::GlfwInitializer glfw_initializer;
+#endif
+	using namespace impala;
+
+	auto config = TrainConfig::fromParameters<G2048TrainParams>();
+	std::size_t training_steps = 4000000000;
+	std::optional<double> autotune_seconds;
+	std::string autotune_output = "autotune.conf";
+	bool compact_observations = false;
+	std::optional<std::size_t> verify_boards;
+	std::optional<std::size_t> verify_native_boards;
+	std::optional<double> benchmark_seconds;
+	bool torch_script_inference = false;
+	// inference workers get the command line of the server, so that they build the same model
+	std::optional<std::string> inference_worker;
+	std::vector<int> worker_cpus;
+	ServingConfig serving_config;
+	std::optional<std::int64_t> checkpoint;
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+				throw ConfigError("usage: train2048 [--config=FILE] [--steps=N] [--autotune=SECONDS] [--autotune-output=FILE] [--observations=full|compact] [--verify-compact-encoding=BOARDS] [--verify-native-inference=BOARDS [--checkpoint=INDEX]] [--inference-model=native|torchscript] [--benchmark-inference=SECONDS] [--serve=SOCKET --checkpoint=INDEX [--latency-slo-us=N] [--serve-batch=N]] [--<config key>=VALUE]...");
+			}
+			auto key = arg.substr(2, eq - 2);
+			auto value = arg.substr(eq + 1);
+			if (key == "config") {
+				config.load(value);
+			} else if (key == "steps") {
+				training_steps = std::stoull(value);
+			} else if (key == "autotune") {
+				autotune_seconds = std::stod(value);
+			} else if (key == "autotune-output") {
+				autotune_output = value;
+			} else if (key == "observations") {
+				if (value != "full" && value != "compact") {
+					throw ConfigError("observations must be full or compact");
+				}
+				compact_observations = (value == "compact");
+			} else if (key == "verify-compact-encoding") {
+				verify_boards = std::stoull(value);
+			} else if (key == "verify-native-inference") {
+				verify_native_boards = std::stoull(value);
+			} else if (key == "inference-model") {
+				if (value != "native" && value != "torchscript") {
+					throw ConfigError("inference-model must be native or torchscript");
+				}
+				torch_script_inference = (value == "torchscript");
+			} else if (key == "benchmark-inference") {
+				benchmark_seconds = std::stod(value);
+			} else if (key == "serve") {
+				serving_config.socket_path = value;
+			} else if (key == "checkpoint") {
+				checkpoint = std::stoll(value);
+			} else if (key == "latency-slo-us") {
+				serving_config.latency_slo = std::chrono::microseconds(std::stoll(value));
+			} else if (key == "serve-batch") {
+				serving_config.max_batch_size = std::stoull(value);
+			} else if (arg.compare(0, std::string(INFERENCE_WORKER_FLAG).size(), INFERENCE_WORKER_FLAG) == 0) {
+				inference_worker = value;
+			} else if (arg.compare(0, std::string(WORKER_CPUS_FLAG).size(), WORKER_CPUS_FLAG) == 0) {
+				worker_cpus = parseCpuList(value);
+			} else {
+				config.set(key, value);
+			}
+		}
+		config.validate();
+#ifndef IMPALA_USE_LIBTORCH
+		if (torch_script_inference) {
+			throw ConfigError("--inference-model=torchscript needs train2048 built with USE_LIBTORCH");
+		}
+#endif
+		if (torch_script_inference && !config.native_inference && !verify_native_boards.has_value()) {
+			throw ConfigError("--inference-model=torchscript needs --native_inference=true");
+		}
+		if (!serving_config.socket_path.empty() && (!checkpoint.has_value() || serving_config.max_batch_size == 0)) {
+			throw ConfigError("--serve needs --checkpoint=INDEX and a positive --serve-batch");
+		}
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (verify_boards.has_value()) {
+		return verifyCompactEncoding(verify_boards.value());
+	}
+	if (verify_native_boards.has_value()) {
+#ifdef IMPALA_USE_LIBTORCH
+		if (torch_script_inference) {
+			return verifyInferenceModel<G2048TorchScriptAgentTraits>("torchscript", verify_native_boards.value(), checkpoint);
+		}
+#endif
+		return verifyInferenceModel<G2048AgentTraits>("native", verify_native_boards.value(), checkpoint);
+	}
+	if (benchmark_seconds.has_value()) {
+		return benchmarkInference(benchmark_seconds.value(), config.num_predictors);
+	}
+	if (!serving_config.socket_path.empty()) {
+		if (compact_observations) {
+			return serve<G2048CompactAgentTraits>(serving_config, checkpoint.value());
+		}
+		return serve<G2048AgentTraits>(serving_config, checkpoint.value());
+	}
+#ifdef IMPALA_USE_LIBTORCH
+	if (torch_script_inference) {
+		if (compact_observations) {
+			return train<G2048CompactTorchScriptAgentTraits>(config, training_steps, autotune_seconds, autotune_output, inference_worker, worker_cpus);
+		}
+		return train<G2048TorchScriptAgentTraits>(config, training_steps, autotune_seconds, autotune_output, inference_worker, worker_cpus);
+	}
+#endif
+	if (compact_observations) {
+		return train<G2048CompactAgentTraits>(config, training_steps, autotune_seconds, autotune_output, inference_worker, worker_cpus);
+	}
+	return train<G2048AgentTraits>(config, training_steps, autotune_seconds, autotune_output, inference_worker, worker_cpus);
+}
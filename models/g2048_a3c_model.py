@@ -21,6 +21,46 @@ class G2048A3CModel(Model):
         self.l_v = nn.Linear(1536, 1)
 
         self.rot_matrix = None
+        self.orientation_index = None
+
+    def convert_obs_to_tensor(self, observation, device):
+        # G2048CompactEnv sends (boards, masks) instead of (raw, conv, masks). the base class calls this
+        # again for every array of the tuple
+        if not isinstance(observation, tuple) or len(observation) != 2:
+            return super().convert_obs_to_tensor(observation, device)
+        boards, masks = super().convert_obs_to_tensor(observation, device)
+        raw, conv = self.expand_boards(boards.long())
+        return raw, conv, masks
+
+    def expand_boards(self, boards):
+        # same encoding as G2048Env::writeRawData and writeConvData
+        if self.orientation_index is None:
+            # cell y * 4 + x of orientation d reads this cell of the board
+            self.orientation_index = torch.tensor([
+                [y * 4 + x, (3 - x) * 4 + y, (3 - y) * 4 + 3 - x, x * 4 + 3 - y,
+                 x * 4 + y, y * 4 + 3 - x, (3 - x) * 4 + 3 - y, (3 - y) * 4 + x]
+                for y in range(4) for x in range(4)
+            ], dtype=torch.int64).t().contiguous().to(boards.device)
+        numbers = boards[:, self.orientation_index]
+        raw_values = torch.arange(18, device=boards.device)
+        raw = (numbers.unsqueeze(2) == raw_values.reshape(1, 1, 18, 1)).float()
+
+        numbers = numbers.reshape(-1, 8, 1, 1, 16)
+        n = torch.arange(15, device=boards.device).reshape(1, 1, 15, 1, 1)
+        k = torch.arange(3, device=boards.device).reshape(1, 1, 1, 3, 1)
+        exact = numbers == n + 1 + k
+        empty = (numbers == 0).expand(-1, -1, 15, -1, -1)
+        smaller = (numbers != 0) & (numbers < n + 1)
+        larger = numbers >= n + 4
+        conv = torch.cat((exact, empty, smaller, larger), dim=3).float()
+        return raw, conv
+
+    def count_encoding_mismatches(self, full_observation, compact_observation):
+        # used by the --verify-compact-encoding mode of train2048
+        device = torch.device("cpu")
+        expected = self.convert_obs_to_tensor(full_observation, device)
+        actual = self.convert_obs_to_tensor(compact_observation, device)
+        return sum(int((e.reshape(a.shape) != a).sum()) for e, a in zip(expected, actual))
 
     def convert_obs_to_hidden(self, observation):
         h0 = observation[0].reshape(-1, 8, 288)
@@ -58,6 +98,11 @@ class G2048A3CModel(Model):
         logits = self.logits_from_hidden(hidden[0])
         return functions.masked_softmax(logits, hidden[1], dim=1)
 
+    def probs_for_trace(self, observation):
+        hidden = self.convert_obs_to_hidden(observation)
+        logits = self.logits_from_hidden(hidden[0])
+        return functions.masked_softmax_for_trace(logits, hidden[1], dim=1)
+
     def log_probs_from_hidden(self, hidden):
         logits = self.logits_from_hidden(hidden[0])
         return functions.masked_log_softmax(logits, hidden[1], dim=1)
@@ -33,6 +33,10 @@ class Model(nn.Module):
     def probs_from_hidden(self, hidden):
         raise NotImplementedError()
 
+    # probs without autograd Functions, which torch.jit.trace cannot save
+    def probs_for_trace(self, observation):
+        raise NotImplementedError()
+
     def log_probs_from_hidden(self, hidden):
         raise NotImplementedError()
 
@@ -0,0 +1,205 @@
+#include "native_kernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace impala
+{
+
+namespace
+{
+
+// 48 rows of 960 inputs take 180 KB
+constexpr std::size_t ROW_BLOCK = 48;
+// 256 inputs of a panel take 16 KB
+constexpr std::size_t INPUT_BLOCK = 256;
+// rows that share the loads of a panel, 6 rows keep 12 accumulators in registers
+constexpr std::size_t MICRO_ROWS = 6;
+
+constexpr std::size_t PANEL_WIDTH = PackedLinear::PANEL_WIDTH;
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+static_assert(PANEL_WIDTH == 16);
+
+inline __m256 activate(__m256 v, Activation activation) noexcept
+{
+	// max(v, slope * v) is leaky_relu for a slope below 1
+	return activation == Activation::LEAKY_RELU ? _mm256_max_ps(v, _mm256_mul_ps(v, _mm256_set1_ps(LEAKY_RELU_SLOPE))) : v;
+}
+
+// ROWS rows times one panel over a block of inputs, starting from the bias or, if bias is null, from y
+template <std::size_t ROWS>
+void panelKernel(const float* x, std::size_t x_stride, const float* panel, std::size_t num_inputs, const float* bias, float* y, std::size_t y_stride, Activation activation) noexcept
+{
+	__m256 acc[ROWS][2];
+	for (std::size_t r = 0; r < ROWS; ++r) {
+		const float* init = (bias != nullptr ? bias : y + r * y_stride);
+		acc[r][0] = _mm256_loadu_ps(init);
+		acc[r][1] = _mm256_loadu_ps(init + 8);
+	}
+	for (std::size_t k = 0; k < num_inputs; ++k) {
+		const auto w0 = _mm256_loadu_ps(panel + k * PANEL_WIDTH);
+		const auto w1 = _mm256_loadu_ps(panel + k * PANEL_WIDTH + 8);
+		for (std::size_t r = 0; r < ROWS; ++r) {
+			const auto xk = _mm256_broadcast_ss(x + r * x_stride + k);
+			acc[r][0] = _mm256_fmadd_ps(xk, w0, acc[r][0]);
+			acc[r][1] = _mm256_fmadd_ps(xk, w1, acc[r][1]);
+		}
+	}
+	for (std::size_t r = 0; r < ROWS; ++r) {
+		_mm256_storeu_ps(y + r * y_stride, activate(acc[r][0], activation));
+		_mm256_storeu_ps(y + r * y_stride + 8, activate(acc[r][1], activation));
+	}
+}
+
+#else
+
+template <std::size_t ROWS>
+void panelKernel(const float* x, std::size_t x_stride, const float* panel, std::size_t num_inputs, const float* bias, float* y, std::size_t y_stride, Activation activation) noexcept
+{
+	float acc[ROWS][PANEL_WIDTH];
+	for (std::size_t r = 0; r < ROWS; ++r) {
+		const float* init = (bias != nullptr ? bias : y + r * y_stride);
+		std::copy(init, init + PANEL_WIDTH, acc[r]);
+	}
+	for (std::size_t k = 0; k < num_inputs; ++k) {
+		for (std::size_t r = 0; r < ROWS; ++r) {
+			const auto xk = x[r * x_stride + k];
+			for (std::size_t j = 0; j < PANEL_WIDTH; ++j) {
+				acc[r][j] += xk * panel[k * PANEL_WIDTH + j];
+			}
+		}
+	}
+	for (std::size_t r = 0; r < ROWS; ++r) {
+		for (std::size_t j = 0; j < PANEL_WIDTH; ++j) {
+			y[r * y_stride + j] = (activation == Activation::LEAKY_RELU ? std::max(acc[r][j], acc[r][j] * LEAKY_RELU_SLOPE) : acc[r][j]);
+		}
+	}
+}
+
+#endif
+
+// the rows left over after the full groups of MICRO_ROWS
+void panelKernelTail(std::size_t rows, const float* x, std::size_t x_stride, const float* panel, std::size_t num_inputs, const float* bias, float* y, std::size_t y_stride, Activation activation) noexcept
+{
+	static_assert(MICRO_ROWS == 6);
+	switch (rows) {
+	case 5:
+		panelKernel<5>(x, x_stride, panel, num_inputs, bias, y, y_stride, activation);
+		break;
+	case 4:
+		panelKernel<4>(x, x_stride, panel, num_inputs, bias, y, y_stride, activation);
+		break;
+	case 3:
+		panelKernel<3>(x, x_stride, panel, num_inputs, bias, y, y_stride, activation);
+		break;
+	case 2:
+		panelKernel<2>(x, x_stride, panel, num_inputs, bias, y, y_stride, activation);
+		break;
+	case 1:
+		panelKernel<1>(x, x_stride, panel, num_inputs, bias, y, y_stride, activation);
+		break;
+	default:
+		break;
+	}
+}
+
+}  // namespace
+
+PackedLinear::PackedLinear(const float* weight, const float* bias, std::size_t outputs, std::size_t inputs, const std::vector<std::size_t>& input_order)
+    : m_outputs(outputs), m_inputs(inputs), m_panels(outputs * inputs), m_bias(bias, bias + outputs)
+{
+	assert(outputs % PANEL_WIDTH == 0);
+	assert(input_order.empty() || input_order.size() == inputs);
+	for (std::size_t output = 0; output < outputs; output += PANEL_WIDTH) {
+		float* panel = m_panels.data() + output * inputs;
+		for (std::size_t k = 0; k < inputs; ++k) {
+			const auto column = (input_order.empty() ? k : input_order[k]);
+			for (std::size_t j = 0; j < PANEL_WIDTH; ++j) {
+				panel[k * PANEL_WIDTH + j] = weight[(output + j) * inputs + column];
+			}
+		}
+	}
+}
+
+void PackedLinear::forward(const float* x, std::size_t rows, std::size_t x_stride, float* y, std::size_t y_stride, Activation activation) const noexcept
+{
+	for (std::size_t row_begin = 0; row_begin < rows; row_begin += ROW_BLOCK) {
+		const auto row_end = std::min(rows, row_begin + ROW_BLOCK);
+		for (std::size_t input_begin = 0; input_begin < m_inputs; input_begin += INPUT_BLOCK) {
+			const auto num_inputs = std::min(m_inputs - input_begin, INPUT_BLOCK);
+			// the activation follows the last block of inputs
+			const auto block_activation = (input_begin + num_inputs == m_inputs ? activation : Activation::IDENTITY);
+			for (std::size_t output = 0; output < m_outputs; output += PANEL_WIDTH) {
+				const float* panel = m_panels.data() + output * m_inputs + input_begin * PANEL_WIDTH;
+				const float* bias = (input_begin == 0 ? m_bias.data() + output : nullptr);
+				auto row = row_begin;
+				for (; row + MICRO_ROWS <= row_end; row += MICRO_ROWS) {
+					panelKernel<MICRO_ROWS>(x + row * x_stride + input_begin, x_stride, panel, num_inputs, bias, y + row * y_stride + output, y_stride, block_activation);
+				}
+				panelKernelTail(row_end - row, x + row * x_stride + input_begin, x_stride, panel, num_inputs, bias, y + row * y_stride + output, y_stride, block_activation);
+			}
+		}
+	}
+}
+
+OneHotLinear::OneHotLinear(const float* weight, const float* bias, std::size_t outputs, std::size_t inputs)
+    : m_outputs(outputs), m_inputs(inputs), m_columns(inputs * outputs), m_bias(bias, bias + outputs)
+{
+	for (std::size_t output = 0; output < outputs; ++output) {
+		for (std::size_t k = 0; k < inputs; ++k) {
+			m_columns[k * outputs + output] = weight[output * inputs + k];
+		}
+	}
+}
+
+void OneHotLinear::forward(const std::uint16_t* active, std::size_t num_active, float* y, Activation activation) const noexcept
+{
+	// plain loops over the outputs, which the compiler vectorizes
+	std::copy(m_bias.begin(), m_bias.end(), y);
+	for (std::size_t i = 0; i < num_active; ++i) {
+		const float* column = m_columns.data() + static_cast<std::size_t>(active[i]) * m_outputs;
+		for (std::size_t j = 0; j < m_outputs; ++j) {
+			y[j] += column[j];
+		}
+	}
+	if (activation == Activation::LEAKY_RELU) {
+		for (std::size_t j = 0; j < m_outputs; ++j) {
+			y[j] = std::max(y[j], y[j] * LEAKY_RELU_SLOPE);
+		}
+	}
+}
+
+void maskedSoftmax(const float* logits, const std::uint8_t* invalid, std::size_t rows, std::size_t cols, float* out) noexcept
+{
+	for (std::size_t row = 0; row < rows; ++row) {
+		const float* x = logits + row * cols;
+		const std::uint8_t* mask = invalid + row * cols;
+		float* y = out + row * cols;
+		auto max = -std::numeric_limits<float>::infinity();
+		for (std::size_t i = 0; i < cols; ++i) {
+			if (mask[i] == 0) {
+				max = std::max(max, x[i]);
+			}
+		}
+		float sum = 0.0f;
+		for (std::size_t i = 0; i < cols; ++i) {
+			y[i] = (mask[i] == 0 ? std::exp(x[i] - max) : 0.0f);
+			sum += y[i];
+		}
+		if (sum > 0.0f) {
+			for (std::size_t i = 0; i < cols; ++i) {
+				y[i] /= sum;
+			}
+		}
+	}
+}
+
+}  // namespace impala
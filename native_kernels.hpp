@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace impala
+{
+
+// Kernels of the native inference models, e.g. envs/g2048/g2048_native_model.hpp. They use AVX2 and FMA when they are
+// compiled for them (-march=native) and plain loops otherwise. Every row is computed in the same order whichever
+// rows it is batched with, so that a policy does not depend on the batch.
+
+enum class Activation
+{
+	IDENTITY,
+	// F.leaky_relu with the default slope
+	LEAKY_RELU,
+};
+
+inline constexpr float LEAKY_RELU_SLOPE = 0.01f;
+
+// A linear layer y = x W^T + b, with W (outputs x inputs, row-major as nn.Linear keeps it) packed into panels of
+// PANEL_WIDTH outputs with the inputs outermost. The product runs over blocks of rows and inputs, so that the rows of
+// a block stay in L2 while every panel passes over them and the inputs of a panel stay in L1.
+class PackedLinear
+{
+public:
+	static inline constexpr std::size_t PANEL_WIDTH = 16;
+
+	PackedLinear() = default;
+	// input k of the layer is column input_order[k] of weight, the identity if input_order is empty, so that a layer can
+	// read its input in another order than the one it was trained with; outputs must be a multiple of PANEL_WIDTH
+	PackedLinear(const float* weight, const float* bias, std::size_t outputs, std::size_t inputs, const std::vector<std::size_t>& input_order = {});
+
+	// rows of x are x_stride floats apart and rows of y y_stride floats apart, rows of x may overlap
+	void forward(const float* x, std::size_t rows, std::size_t x_stride, float* y, std::size_t y_stride, Activation activation) const noexcept;
+
+	std::size_t outputs() const noexcept
+	{
+		return m_outputs;
+	}
+	std::size_t inputs() const noexcept
+	{
+		return m_inputs;
+	}
+
+private:
+	std::size_t m_outputs = 0;
+	std::size_t m_inputs = 0;
+	std::vector<float> m_panels;
+	std::vector<float> m_bias;
+};
+
+// A linear layer whose input is a sum of one-hot vectors: the output is the bias plus the weight columns of the
+// active inputs, so that the zeros of the encoding are never multiplied.
+class OneHotLinear
+{
+public:
+	OneHotLinear() = default;
+	OneHotLinear(const float* weight, const float* bias, std::size_t outputs, std::size_t inputs);
+
+	// y = b + the sum of the columns active[0..num_active) in that order
+	void forward(const std::uint16_t* active, std::size_t num_active, float* y, Activation activation) const noexcept;
+
+	std::size_t outputs() const noexcept
+	{
+		return m_outputs;
+	}
+	std::size_t inputs() const noexcept
+	{
+		return m_inputs;
+	}
+
+private:
+	std::size_t m_outputs = 0;
+	std::size_t m_inputs = 0;
+	// inputs x outputs
+	std::vector<float> m_columns;
+	std::vector<float> m_bias;
+};
+
+// softmax over each row of logits without the entries whose invalid flag is set, like functions.masked_softmax; a row
+// without valid entries gets zeros
+void maskedSoftmax(const float* logits, const std::uint8_t* invalid, std::size_t rows, std::size_t cols, float* out) noexcept;
+
+}  // namespace impala
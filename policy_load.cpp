@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "action.hpp"
+#include "policy_server.hpp"
+#include "socket.hpp"
+
+#include "envs/g2048/g2048_env.hpp"
+
+// Drives train2048 --serve=SOCKET: every client keeps depth games in flight on its own connection and plays
+// them with the moves it gets back. Prints the throughput and the latency seen by the clients.
+int main(int argc, char** argv)
+{
+	using namespace impala;
+	using Clock = std::chrono::steady_clock;
+	using Observation = G2048Env::Observation;
+	using Action = G2048Env::Action;
+
+	std::string socket_path;
+	std::size_t num_clients = 8;
+	std::size_t depth = 4;
+	double seconds = 10.0;
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto eq = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+				throw std::invalid_argument("usage: policy_load --socket=PATH [--clients=N] [--depth=N] [--seconds=S]");
+			}
+			auto key = arg.substr(2, eq - 2);
+			auto value = arg.substr(eq + 1);
+			if (key == "socket") {
+				socket_path = value;
+			} else if (key == "clients") {
+				num_clients = std::stoull(value);
+			} else if (key == "depth") {
+				depth = std::stoull(value);
+			} else if (key == "seconds") {
+				seconds = std::stod(value);
+			} else {
+				throw std::invalid_argument("unknown option " + key);
+			}
+		}
+		if (socket_path.empty() || num_clients == 0 || depth == 0) {
+			throw std::invalid_argument("--socket=PATH and positive numbers of clients and games are required");
+		}
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	const auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	std::mutex result_mutex;
+	std::vector<float> latencies;
+	std::size_t finished_games = 0;
+	std::size_t invalid_moves = 0;
+	std::atomic<bool> failed{false};
+
+	auto runClient = [&] {
+		std::vector<float> client_latencies;
+		std::size_t client_games = 0;
+		std::size_t client_invalid = 0;
+		try {
+			auto stream = SocketStream::connectLocal(socket_path);
+			std::vector<G2048Env> games(depth);
+			// the games in the order of their requests, answers come back in the same order
+			std::deque<std::pair<std::size_t, Clock::time_point>> in_flight;
+			std::vector<Observation> observations(depth);
+			std::vector<Observation> outgoing;
+			for (std::size_t i = 0; i < depth; ++i) {
+				observations[i] = games[i].reset();
+				outgoing.push_back(observations[i]);
+				in_flight.emplace_back(i, Clock::now());
+			}
+			stream.sendAll(outgoing.data(), outgoing.size() * sizeof(Observation));
+			std::vector<std::uint8_t> replies(depth);
+			while (Clock::now() < deadline) {
+				const auto received = stream.receiveSome(replies.data(), replies.size());
+				if (received == 0) {
+					throw SocketError("the server closed the connection");
+				}
+				const auto now = Clock::now();
+				outgoing.clear();
+				for (std::size_t r = 0; r < received; ++r) {
+					const auto [game, sent] = in_flight.front();
+					in_flight.pop_front();
+					client_latencies.push_back(std::chrono::duration<float, std::milli>(now - sent).count());
+					auto action_id = replies[r];
+					bool finished = (action_id == POLICY_NO_ACTION);
+					if (!finished) {
+						const auto action = DiscreteActionTraits<Action>::convertFromID(action_id);
+						if (!games[game].isValidAction(action)) {
+							++client_invalid;
+							finished = true;
+						} else {
+							auto&& [next_obs, reward, status] = games[game].step(action);
+							observations[game] = next_obs;
+							finished = (status == EnvState::FINISHED);
+						}
+					}
+					if (finished) {
+						++client_games;
+						observations[game] = games[game].reset();
+					}
+					outgoing.push_back(observations[game]);
+					in_flight.emplace_back(game, now);
+				}
+				stream.sendAll(outgoing.data(), outgoing.size() * sizeof(Observation));
+			}
+		} catch (const SocketError& e) {
+			std::cerr << e.what() << std::endl;
+			failed = true;
+		}
+		std::lock_guard lock{result_mutex};
+		latencies.insert(latencies.end(), client_latencies.begin(), client_latencies.end());
+		finished_games += client_games;
+		invalid_moves += client_invalid;
+	};
+
+	const auto start = Clock::now();
+	std::vector<std::thread> clients;
+	for (std::size_t i = 0; i < num_clients; ++i) {
+		clients.emplace_back(runClient);
+	}
+	for (auto&& client : clients) {
+		client.join();
+	}
+	const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	if (latencies.empty()) {
+		std::cerr << "no request was answered" << std::endl;
+		return 1;
+	}
+	auto percentile = [&](double q) {
+		auto nth = latencies.begin() + static_cast<std::ptrdiff_t>(q * static_cast<double>(latencies.size() - 1));
+		std::nth_element(latencies.begin(), nth, latencies.end());
+		return *nth;
+	};
+	const auto p50 = percentile(0.5);
+	const auto p99 = percentile(0.99);
+	std::cout << "requests " << latencies.size() << " , qps " << static_cast<double>(latencies.size()) / elapsed << " , latency p50 " << p50 << " ms p99 " << p99 << " ms" << std::endl;
+	std::cout << "finished games " << finished_games << " , invalid moves " << invalid_moves << std::endl;
+	return failed ? 1 : 0;
+}
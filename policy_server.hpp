@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "action.hpp"
+#include "agent.hpp"
+#include "environment.hpp"
+#include "socket.hpp"
+
+namespace impala
+{
+
+// Clients of the policy server send observations as the raw bytes of Environment::Observation and receive one
+// byte per observation, in order: the id of the valid action with the highest probability, or POLICY_NO_ACTION
+// if no action is valid.
+inline constexpr std::uint8_t POLICY_NO_ACTION = 0xff;
+
+struct ServingConfig
+{
+	std::string socket_path;
+	std::size_t max_batch_size = 256;
+	// a request waits for more requests only as long as its batch can still be answered within this latency
+	std::chrono::microseconds latency_slo{5000};
+	// replies a client may leave unread beyond its socket buffer before it is dropped, so that it does not hold up
+	// the others
+	std::size_t max_pending_reply_bytes = 1 << 16;
+	std::chrono::milliseconds report_interval{10000};
+};
+
+// Answers "best action for this observation" for the clients of a Unix-domain socket with a trained agent.
+// Concurrent requests are micro-batched: a batch is predicted as soon as it is full, or when waiting longer
+// would make its oldest request miss the latency SLO given the recent time to serve a batch.
+template <class Environment, class Agent>
+class PolicyServer
+{
+public:
+	static_assert(IsEnvironmentV<Environment>);
+	static_assert(IsAgentForGivenEnvironmentV<Agent, Environment>);
+
+	using Observation = typename Environment::Observation;
+	using ObsBatch = typename Environment::ObsBatch;
+	using Action = typename Environment::Action;
+	using Clock = std::chrono::steady_clock;
+
+	static_assert(std::is_trivially_copyable_v<Observation>, "observations are received as raw bytes");
+	static_assert(DiscreteActionTraits<Action>::num_actions < POLICY_NO_ACTION);
+
+	PolicyServer(std::unique_ptr<Agent> agent, ServingConfig config) : m_agent(std::move(agent)), m_config(std::move(config)), m_listener(m_config.socket_path)
+	{
+		m_accept_thread = std::thread{[this] {
+			acceptConnections();
+		}};
+		std::cout << "serving on " << m_config.socket_path << std::endl;
+	}
+	~PolicyServer()
+	{
+		m_exit_flag.store(true, std::memory_order_release);
+		m_accept_thread.join();
+		for (auto&& connection : m_connections) {
+			connection->reader.join();
+		}
+	}
+
+	// predicts on the calling thread, which has to be the thread the agent was created on
+	void run(std::optional<Clock::duration> time_limit = std::nullopt)
+	{
+		static constexpr auto NUM_ACTIONS = DiscreteActionTraits<Action>::num_actions;
+		const auto deadline = Clock::now() + time_limit.value_or(Clock::duration::zero());
+		std::vector<Request> batch;
+		std::vector<std::reference_wrapper<const Observation>> observations;
+		ObsBatch states;
+		std::vector<float> policies;
+		std::unordered_map<std::shared_ptr<Connection>, std::vector<std::uint8_t>> replies;
+		m_report_start = Clock::now();
+		while (!time_limit.has_value() || Clock::now() < deadline) {
+			batch.clear();
+			flushBacklog();
+			{
+				std::unique_lock lock{m_mutex};
+				// clients with unsent replies are retried soon
+				const auto idle_wait = (m_backlog.empty() ? std::chrono::milliseconds(100) : std::chrono::milliseconds(1));
+				if (!m_event.wait_for(lock, idle_wait, [this] { return !m_queue.empty(); })) {
+					lock.unlock();
+					report();
+					continue;
+				}
+				const auto flush_time = m_queue.front().arrival + m_config.latency_slo - m_service_estimate;
+				m_event.wait_until(lock, flush_time, [this] { return m_queue.size() >= m_config.max_batch_size; });
+				const auto batch_size = std::min(m_queue.size(), m_config.max_batch_size);
+				std::move(m_queue.begin(), m_queue.begin() + static_cast<std::ptrdiff_t>(batch_size), std::back_inserter(batch));
+				m_queue.erase(m_queue.begin(), m_queue.begin() + static_cast<std::ptrdiff_t>(batch_size));
+			}
+
+			const auto service_start = Clock::now();
+			observations.clear();
+			for (auto&& request : batch) {
+				observations.emplace_back(request.observation);
+			}
+			Environment::makeBatch(observations.begin(), observations.end(), states);
+			policies.resize(batch.size() * NUM_ACTIONS);
+			const auto predict_start = Clock::now();
+			m_agent->template predict<NUM_ACTIONS>(states, {policies.data(), static_cast<std::ptrdiff_t>(policies.size())}, [] {});
+			m_agent->sync();
+			m_predict_seconds += std::chrono::duration<double>(Clock::now() - predict_start).count();
+
+			for (std::size_t i = 0; i < batch.size(); ++i) {
+				replies[batch[i].connection].push_back(bestValidAction(batch[i].observation, &policies[i * NUM_ACTIONS]));
+			}
+			// one write per client, the requests of a batch keep their order. A client that does not read is not
+			// waited for, its replies wait in its output
+			for (auto&& [connection, reply] : replies) {
+				if (connection->dropped) {
+					continue;
+				}
+				const bool backlogged = !connection->output.empty();
+				connection->output.insert(connection->output.end(), reply.begin(), reply.end());
+				sendOutput(*connection);
+				if (!backlogged && !connection->output.empty()) {
+					m_backlog.push_back(connection);
+				}
+			}
+			replies.clear();
+			const auto now = Clock::now();
+			m_service_estimate = std::chrono::duration_cast<Clock::duration>(0.9 * m_service_estimate + 0.1 * (now - service_start));
+			for (auto&& request : batch) {
+				m_latencies.push_back(std::chrono::duration<float, std::milli>(now - request.arrival).count());
+			}
+			++m_num_batches;
+			report();
+		}
+	}
+
+private:
+	struct Connection
+	{
+		explicit Connection(SocketStream&& stream) : stream(std::move(stream)) {}
+
+		SocketStream stream;
+		std::thread reader;
+		std::atomic<bool> closed{false};
+		// replies not yet taken by the socket and whether the client was dropped, only touched by the thread in run()
+		std::vector<std::uint8_t> output;
+		bool dropped = false;
+	};
+	struct Request
+	{
+		Observation observation;
+		std::shared_ptr<Connection> connection;
+		Clock::time_point arrival;
+	};
+
+	static std::uint8_t bestValidAction(const Observation& observation, const float* policy)
+	{
+		std::uint8_t best = POLICY_NO_ACTION;
+		for (std::size_t id = 0; id < DiscreteActionTraits<Action>::num_actions; ++id) {
+			if (!Environment::isValidActionFor(observation, DiscreteActionTraits<Action>::convertFromID(static_cast<std::int64_t>(id)))) {
+				continue;
+			}
+			if (best == POLICY_NO_ACTION || policy[id] > policy[best]) {
+				best = static_cast<std::uint8_t>(id);
+			}
+		}
+		return best;
+	}
+
+	// sends what the socket takes of the output of connection, drops a client that leaves more than
+	// max_pending_reply_bytes unread
+	void sendOutput(Connection& connection)
+	{
+		try {
+			const auto sent = connection.stream.sendSome(connection.output.data(), connection.output.size());
+			connection.output.erase(connection.output.begin(), connection.output.begin() + static_cast<std::ptrdiff_t>(sent));
+		} catch (const SocketError&) {
+			// the reader notices the closed connection
+			connection.output.clear();
+			connection.dropped = true;
+			return;
+		}
+		if (connection.output.size() > m_config.max_pending_reply_bytes) {
+			std::cerr << "dropped a client that does not read its replies" << std::endl;
+			// the reader sees the end of the stream and closes the connection
+			::shutdown(connection.stream.fd(), SHUT_RDWR);
+			connection.output.clear();
+			connection.dropped = true;
+		}
+	}
+
+	void flushBacklog()
+	{
+		for (auto&& connection : m_backlog) {
+			if (!connection->dropped) {
+				sendOutput(*connection);
+			}
+		}
+		m_backlog.erase(std::remove_if(m_backlog.begin(), m_backlog.end(), [](const std::shared_ptr<Connection>& connection) { return connection->output.empty(); }), m_backlog.end());
+	}
+
+	void acceptConnections()
+	{
+		while (!m_exit_flag.load(std::memory_order_acquire)) {
+			// readers of closed connections are joined here, pending requests keep their connection alive
+			m_connections.remove_if([](const std::shared_ptr<Connection>& connection) {
+				if (!connection->closed.load(std::memory_order_acquire)) {
+					return false;
+				}
+				connection->reader.join();
+				return true;
+			});
+			auto stream = m_listener.accept(std::chrono::milliseconds(100));
+			if (!stream.has_value()) {
+				continue;
+			}
+			auto connection = std::make_shared<Connection>(std::move(stream.value()));
+			connection->reader = std::thread{[this, connection] {
+				readRequests(connection);
+			}};
+			m_connections.push_back(std::move(connection));
+		}
+	}
+
+	void readRequests(const std::shared_ptr<Connection>& connection)
+	{
+		std::vector<std::byte> buffer(sizeof(Observation) * 1024);
+		std::size_t filled = 0;
+		try {
+			while (!m_exit_flag.load(std::memory_order_acquire)) {
+				::pollfd pfd{connection->stream.fd(), POLLIN, 0};
+				if (::poll(&pfd, 1, 100) <= 0) {
+					continue;
+				}
+				const auto received = connection->stream.receiveSome(buffer.data() + filled, buffer.size() - filled);
+				if (received == 0) {
+					break;
+				}
+				filled += received;
+				const auto count = filled / sizeof(Observation);
+				const auto arrival = Clock::now();
+				bool notify;
+				{
+					std::lock_guard lock{m_mutex};
+					const auto prev_size = m_queue.size();
+					for (std::size_t i = 0; i < count; ++i) {
+						Request request{Observation{}, connection, arrival};
+						std::memcpy(&request.observation, buffer.data() + i * sizeof(Observation), sizeof(Observation));
+						m_queue.push_back(std::move(request));
+					}
+					// the batcher waits either for a first request or for a full batch
+					notify = (prev_size == 0 || (prev_size < m_config.max_batch_size && m_queue.size() >= m_config.max_batch_size));
+				}
+				if (notify) {
+					m_event.notify_one();
+				}
+				std::memmove(buffer.data(), buffer.data() + count * sizeof(Observation), filled - count * sizeof(Observation));
+				filled -= count * sizeof(Observation);
+			}
+		} catch (const SocketError& e) {
+			std::cerr << e.what() << std::endl;
+		}
+		connection->closed.store(true, std::memory_order_release);
+	}
+
+	void report()
+	{
+		const auto now = Clock::now();
+		if (now - m_report_start < m_config.report_interval) {
+			return;
+		}
+		const auto elapsed = std::chrono::duration<double>(now - m_report_start).count();
+		if (!m_latencies.empty()) {
+			auto percentile = [this](double q) {
+				auto nth = m_latencies.begin() + static_cast<std::ptrdiff_t>(q * static_cast<double>(m_latencies.size() - 1));
+				std::nth_element(m_latencies.begin(), nth, m_latencies.end());
+				return *nth;
+			};
+			const auto count = m_latencies.size();
+			const auto p50 = percentile(0.5);
+			const auto p99 = percentile(0.99);
+			std::cout << "qps " << static_cast<double>(count) / elapsed << " , latency p50 " << p50 << " ms p99 " << p99 << " ms , mean batch " << static_cast<double>(count) / static_cast<double>(m_num_batches) << " , predict " << m_predict_seconds * 1e3 / static_cast<double>(m_num_batches) << " ms" << std::endl;
+		}
+		m_latencies.clear();
+		m_num_batches = 0;
+		m_predict_seconds = 0.0;
+		m_report_start = now;
+	}
+
+	std::unique_ptr<Agent> m_agent;
+	ServingConfig m_config;
+	LocalListener m_listener;
+	std::atomic<bool> m_exit_flag{false};
+	std::thread m_accept_thread;
+	// only touched by the accept thread until the destructor joins it
+	std::list<std::shared_ptr<Connection>> m_connections;
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	std::deque<Request> m_queue;
+	// the rest is only touched by the thread in run()
+	// connections with replies left in their output
+	std::vector<std::shared_ptr<Connection>> m_backlog;
+	// encoding, prediction and replies of a batch
+	Clock::duration m_service_estimate = Clock::duration::zero();
+	Clock::time_point m_report_start = Clock::now();
+	std::vector<float> m_latencies;
+	std::size_t m_num_batches = 0;
+	double m_predict_seconds = 0.0;
+};
+
+}  // namespace impala
@@ -2,9 +2,13 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iterator>
+#include <optional>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <boost/python.hpp>
 #include <boost/python/numpy.hpp>
@@ -29,7 +33,7 @@ template <class T,
             IsEnvironment<typename T::Environment>,
             std::is_same<boost::python::object, decltype(T::create(std::declval<boost::python::object&>()))>,
             std::is_same<boost::python::object, decltype(T::convertObsBatch(std::declval<std::add_lvalue_reference_t<typename T::Environment::ObsBatch>>(), std::declval<std::size_t>()))>,
-            std::is_same<boost::python::object, decltype(T::convertRewardBatch(std::declval<ranges::span<typename T::Environment::Reward>>(), std::declval<std::size_t>(), std::declval<std::size_t>()))>,
+            std::is_same<boost::python::object, decltype(T::convertRewardBatch(std::declval<ranges::span<typename T::Environment::Reward>>(), std::declval<std::size_t>()))>,
             std::is_same<typename T::Loss, decltype(T::convertToLoss(std::declval<boost::python::object&&>()))>>,
         std::nullptr_t> = nullptr>
 inline constexpr std::true_type isPythonAgentTraitsHelper(const volatile T*);
@@ -58,17 +62,28 @@ public:
 
 	using Environment = typename PythonAgentTraits::Environment;
 	using Loss = typename PythonAgentTraits::Loss;
+	// the traits may name the native model of predictors that do not take the GIL, see agent.hpp
+	using InferenceModel = AgentInferenceModelT<PythonAgentTraits>;
 
-	PythonAgent()
+	// the traits see the index of the learner as LEARNER, None outside of sweeps, the seed of the run as
+	// SEED (None if unseeded), DETERMINISTIC and the learning rate of the learner as LEARNING_RATE (None picks
+	// the default of the traits)
+	explicit PythonAgent(std::optional<std::size_t> learner = std::nullopt, std::optional<std::size_t> seed = std::nullopt, bool deterministic = false, std::optional<float> learning_rate = std::nullopt)
 	{
 		try {
 			m_python_main_ns = makePythonMainNameSpace();
+			m_python_main_ns["LEARNER"] = learner.has_value() ? boost::python::object(learner.value()) : boost::python::object();
+			m_python_main_ns["SEED"] = seed.has_value() ? boost::python::object(seed.value()) : boost::python::object();
+			m_python_main_ns["DETERMINISTIC"] = deterministic;
+			m_python_main_ns["LEARNING_RATE"] = learning_rate.has_value() ? boost::python::object(learning_rate.value()) : boost::python::object();
 			m_agent_object = PythonAgentTraits::create(m_python_main_ns);
 			m_predict_func = m_agent_object.attr("predict");
 			m_train_func = m_agent_object.attr("train");
 			m_sync_func = m_agent_object.attr("sync");
 			m_save_func = m_agent_object.attr("save_model");
 			m_load_func = m_agent_object.attr("load_model");
+			m_snapshot_func = m_agent_object.attr("snapshot_model");
+			m_output_directory = boost::python::extract<std::string>(m_agent_object.attr("output_dir"));
 		} catch (boost::python::error_already_set) {
 			::PyErr_Print();
 			std::terminate();
@@ -95,8 +110,9 @@ public:
 			std::terminate();
 		}
 	}
+	// the step data are packed: data_sizes[t] rollouts have a step t, and states hold one extra bootstrap observation per rollout
 	template <class Callback, std::enable_if_t<std::is_invocable_v<Callback, Loss>, std::nullptr_t> = nullptr>
-	void train(typename Environment::ObsBatch& states, ranges::span<std::int64_t> action_ids, ranges::span<typename Environment::Reward> rewards, ranges::span<float> behaviour_policies, ranges::span<float> discounts, ranges::span<float> loss_coefs, ranges::span<std::int64_t> data_sizes, Callback&& callback)
+	void train(typename Environment::ObsBatch& states, ranges::span<std::int64_t> action_ids, ranges::span<typename Environment::Reward> rewards, ranges::span<float> behaviour_policies, ranges::span<float> discounts, ranges::span<std::int64_t> data_sizes, Callback&& callback)
 	{
 		auto prev_callback = std::move(m_callback);
 		m_callback = [callback = std::move(callback)](boost::python::object&& result) {
@@ -104,19 +120,18 @@ public:
 		};
 		try {
 			namespace np = boost::python::numpy;
-			const auto t_max = static_cast<std::size_t>(data_sizes.size());
-			const auto batch_size = static_cast<std::size_t>(action_ids.size()) / t_max;
-			auto states_pyobj = PythonAgentTraits::convertObsBatch(states, (t_max + 1) * batch_size);
-			auto action_ids_ndarray = NdArrayTraits<std::int64_t, 1>::convertToBatchedNdArray(action_ids, t_max, batch_size);
-			auto rewards_pyobj = PythonAgentTraits::convertRewardBatch(rewards, t_max, batch_size);
-			auto bp_ndarray = NdArrayTraits<float, 1>::convertToBatchedNdArray(behaviour_policies, t_max, batch_size);
-			auto discounts_ndarray = NdArrayTraits<float, 1>::convertToBatchedNdArray(discounts, t_max, batch_size);
-			auto loss_coefs_ndarray = NdArrayTraits<float, 1>::convertToBatchedNdArray(loss_coefs, t_max, batch_size);
+			const auto num_steps = static_cast<std::size_t>(action_ids.size());
+			const auto batch_size = static_cast<std::size_t>(data_sizes[0]);
+			auto states_pyobj = PythonAgentTraits::convertObsBatch(states, num_steps + batch_size);
+			auto action_ids_ndarray = NdArrayTraits<std::int64_t, 1>::convertToBatchedNdArray(action_ids, num_steps);
+			auto rewards_pyobj = PythonAgentTraits::convertRewardBatch(rewards, num_steps);
+			auto bp_ndarray = NdArrayTraits<float, 1>::convertToBatchedNdArray(behaviour_policies, num_steps);
+			auto discounts_ndarray = NdArrayTraits<float, 1>::convertToBatchedNdArray(discounts, num_steps);
 			boost::python::list data_sizes_list;
 			for (auto&& s : data_sizes) {
 				data_sizes_list.append(s);
 			}
-			auto result = m_train_func(states_pyobj, action_ids_ndarray, rewards_pyobj, bp_ndarray, discounts_ndarray, loss_coefs_ndarray, data_sizes_list);
+			auto result = m_train_func(states_pyobj, action_ids_ndarray, rewards_pyobj, bp_ndarray, discounts_ndarray, data_sizes_list);
 			if (prev_callback) {
 				prev_callback(std::move(result));
 			}
@@ -151,6 +166,31 @@ public:
 		}
 	}
 
+	// the files save would write, serialized in memory so that they can be written on another thread
+	void snapshot(std::int64_t index, std::vector<CheckpointFile>& files)
+	{
+		try {
+			boost::python::object result = m_snapshot_func(index);
+			const auto num_files = static_cast<std::size_t>(boost::python::len(result));
+			files.resize(num_files);
+			for (std::size_t i = 0; i < num_files; ++i) {
+				boost::python::object entry = result[i];
+				files[i].path = boost::python::extract<std::string>(entry[0]);
+				boost::python::object data = entry[1];
+				char* buffer = nullptr;
+				::Py_ssize_t size = 0;
+				if (::PyBytes_AsStringAndSize(data.ptr(), &buffer, &size) != 0) {
+					boost::python::throw_error_already_set();
+				}
+				files[i].data.resize(static_cast<std::size_t>(size));
+				std::memcpy(files[i].data.data(), buffer, files[i].data.size());
+			}
+		} catch (boost::python::error_already_set) {
+			::PyErr_Print();
+			std::terminate();
+		}
+	}
+
 	void load(std::int64_t index)
 	{
 		try {
@@ -161,6 +201,45 @@ public:
 		}
 	}
 
+	// save and snapshot write the checkpoint INDEX to the directory OUTPUT/INDEX
+	const std::string& outputDirectory() const noexcept
+	{
+		return m_output_directory;
+	}
+
+	// the model parameters as one flat vector, to hand them to inference workers
+	void exportWeights(std::vector<float>& weights)
+	{
+		try {
+			weights.resize(boost::python::extract<std::size_t>(m_agent_object.attr("num_weights")()));
+			m_agent_object.attr("get_weights")(NdArrayTraits<float, 1>::convertToBatchedNdArray({weights.data(), static_cast<std::ptrdiff_t>(weights.size())}, weights.size()));
+		} catch (boost::python::error_already_set) {
+			::PyErr_Print();
+			std::terminate();
+		}
+	}
+
+	// traces the policy on an example batch and saves the trace to path, for TorchScriptModel
+	void exportTorchScript(const std::string& path, typename Environment::ObsBatch& example, std::size_t batch_size)
+	{
+		try {
+			m_agent_object.attr("export_torchscript")(path, PythonAgentTraits::convertObsBatch(example, batch_size));
+		} catch (boost::python::error_already_set) {
+			::PyErr_Print();
+			std::terminate();
+		}
+	}
+
+	void importWeights(ranges::span<float> weights)
+	{
+		try {
+			m_agent_object.attr("set_weights")(NdArrayTraits<float, 1>::convertToBatchedNdArray(weights, static_cast<std::size_t>(weights.size())));
+		} catch (boost::python::error_already_set) {
+			::PyErr_Print();
+			std::terminate();
+		}
+	}
+
 private:
 	boost::python::object m_python_main_ns;
 	boost::python::object m_agent_object;
@@ -169,6 +248,8 @@ private:
 	boost::python::object m_sync_func;
 	boost::python::object m_save_func;
 	boost::python::object m_load_func;
+	boost::python::object m_snapshot_func;
+	std::string m_output_directory;
 	std::function<void(boost::python::object&&)> m_callback;
 };
 
@@ -13,6 +13,7 @@
 
 #include "cuda/cuda_util.hpp"
 #include "tensor.hpp"
+#include "thread_pool.hpp"
 
 namespace impala
 {
@@ -117,19 +118,20 @@ public:
 	{
 		const auto batch_size = static_cast<std::size_t>(std::distance(first, last));
 		buffer.resize(batch_size * size_of_all, boost::container::default_init);
-		auto dest = buffer.begin();
-		for (; first != last; ++first) {
-			if constexpr (std::is_convertible_v<typename std::iterator_traits<ForwardIterator>::reference, const Tensor<T, Ns...>&>) {
-				const Tensor<T, Ns...>& src = *first;
-				std::copy_n(src.data(), size_of_all, dest);
-			} else {
-				const std::optional<Tensor<T, Ns...>>& src = *first;
-				if (src.has_value()) {
-					std::copy_n(src.value().data(), size_of_all, dest);
+		forEachChunk(first, last, batch_size, buffer.data(), [](auto chunk_first, auto chunk_last, T* dest) {
+			for (; chunk_first != chunk_last; ++chunk_first) {
+				if constexpr (std::is_convertible_v<typename std::iterator_traits<ForwardIterator>::reference, const Tensor<T, Ns...>&>) {
+					const Tensor<T, Ns...>& src = *chunk_first;
+					std::copy_n(src.data(), size_of_all, dest);
+				} else {
+					const std::optional<Tensor<T, Ns...>>& src = *chunk_first;
+					if (src.has_value()) {
+						std::copy_n(src.value().data(), size_of_all, dest);
+					}
 				}
+				dest += size_of_all;
 			}
-			dest += size_of_all;
-		}
+		});
 	}
 	template <class ForwardIterator, class Callback,
 	    std::enable_if_t<
@@ -141,14 +143,31 @@ public:
 	{
 		const auto batch_size = static_cast<std::size_t>(std::distance(first, last));
 		buffer.resize(batch_size * size_of_all, boost::container::default_init);
-		auto dest = buffer.data();
-		for (; first != last; ++first) {
-			TensorRef<T, Ns...> tensor_ref{dest};
-			std::invoke(callback, *first, tensor_ref);
-			dest += size_of_all;
+		forEachChunk(first, last, batch_size, buffer.data(), [&callback](auto chunk_first, auto chunk_last, T* dest) {
+			for (; chunk_first != chunk_last; ++chunk_first) {
+				TensorRef<T, Ns...> tensor_ref{dest};
+				std::invoke(callback, *chunk_first, tensor_ref);
+				dest += size_of_all;
+			}
+		});
+	}
+
+private:
+	// random access inputs are split into chunks over the batch thread pool, others are written serially
+	template <class ForwardIterator, class Func>
+	static void forEachChunk(ForwardIterator first, [[maybe_unused]] ForwardIterator last, [[maybe_unused]] std::size_t batch_size, T* dest, Func&& func)
+	{
+		if constexpr (std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<ForwardIterator>::iterator_category>) {
+			parallelForBatch(batch_size, [&](std::size_t chunk_first, std::size_t chunk_last) {
+				using Diff = typename std::iterator_traits<ForwardIterator>::difference_type;
+				func(first + static_cast<Diff>(chunk_first), first + static_cast<Diff>(chunk_last), dest + chunk_first * size_of_all);
+			});
+		} else {
+			func(first, last, dest);
 		}
 	}
 
+public:
 	// 返り値のndarrayはspanの元となったメモリ領域を直接参照するため、lifetimeに注意
 	template <class... SizeT, std::enable_if_t<std::conjunction_v<std::is_convertible<SizeT, std::size_t>...>, std::nullptr_t> = nullptr>
 	static boost::python::numpy::ndarray convertToBatchedNdArray(ranges::span<T> buffer, SizeT... batch_sizes)
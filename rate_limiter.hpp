@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+namespace impala
+{
+
+// Keeps (inserted steps * samples_per_insert - sampled steps) within [-tolerance, tolerance].
+// Producers block in awaitInsert while they are ahead, consumers block in awaitSample while they are ahead.
+class RateLimiter
+{
+public:
+	RateLimiter(double samples_per_insert, double tolerance) noexcept : m_samples_per_insert(samples_per_insert), m_tolerance(tolerance) {}
+
+	void awaitInsert()
+	{
+		std::unique_lock lock{m_mutex};
+		if (canInsert() || m_exit_flag) {
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		m_insert_event.wait(lock, [this] { return canInsert() || m_exit_flag; });
+		m_blocked_insert_time += std::chrono::steady_clock::now() - start;
+	}
+	void insert(std::size_t num_steps)
+	{
+		{
+			std::lock_guard lock{m_mutex};
+			m_inserted += static_cast<double>(num_steps);
+		}
+		m_sample_event.notify_all();
+	}
+
+	void awaitSample(std::size_t num_steps)
+	{
+		std::unique_lock lock{m_mutex};
+		if (canSample(num_steps) || m_exit_flag) {
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		m_sample_event.wait(lock, [this, num_steps] { return canSample(num_steps) || m_exit_flag; });
+		m_blocked_sample_time += std::chrono::steady_clock::now() - start;
+	}
+	void sample(std::size_t num_steps)
+	{
+		{
+			std::lock_guard lock{m_mutex};
+			m_sampled += static_cast<double>(num_steps);
+		}
+		m_insert_event.notify_all();
+	}
+
+	void exit()
+	{
+		{
+			std::lock_guard lock{m_mutex};
+			m_exit_flag = true;
+		}
+		m_insert_event.notify_all();
+		m_sample_event.notify_all();
+	}
+
+	// returns the seconds producers and consumers spent blocked since the last call
+	std::pair<double, double> takeBlockedSeconds()
+	{
+		std::lock_guard lock{m_mutex};
+		auto result = std::make_pair(std::chrono::duration<double>(m_blocked_insert_time).count(), std::chrono::duration<double>(m_blocked_sample_time).count());
+		m_blocked_insert_time = std::chrono::steady_clock::duration::zero();
+		m_blocked_sample_time = std::chrono::steady_clock::duration::zero();
+		return result;
+	}
+
+private:
+	double difference() const noexcept
+	{
+		return m_inserted * m_samples_per_insert - m_sampled;
+	}
+	bool canInsert() const noexcept
+	{
+		return difference() <= m_tolerance;
+	}
+	bool canSample(std::size_t num_steps) const noexcept
+	{
+		return difference() - static_cast<double>(num_steps) >= -m_tolerance;
+	}
+
+	double m_samples_per_insert;
+	double m_tolerance;
+	double m_inserted = 0.0;
+	double m_sampled = 0.0;
+	std::mutex m_mutex;
+	std::condition_variable m_insert_event;
+	std::condition_variable m_sample_event;
+	std::chrono::steady_clock::duration m_blocked_insert_time = std::chrono::steady_clock::duration::zero();
+	std::chrono::steady_clock::duration m_blocked_sample_time = std::chrono::steady_clock::duration::zero();
+	bool m_exit_flag = false;
+};
+
+}  // namespace impala
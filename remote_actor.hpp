@@ -0,0 +1,361 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "action.hpp"
+#include "environment.hpp"
+#include "socket.hpp"
+
+namespace impala
+{
+
+// Framing of the connection between an actor node and the learner. Every frame is a RemoteFrameHeader followed
+// by size bytes of fields written back to back without padding.
+//   HELLO    node -> learner : magic, observation bytes, number of environments
+//   CONFIG   learner -> node : t_max, max episode length (0 means none)
+//   PREDICT  node -> learner : count, then per request slot, retry flag, observation
+//   ACTIONS  learner -> node : count, then per action slot, action id, policy, model version
+//   ROLLOUT  node -> learner : slot, number of steps, model version, terminal observation,
+//                              then per step observation, action id | next goal flag, reward, policy
+// A node sends the requests and rollouts of all its environments after each ACTIONS frame, so that both sides
+// exchange a few large frames instead of one per step.
+enum class RemoteMessage : std::uint32_t
+{
+	HELLO,
+	CONFIG,
+	PREDICT,
+	ACTIONS,
+	ROLLOUT
+};
+
+struct RemoteFrameHeader
+{
+	RemoteMessage type;
+	std::uint32_t size;
+};
+
+inline constexpr std::uint64_t REMOTE_ACTOR_MAGIC = 0x696d70616c61726eull;
+// the next goal flag shares the byte with the action id
+inline constexpr std::uint8_t REMOTE_NEXT_GOAL_FLAG = 0x80;
+
+// environments a node may run, so that the frames of a connection have a bound
+inline constexpr std::uint32_t REMOTE_MAX_ENVS = 1 << 16;
+
+// the payload sizes of the frames, frames of any other size are rejected
+inline constexpr std::size_t REMOTE_HELLO_SIZE = sizeof(std::uint64_t) + 2 * sizeof(std::uint32_t);
+inline constexpr std::size_t REMOTE_CONFIG_SIZE = 2 * sizeof(std::uint32_t);
+template <class Observation>
+constexpr std::size_t remotePredictSize(std::size_t count) noexcept
+{
+	return sizeof(std::uint32_t) + count * (sizeof(std::uint32_t) + sizeof(std::uint8_t) + sizeof(Observation));
+}
+inline constexpr std::size_t remoteActionsSize(std::size_t count) noexcept
+{
+	return sizeof(std::uint32_t) + count * (sizeof(std::uint32_t) + sizeof(std::uint8_t) + sizeof(float) + sizeof(std::uint64_t));
+}
+template <class Observation, class Reward>
+constexpr std::size_t remoteRolloutSize(std::size_t num_steps) noexcept
+{
+	return 2 * sizeof(std::uint32_t) + sizeof(std::uint64_t) + sizeof(Observation) + num_steps * (sizeof(Observation) + sizeof(std::uint8_t) + sizeof(Reward) + sizeof(float));
+}
+
+// a frame that does not follow the framing above, the connection is dropped
+class RemoteFrameError : public SocketError
+{
+public:
+	using SocketError::SocketError;
+};
+
+class RemoteFrameWriter
+{
+public:
+	void begin(RemoteMessage type)
+	{
+		m_frame_offset = m_buffer.size();
+		append(RemoteFrameHeader{type, 0});
+	}
+	template <class T>
+	void append(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		const auto offset = m_buffer.size();
+		m_buffer.resize(offset + sizeof(T));
+		std::memcpy(m_buffer.data() + offset, &value, sizeof(T));
+	}
+	void end()
+	{
+		const auto size = static_cast<std::uint32_t>(m_buffer.size() - m_frame_offset - sizeof(RemoteFrameHeader));
+		std::memcpy(m_buffer.data() + m_frame_offset + offsetof(RemoteFrameHeader, size), &size, sizeof(size));
+	}
+
+	// several frames are sent with one call
+	void send(SocketStream& stream)
+	{
+		if (!m_buffer.empty()) {
+			stream.sendAll(m_buffer.data(), m_buffer.size());
+			m_buffer.clear();
+		}
+	}
+	std::size_t size() const noexcept
+	{
+		return m_buffer.size();
+	}
+
+private:
+	std::vector<std::byte> m_buffer;
+	std::size_t m_frame_offset = 0;
+};
+
+class RemoteFrameReader
+{
+public:
+	RemoteFrameReader(const std::byte* data, std::size_t size) noexcept : m_data(data), m_end(data + size) {}
+
+	// throws RemoteFrameError past the end of the payload
+	template <class T>
+	T read()
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		if (static_cast<std::size_t>(m_end - m_data) < sizeof(T)) {
+			throw RemoteFrameError("truncated frame");
+		}
+		T value;
+		std::memcpy(&value, m_data, sizeof(T));
+		m_data += sizeof(T);
+		return value;
+	}
+
+private:
+	const std::byte* m_data;
+	const std::byte* m_end;
+};
+
+// receives the next frame into payload, returns false if the peer closed the connection, throws RemoteFrameError
+// for a payload larger than max_size
+inline bool receiveFrame(SocketStream& stream, RemoteFrameHeader& header, std::vector<std::byte>& payload, std::size_t max_size)
+{
+	if (!stream.receiveAll(&header, sizeof(header))) {
+		return false;
+	}
+	if (header.size > max_size) {
+		throw RemoteFrameError("frame larger than any frame of the connection");
+	}
+	payload.resize(header.size);
+	return stream.receiveAll(payload.data(), payload.size());
+}
+
+namespace detail
+{
+
+inline bool receiveAllBefore(SocketStream& stream, void* data, std::size_t size, std::chrono::steady_clock::time_point deadline)
+{
+	std::size_t received = 0;
+	while (received < size) {
+		const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+		if (remaining.count() <= 0 || !stream.waitForInput(remaining)) {
+			return false;
+		}
+		const auto ret = stream.receiveSome(static_cast<std::byte*>(data) + received, size - received);
+		if (ret == 0) {
+			return false;
+		}
+		received += ret;
+	}
+	return true;
+}
+
+}  // namespace detail
+
+// receiveFrame for peers that may never send the frame, also returns false if it is not complete at deadline
+inline bool receiveFrameBefore(SocketStream& stream, RemoteFrameHeader& header, std::vector<std::byte>& payload, std::size_t max_size, std::chrono::steady_clock::time_point deadline)
+{
+	if (!detail::receiveAllBefore(stream, &header, sizeof(header), deadline)) {
+		return false;
+	}
+	if (header.size > max_size) {
+		throw RemoteFrameError("frame larger than any frame of the connection");
+	}
+	payload.resize(header.size);
+	return detail::receiveAllBefore(stream, payload.data(), payload.size(), deadline);
+}
+
+// Runs num_envs environments against the learner listening on host:port until it closes the connection.
+// Prints the bytes exchanged per environment step every report_interval steps.
+template <class Environment>
+int runRemoteActorNode(const std::string& host, std::uint16_t port, std::size_t num_envs, std::size_t report_interval)
+{
+	using Observation = typename Environment::Observation;
+	using Reward = typename Environment::Reward;
+	using Action = typename Environment::Action;
+	static_assert(IsEnvironmentV<Environment>);
+	static_assert(std::is_trivially_copyable_v<Observation> && std::is_trivially_copyable_v<Reward>);
+	static_assert(DiscreteActionTraits<Action>::num_actions < REMOTE_NEXT_GOAL_FLAG);
+	if (num_envs > REMOTE_MAX_ENVS) {
+		std::cerr << "a node runs at most " << REMOTE_MAX_ENVS << " environments" << std::endl;
+		return 1;
+	}
+
+	std::optional<SocketStream> stream;
+	try {
+		stream.emplace(SocketStream::connectTcp(host, port));
+	} catch (const SocketError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	RemoteFrameWriter writer;
+	writer.begin(RemoteMessage::HELLO);
+	writer.append(REMOTE_ACTOR_MAGIC);
+	writer.append(static_cast<std::uint32_t>(sizeof(Observation)));
+	writer.append(static_cast<std::uint32_t>(num_envs));
+	writer.end();
+	RemoteFrameHeader header;
+	std::vector<std::byte> payload;
+	std::size_t t_max = 0;
+	std::size_t max_episode_length = 0;
+	try {
+		writer.send(*stream);
+		if (!receiveFrame(*stream, header, payload, REMOTE_CONFIG_SIZE) || header.type != RemoteMessage::CONFIG || payload.size() != REMOTE_CONFIG_SIZE) {
+			std::cerr << "the learner rejected the connection" << std::endl;
+			return 1;
+		}
+		RemoteFrameReader reader{payload.data(), payload.size()};
+		t_max = reader.template read<std::uint32_t>();
+		max_episode_length = reader.template read<std::uint32_t>();
+	} catch (const SocketError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	struct Step
+	{
+		Observation observation;
+		std::uint8_t action;
+		Reward reward;
+		float policy;
+	};
+	struct Slot
+	{
+		Environment env;
+		Observation observation;
+		std::size_t t = 0;
+		std::uint64_t model_version = 0;
+		std::vector<Step> steps;
+	};
+	std::vector<Slot> slots(num_envs);
+	// requests are collected while the actions of a frame are applied and sent as one PREDICT frame
+	std::vector<std::pair<std::uint32_t, bool>> requests;
+	for (auto i = 0u; i < num_envs; ++i) {
+		slots[i].observation = slots[i].env.reset();
+		slots[i].steps.reserve(t_max);
+		requests.emplace_back(i, false);
+	}
+	auto writeRollout = [&](Slot& slot, std::uint32_t index, const Observation& terminal) {
+		writer.begin(RemoteMessage::ROLLOUT);
+		writer.append(index);
+		writer.append(static_cast<std::uint32_t>(slot.steps.size()));
+		writer.append(slot.model_version);
+		writer.append(terminal);
+		for (auto&& step : slot.steps) {
+			writer.append(step.observation);
+			writer.append(step.action);
+			writer.append(step.reward);
+			writer.append(step.policy);
+		}
+		writer.end();
+		slot.steps.clear();
+	};
+
+	using Clock = std::chrono::steady_clock;
+	std::size_t env_steps = 0;
+	std::size_t bytes = 0;
+	auto report_start = Clock::now();
+	try {
+		while (true) {
+			if (!requests.empty()) {
+				writer.begin(RemoteMessage::PREDICT);
+				writer.append(static_cast<std::uint32_t>(requests.size()));
+				for (auto&& [index, retry] : requests) {
+					writer.append(index);
+					writer.append(static_cast<std::uint8_t>(retry ? 1 : 0));
+					writer.append(slots[index].observation);
+				}
+				writer.end();
+				requests.clear();
+			}
+			bytes += writer.size();
+			writer.send(*stream);
+
+			if (!receiveFrame(*stream, header, payload, remoteActionsSize(num_envs))) {
+				break;
+			}
+			bytes += sizeof(header) + payload.size();
+			if (header.type != RemoteMessage::ACTIONS) {
+				std::cerr << "unexpected message from the learner" << std::endl;
+				return 1;
+			}
+			RemoteFrameReader reader{payload.data(), payload.size()};
+			const auto count = reader.template read<std::uint32_t>();
+			if (payload.size() != remoteActionsSize(count)) {
+				throw RemoteFrameError("malformed ACTIONS frame from the learner");
+			}
+			for (std::uint32_t i = 0; i < count; ++i) {
+				const auto index = reader.template read<std::uint32_t>();
+				const auto action_id = reader.template read<std::uint8_t>();
+				const auto policy = reader.template read<float>();
+				const auto model_version = reader.template read<std::uint64_t>();
+				if (index >= num_envs || action_id >= DiscreteActionTraits<Action>::num_actions) {
+					throw RemoteFrameError("malformed ACTIONS frame from the learner");
+				}
+				auto& slot = slots[index];
+				const auto action = DiscreteActionTraits<Action>::convertFromID(action_id);
+				if (!slot.env.isValidAction(action)) {
+					requests.emplace_back(index, true);
+					continue;
+				}
+				auto&& [next_obs, reward, status] = slot.env.step(action);
+				++slot.t;
+				++env_steps;
+				if (slot.steps.empty()) {
+					slot.model_version = model_version;
+				}
+				const auto flags = static_cast<std::uint8_t>(status == EnvState::FINISHED ? REMOTE_NEXT_GOAL_FLAG : 0);
+				slot.steps.push_back({slot.observation, static_cast<std::uint8_t>(action_id | flags), reward, policy});
+				// as in the in-process actors, a finished episode keeps filling the rollout after the reset
+				const bool truncated = (status != EnvState::FINISHED && max_episode_length > 0 && slot.t >= max_episode_length);
+				if (slot.steps.size() == t_max || truncated) {
+					writeRollout(slot, index, next_obs);
+				}
+				if (status == EnvState::FINISHED || truncated) {
+					slot.observation = slot.env.reset();
+					slot.t = 0;
+				} else {
+					slot.observation = std::move(next_obs);
+				}
+				requests.emplace_back(index, false);
+			}
+			if (report_interval > 0 && env_steps >= report_interval) {
+				const auto elapsed = std::chrono::duration<double>(Clock::now() - report_start).count();
+				std::cout << "env steps per second " << static_cast<double>(env_steps) / elapsed << " , bytes per env step " << static_cast<double>(bytes) / static_cast<double>(env_steps) << std::endl;
+				env_steps = 0;
+				bytes = 0;
+				report_start = Clock::now();
+			}
+		}
+	} catch (const SocketError& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	std::cout << "the learner closed the connection" << std::endl;
+	return 0;
+}
+
+}  // namespace impala
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include <range/v3/span.hpp>
+
+namespace impala
+{
+
+// Rollouts kept for replay in compact form: the observations as the environment returns them (16 bytes for a
+// 2048 board) with the action ids, rewards and behaviour policies, nothing encoded. Every rollout has a slot
+// of t_max steps and a full buffer overwrites its oldest rollout.
+template <class Observation, class Reward>
+class ReplayBuffer
+{
+public:
+	struct Step
+	{
+		Observation observation;
+		// the server allows at most 256 actions
+		std::uint8_t action_id;
+		bool next_goal;
+		Reward reward;
+		float policy;
+	};
+
+	ReplayBuffer(std::size_t capacity, std::size_t t_max)
+	    : m_capacity(capacity), m_t_max(t_max), m_steps(capacity * t_max), m_terminals(capacity), m_lengths(capacity), m_model_versions(capacity)
+	{}
+
+	void add(ranges::span<const Step> steps, const Observation& terminal, std::uint64_t model_version)
+	{
+		const auto length = std::min(static_cast<std::size_t>(steps.size()), m_t_max);
+		std::lock_guard lock{m_mutex};
+		const auto slot = m_next_slot;
+		m_next_slot = (m_next_slot + 1) % m_capacity;
+		std::copy_n(steps.data(), length, m_steps.begin() + static_cast<std::ptrdiff_t>(slot * m_t_max));
+		m_terminals[slot] = terminal;
+		m_lengths[slot] = length;
+		m_model_versions[slot] = model_version;
+		if (m_size.load(std::memory_order_relaxed) < m_capacity) {
+			m_size.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// calls visit(steps, terminal, model_version) for count rollouts drawn uniformly with replacement,
+	// under the lock of the buffer
+	template <class Engine, class Visitor>
+	std::size_t sample(std::size_t count, Engine& engine, Visitor&& visit)
+	{
+		std::lock_guard lock{m_mutex};
+		const auto size = m_size.load(std::memory_order_relaxed);
+		if (size == 0) {
+			return 0;
+		}
+		std::uniform_int_distribution<std::size_t> distribution{0, size - 1};
+		for (std::size_t i = 0; i < count; ++i) {
+			const auto slot = distribution(engine);
+			visit(ranges::span<const Step>{m_steps.data() + slot * m_t_max, static_cast<std::ptrdiff_t>(m_lengths[slot])}, m_terminals[slot], m_model_versions[slot]);
+		}
+		return count;
+	}
+
+	std::size_t size() const noexcept
+	{
+		return m_size.load(std::memory_order_relaxed);
+	}
+	std::size_t residentBytes() const noexcept
+	{
+		return m_steps.size() * sizeof(Step) + m_terminals.size() * sizeof(Observation) + m_capacity * (sizeof(std::size_t) + sizeof(std::uint64_t));
+	}
+
+private:
+	const std::size_t m_capacity;
+	const std::size_t m_t_max;
+	std::mutex m_mutex;
+	std::vector<Step> m_steps;
+	std::vector<Observation> m_terminals;
+	std::vector<std::size_t> m_lengths;
+	std::vector<std::uint64_t> m_model_versions;
+	std::size_t m_next_slot = 0;
+	std::atomic<std::size_t> m_size{0};
+};
+
+}  // namespace impala
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include <range/v3/span.hpp>
+
+namespace impala
+{
+
+// xorshift64*, much cheaper to step than std::mt19937
+class FastRandomEngine
+{
+public:
+	using result_type = std::uint64_t;
+
+	explicit FastRandomEngine(std::uint64_t seed) noexcept : m_state(seed != 0 ? seed : 0x9e3779b97f4a7c15ull) {}
+
+	static constexpr result_type min() noexcept
+	{
+		return 0;
+	}
+	static constexpr result_type max() noexcept
+	{
+		return std::numeric_limits<result_type>::max();
+	}
+
+	result_type operator()() noexcept
+	{
+		m_state ^= m_state >> 12;
+		m_state ^= m_state << 25;
+		m_state ^= m_state >> 27;
+		return m_state * 0x2545f4914f6cdd1dull;
+	}
+
+	// constructing an engine from its state continues its sequence
+	std::uint64_t state() const noexcept
+	{
+		return m_state;
+	}
+
+	// uniform in [0, 1)
+	float uniform() noexcept
+	{
+		return static_cast<float>((*this)() >> 40) * (1.0f / static_cast<float>(1 << 24));
+	}
+
+private:
+	std::uint64_t m_state;
+};
+
+// independent seeds for the streams of one run seed (splitmix64)
+inline std::uint64_t deriveSeed(std::uint64_t seed, std::uint64_t stream) noexcept
+{
+	std::uint64_t z = seed + (stream + 1) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+// Samples one action per row of policies (num_rows x NUM_ACTIONS, not necessarily normalized) by inverse CDF.
+// Actions with zero probability are never chosen unless the whole row is zero.
+template <std::size_t NUM_ACTIONS>
+void sampleActions(ranges::span<const float> policies, ranges::span<std::int64_t> action_ids, ranges::span<float> action_policies, FastRandomEngine& random_engine)
+{
+	const auto num_rows = static_cast<std::size_t>(action_ids.size());
+	for (std::size_t row = 0; row < num_rows; ++row) {
+		const float* policy = policies.data() + row * NUM_ACTIONS;
+		float cdf[NUM_ACTIONS];
+		float sum = 0.0f;
+		for (std::size_t i = 0; i < NUM_ACTIONS; ++i) {
+			sum += policy[i];
+			cdf[i] = sum;
+		}
+		// uniform() * sum can round up to sum, which would select the last action even with zero probability
+		const float target = std::min(random_engine.uniform() * sum, std::nextafter(sum, 0.0f));
+		std::int64_t action_id = 0;
+		for (std::size_t i = 0; i + 1 < NUM_ACTIONS; ++i) {
+			action_id += (cdf[i] <= target ? 1 : 0);
+		}
+		action_ids.data()[row] = action_id;
+		action_policies.data()[row] = policy[action_id];
+	}
+}
+
+}  // namespace impala
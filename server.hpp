@@ -1,28 +1,56 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstring>
 #include <deque>
+#include <exception>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <numeric>
 #include <optional>
 #include <random>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <variant>
 #include <vector>
 
-#include <boost/container/static_vector.hpp>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <range/v3/algorithm/copy.hpp>
 #include <range/v3/numeric/accumulate.hpp>
 #include <range/v3/span.hpp>
 #include <range/v3/view/indices.hpp>
 #include <range/v3/view/zip.hpp>
 
+#include "actor_worker.hpp"
+#include "affinity.hpp"
 #include "agent.hpp"
+#include "batch_pool.hpp"
+#include "checkpoint_writer.hpp"
+#include "control_socket.hpp"
 #include "cuda/cuda_util.hpp"
 #include "environment.hpp"
+#include "histogram.hpp"
+#include "inference_worker.hpp"
+#include "rate_limiter.hpp"
+#include "remote_actor.hpp"
+#include "replay_buffer.hpp"
+#include "sampling.hpp"
+#include "thread_pool.hpp"
+#include "train_config.hpp"
+#include "trajectory_log.hpp"
+#include "weight_snapshot.hpp"
+#include "worker_process.hpp"
 
 namespace impala
 {
@@ -41,6 +69,45 @@ struct DefaultTrainParams
 	static inline constexpr std::size_t T_MAX = 5;
 	static inline constexpr std::optional<std::size_t> MAX_EPISODE_LENGTH = std::nullopt;
 	static inline constexpr float DISCOUNT = 0.99f;
+	// handed to the agent, the server does not use it
+	static inline constexpr float LEARNING_RATE = 0.01f;
+
+	// agents trained side by side on one actor pool, e.g. for hyperparameter sweeps
+	static inline constexpr std::size_t NUM_LEARNERS = 1;
+	// trained steps between moves of actors towards the learners with the best recent scores, nullopt keeps an even split
+	static inline constexpr std::optional<std::size_t> ACTOR_REASSIGN_INTERVAL_STEPS = std::nullopt;
+
+	static inline constexpr std::optional<std::size_t> MAX_POLICY_LAG = std::nullopt;
+	static inline constexpr StaleDataPolicy STALE_DATA_POLICY = StaleDataPolicy::DROP;
+
+	// rollouts kept per learner for replay, and the fraction of every training batch taken from them
+	static inline constexpr std::size_t REPLAY_CAPACITY = 0;
+	static inline constexpr double REPLAY_FRACTION = 0.0;
+
+	static inline constexpr std::optional<double> SAMPLES_PER_INSERT = std::nullopt;
+	static inline constexpr double SAMPLES_PER_INSERT_TOLERANCE = 65536.0;
+
+	// worker processes that step envs_per_actor_worker environments each, in addition to the num_actors actor threads
+	static inline constexpr std::size_t NUM_ACTOR_WORKERS = 0;
+	static inline constexpr std::size_t ENVS_PER_ACTOR_WORKER = 256;
+
+	// processes with their own copy of the model that serve the prediction batches instead of the learner
+	static inline constexpr std::size_t NUM_INFERENCE_WORKERS = 0;
+	// model versions between two weight snapshots for the inference workers and the weight_snapshot readers
+	static inline constexpr std::size_t WEIGHT_PUBLISH_INTERVAL = 1;
+
+	static inline constexpr bool PIN_THREADS = false;
+	static inline constexpr std::optional<std::size_t> NUM_PYTHON_THREADS = std::nullopt;
+
+	// threads that encode large batches in chunks, 0 keeps the encoding on the predictor and trainer threads
+	static inline constexpr std::size_t NUM_BATCH_THREADS = 0;
+	static inline constexpr std::size_t MIN_BATCH_CHUNK_SIZE = 64;
+
+	// keep the rows encoded for prediction and copy them into training batches instead of encoding the steps again
+	static inline constexpr bool REUSE_ENCODINGS = false;
+
+	// bytes of prediction and training batch buffers kept resident, nullopt means unbounded
+	static inline constexpr std::optional<std::size_t> BATCH_MEMORY_BUDGET = std::nullopt;
 
 	static inline constexpr double AVERAGE_LOSS_DECAY = 0.99;
 	static inline constexpr std::optional<std::size_t> LOG_INTERVAL_STEPS = 10000;
@@ -59,113 +126,877 @@ public:
 	using ObsBatch = typename Environment::ObsBatch;
 	using Action = typename Environment::Action;
 	using Loss = typename Agent::Loss;
+	// replayed steps and the actions of remote actors keep the action id in one byte
+	static_assert(DiscreteActionTraits<Action>::num_actions <= 256);
+	// run by the predictors with native_inference, see agent.hpp
+	using InferenceModel = AgentInferenceModelT<Agent>;
 
-	static inline constexpr std::size_t NUM_ACTORS = Parameters::NUM_ACTORS;
-	static inline constexpr std::size_t NUM_PREDICTORS = Parameters::NUM_PREDICTORS;
-	static inline constexpr std::size_t NUM_TRAINERS = Parameters::NUM_TRAINERS;
-
-	static inline constexpr std::size_t MIN_PREDICTION_BATCH_SIZE = Parameters::MIN_PREDICTION_BATCH_SIZE;
-	static inline constexpr std::size_t MAX_PREDICTION_BATCH_SIZE = Parameters::MAX_PREDICTION_BATCH_SIZE;
-	static inline constexpr std::size_t MIN_TRAINING_BATCH_SIZE = Parameters::MIN_TRAINING_BATCH_SIZE;
-	static inline constexpr std::size_t MAX_TRAINING_BATCH_SIZE = Parameters::MAX_TRAINING_BATCH_SIZE;
+	struct TrainResult
+	{
+		std::size_t trained_steps;
+		// measured from the first trained batch, so that start-up is excluded
+		double steps_per_second;
+	};
 
-	static inline constexpr std::size_t T_MAX = Parameters::T_MAX;
-	static inline constexpr std::optional<std::size_t> MAX_EPISODE_LENGTH = Parameters::MAX_EPISODE_LENGTH;
-	static inline constexpr float DISCOUNT = Parameters::DISCOUNT;
+	// call before the agent is created so that the Python thread pool inherits the limits and the placement;
+	// an inference worker runs on the worker_cpus the server gave it instead of the learner cpus
+	static void prepareProcess(const TrainConfig& config, const std::optional<std::vector<int>>& worker_cpus = std::nullopt)
+	{
+		if (config.num_python_threads.has_value()) {
+			limitPythonThreads(config.num_python_threads.value());
+		}
+		if (worker_cpus.has_value()) {
+			pinCurrentProcess(worker_cpus.value());
+		} else if (config.pin_threads) {
+			pinCurrentThread(makeThreadPlacement(config).learnerCpus());
+		}
+	}
 
-	static inline constexpr double AVERAGE_LOSS_DECAY = Parameters::AVERAGE_LOSS_DECAY;
-	static inline constexpr std::optional<std::size_t> LOG_INTERVAL_STEPS = Parameters::LOG_INTERVAL_STEPS;
-	static inline constexpr std::optional<std::size_t> SAVE_INTERVAL_STEPS = Parameters::SAVE_INTERVAL_STEPS;
+	explicit Server(std::unique_ptr<Agent> agent, const TrainConfig& config = TrainConfig::fromParameters<Parameters>()) : Server(makeAgents(std::move(agent)), config) {}
 
-	Server(std::unique_ptr<Agent> agent) : m_agent(std::move(agent))
+	// one agent per learner, the learners share the actors
+	Server(std::vector<std::unique_ptr<Agent>> agents, const TrainConfig& config) : m_config(config)
 	{
-		for ([[maybe_unused]] auto&& i : ranges::view::indices(NUM_PREDICTORS)) {
-			m_predictors.emplace_back(*this);
+		m_config.validate();
+		if (agents.size() != m_config.num_learners) {
+			throw ConfigError("the server needs num_learners agents");
+		}
+		if (m_config.native_inference && std::is_same_v<InferenceModel, NoInferenceModel>) {
+			throw ConfigError("native_inference needs an agent with an inference model");
+		}
+		// the trajectory files are checked before any thread is started
+		if (m_config.offline_trajectories.has_value()) {
+			m_offline_paths = OfflineReader::listSegments(m_config.offline_trajectories.value());
+		}
+		if (m_config.save_interval_steps.has_value() && m_config.async_checkpoints) {
+			m_checkpoint_writer.emplace(MAX_PENDING_CHECKPOINTS);
+		}
+		if (m_config.record_trajectories.has_value()) {
+			m_trajectory_writer.emplace(m_config.record_trajectories.value(), m_config.record_segment_bytes, MAX_QUEUED_RECORD_BYTES, sizeof(Observation), sizeof(Reward));
+			std::cout << "recording rollouts to " << m_config.record_trajectories.value() << std::endl;
+		}
+		if (m_config.pin_threads) {
+			m_thread_placement.emplace(makeThreadPlacement(m_config));
+			m_thread_placement->report(std::cout, m_config.num_learners * m_config.num_predictors, m_config.num_learners * m_config.num_trainers, m_config.num_inference_workers, m_config.num_actors);
+			pinCurrentThread(m_thread_placement->learnerCpus());
+		}
+		m_batch_pool.template expectBytes<PredictionBatch>(predictionBatchBytes(m_config));
+		m_batch_pool.template expectBytes<TrainingBatch>(trainingBatchBytes(m_config));
+		if (m_config.num_batch_threads > 0) {
+			m_batch_threads.emplace(m_config.num_batch_threads, [this] {
+				pinLearnerThread();
+			});
+			setBatchThreadPool(&m_batch_threads.value(), m_config.min_batch_chunk_size);
+		}
+		for (auto&& i : ranges::view::indices(agents.size())) {
+			m_learners.emplace_back(i, std::move(agents[i]), m_config);
+		}
+		// before the weights are handed to anyone
+		if (m_config.resume) {
+			for (auto&& learner : m_learners) {
+				resume(learner);
+			}
+		}
+		if (m_config.native_inference) {
+			if constexpr (HasInferenceModelPrepare<InferenceModel, Agent>::value) {
+				InferenceModel::prepare(*m_learners.front().agent);
+			}
+			for (auto&& learner : m_learners) {
+				publishInferenceWeights(learner);
+			}
+		}
+		if (m_config.num_inference_workers > 0 || m_config.weight_snapshot.has_value()) {
+			m_learners.front().agent->exportWeights(m_weight_buffer);
+			m_weight_snapshot.emplace(m_config.weight_snapshot.value_or(makeSharedMemoryName()), m_weight_buffer.size());
+			m_weight_snapshot->publish(m_weight_buffer.data(), 0);
+		}
+		// before the predictors, which pick their path by whether there are inference workers
+		if (m_config.num_inference_workers > 0) {
+			startInferenceWorkers();
 		}
-		for ([[maybe_unused]] auto&& i : ranges::view::indices(NUM_TRAINERS)) {
-			m_trainers.emplace_back(*this);
+		for (auto&& learner : m_learners) {
+			for ([[maybe_unused]] auto&& i : ranges::view::indices(m_config.num_predictors)) {
+				m_predictors.emplace_back(*this, learner, makeSeed(PREDICTOR_SEED_STREAM + m_predictors.size()));
+			}
+			for ([[maybe_unused]] auto&& i : ranges::view::indices(m_config.num_trainers)) {
+				m_trainers.emplace_back(*this, learner, makeSeed(TRAINER_SEED_STREAM + m_trainers.size()));
+			}
+		}
+		m_next_reassign_steps = m_config.actor_reassign_interval_steps.value_or(0);
+		m_actor_learners = std::make_unique<std::atomic<std::size_t>[]>(m_config.num_actors);
+		assignActors(std::vector<double>(m_learners.size(), 1.0));
+		for (auto&& i : ranges::view::indices(m_config.num_actors)) {
+			m_actors.emplace_back(*this, i, i < m_actor_resume_states.size() ? m_actor_resume_states[i] : std::nullopt);
+		}
+		m_actor_resume_states.clear();
+		if (m_config.offline_trajectories.has_value()) {
+			for (auto&& learner : m_learners) {
+				m_offline_readers.emplace_back(*this, learner);
+			}
+			std::cout << "training on the rollouts recorded in " << m_config.offline_trajectories.value() << std::endl;
+		}
+		for (auto&& i : ranges::view::indices(m_config.num_actor_workers)) {
+			m_actor_workers.emplace_back(*this, i);
 		}
-		for ([[maybe_unused]] auto&& i : ranges::view::indices(NUM_ACTORS)) {
-			m_actors.emplace_back(*this);
+		if (m_config.remote_actor_port.has_value()) {
+			m_remote_actors.emplace(*this, static_cast<std::uint16_t>(m_config.remote_actor_port.value()));
+		}
+		if (m_config.control_socket.has_value()) {
+			m_control_socket.emplace(m_config.control_socket.value(), [this](const std::string& command) {
+				return handleControlCommand(command);
+			});
+			std::cout << "control socket listening on " << m_config.control_socket.value() << std::endl;
 		}
 	}
 	~Server()
 	{
+		m_control_socket.reset();
+		m_batch_pool.exit();
+		for (auto&& learner : m_learners) {
+			if (learner.rate_limiter.has_value()) {
+				learner.rate_limiter->exit();
+			}
+		}
 		for (auto&& predictor : m_predictors) {
 			predictor.exit();
 		}
-		m_predictor_event.notify_all();
+		for (auto&& learner : m_learners) {
+			learner.predictor_event.notify_all();
+			{
+				std::lock_guard lock{learner.training_queue_lock};
+			}
+			learner.lockstep_event.notify_all();
+		}
+		// the workers stop answering before the predictors they answer are destroyed
+		for (auto&& worker : m_inference_workers) {
+			worker.exit();
+		}
 		m_predictors.clear();
+		m_inference_workers.clear();
 		for (auto&& trainer : m_trainers) {
 			trainer.exit();
 		}
-		m_trainer_event.notify_all();
+		for (auto&& learner : m_learners) {
+			learner.trainer_event.notify_all();
+		}
 		m_trainers.clear();
+		setBatchThreadPool(nullptr, 0);
 		for (auto&& actor : m_actors) {
 			actor.exit();
 		}
 		m_actors.clear();
+		for (auto&& reader : m_offline_readers) {
+			reader.exit();
+		}
+		m_offline_readers.clear();
+		// closes the last segment after the actors appended their last rollouts
+		m_trajectory_writer.reset();
+		// the predictors are gone, so nothing answers the proxies of the workers anymore
+		for (auto&& worker : m_actor_workers) {
+			worker.exit();
+		}
+		m_actor_workers.clear();
+		m_remote_actors.reset();
 	}
 
-	void train(const std::size_t training_steps)
+	// with several learners, every learner trains training_steps
+	TrainResult train(const std::size_t training_steps, std::optional<std::chrono::steady_clock::duration> time_limit = std::nullopt)
 	{
-		std::size_t trained_steps = 0;
-
-		Loss average_loss{};
+		using Clock = std::chrono::steady_clock;
+		const auto deadline = Clock::now() + time_limit.value_or(Clock::duration::zero());
+		std::optional<std::pair<Clock::time_point, std::size_t>> first_trained;
+		const auto initial_trained_steps = totalTrainedSteps();
 
 		std::vector<std::reference_wrapper<Trainer>> training_batches;
 		std::vector<std::reference_wrapper<Predictor>> prediction_batches;
+		std::vector<bool> issued(m_learners.size());
+		for (auto&& learner : m_learners) {
+			learner.log_start = Clock::now();
+		}
 
 		while (true) {
 			training_batches.clear();
 			prediction_batches.clear();
 			{
 				std::unique_lock lock{m_batches_lock};
-				m_server_event.wait(lock, [this] { return !m_training_batches.empty() || !m_prediction_batches.empty(); });
+				auto has_batches = [this] { return !m_training_batches.empty() || !m_prediction_batches.empty() || m_offline_error; };
+				auto wake_time = time_limit.has_value() ? deadline : Clock::time_point::max();
+				for (auto&& learner : m_learners) {
+					if (learner.operation_pending) {
+						wake_time = std::min(wake_time, learner.last_issued + IDLE_SYNC_DELAY);
+					}
+				}
+				if (wake_time != Clock::time_point::max()) {
+					m_server_event.wait_until(lock, wake_time, has_batches);
+				} else {
+					m_server_event.wait(lock, has_batches);
+				}
+				if (m_offline_error) {
+					std::rethrow_exception(m_offline_error);
+				}
 				std::swap(m_training_batches, training_batches);
 				std::swap(m_prediction_batches, prediction_batches);
 			}
+			issued.assign(m_learners.size(), false);
 			for (auto&& trainer : training_batches) {
+				auto& learner = trainer.get().learner();
 				auto& batch = trainer.get().getBatchData();
 				auto num_datas = ranges::accumulate(batch.data_sizes, static_cast<std::int64_t>(0));
-				m_agent->train(batch.states, batch.actions, batch.rewards, batch.policies, batch.discounts, batch.loss_coefs, batch.data_sizes, [this, &average_loss, &trained_steps, trainer, num_datas](const Loss& loss) {
+				learner.agent->train(batch.states, batch.actions, batch.rewards, batch.policies, batch.discounts, batch.data_sizes, [this, &learner, trainer, num_datas](const Loss& loss) {
 					trainer.get().processFinished();
-					average_loss = exponentialMovingAverage(average_loss, loss, AVERAGE_LOSS_DECAY);
-					auto prev_trained_steps = trained_steps;
-					trained_steps += static_cast<std::size_t>(num_datas);
-					if constexpr (LOG_INTERVAL_STEPS.has_value()) {
-						if (trained_steps / LOG_INTERVAL_STEPS.value() != prev_trained_steps / LOG_INTERVAL_STEPS.value()) {
-							std::cout << "steps " << trained_steps << " , loss " << average_loss << std::endl;
+					learner.model_version.fetch_add(1, std::memory_order_release);
+					if (learner.rate_limiter.has_value()) {
+						learner.rate_limiter->sample(static_cast<std::size_t>(num_datas));
+					}
+					learner.average_loss = exponentialMovingAverage(learner.average_loss, loss, m_config.average_loss_decay);
+					auto prev_trained_steps = learner.trained_steps.fetch_add(static_cast<std::size_t>(num_datas));
+					auto trained_steps = prev_trained_steps + static_cast<std::size_t>(num_datas);
+					if (auto log_interval = m_tunables.log_interval_steps.load(); log_interval > 0) {
+						if (trained_steps / log_interval != prev_trained_steps / log_interval) {
+							logProgress(learner, trained_steps);
 						}
 					}
-					if constexpr (SAVE_INTERVAL_STEPS.has_value()) {
-						if (trained_steps / SAVE_INTERVAL_STEPS.value() != prev_trained_steps / SAVE_INTERVAL_STEPS.value()) {
-							m_agent->save(static_cast<std::int64_t>(trained_steps));
+					if (m_config.save_interval_steps.has_value()) {
+						if (trained_steps / m_config.save_interval_steps.value() != prev_trained_steps / m_config.save_interval_steps.value()) {
+							saveCheckpoint(learner, trained_steps);
 						}
 					}
 				});
+				learner.operation_pending = true;
+				learner.last_issued = Clock::now();
+				issued[learner.index] = true;
+			}
+			if (m_weight_snapshot.has_value() && m_learners.front().model_version.load(std::memory_order_acquire) >= m_published_model_version + m_config.weight_publish_interval) {
+				publishWeights();
+			}
+			if (m_config.native_inference) {
+				for (auto&& learner : m_learners) {
+					if (learner.model_version.load(std::memory_order_acquire) >= learner.inference_weights_version + m_config.weight_publish_interval) {
+						publishInferenceWeights(learner);
+					}
+				}
 			}
 			for (auto&& predictor : prediction_batches) {
-				m_agent->template predict<DiscreteActionTraits<Action>::num_actions>(predictor.get().getStates(), predictor.get().getBufferForPolicies(), [predictor]() {
+				auto& learner = predictor.get().learner();
+				learner.agent->template predict<DiscreteActionTraits<Action>::num_actions>(predictor.get().getStates(), predictor.get().getBufferForPolicies(), [predictor]() {
 					predictor.get().processFinished();
 				});
+				// the prediction runs after every training operation issued before it
+				predictor.get().setModelVersion(learner.model_version.load(std::memory_order_acquire));
+				learner.operation_pending = true;
+				learner.last_issued = Clock::now();
+				issued[learner.index] = true;
+			}
+			// an operation finishes when its agent gets the next one, which may never come if the actors of
+			// the learner all wait for it. A learner that keeps getting batches is left alone
+			const auto now = Clock::now();
+			for (auto&& learner : m_learners) {
+				if (learner.operation_pending && !issued[learner.index] && now - learner.last_issued >= IDLE_SYNC_DELAY) {
+					learner.agent->sync();
+					learner.operation_pending = false;
+				}
+			}
+			const auto total_trained_steps = totalTrainedSteps();
+			if (m_learners.size() > 1) {
+				// a learner that is done keeps only its reserved actors, the others get the rest
+				bool finished = false;
+				for (auto&& learner : m_learners) {
+					if (!learner.finished && learner.trained_steps >= training_steps) {
+						std::cout << "learner " << learner.index << " finished" << std::endl;
+						learner.finished = true;
+						finished = true;
+					}
+				}
+				if (m_config.actor_reassign_interval_steps.has_value() && total_trained_steps >= m_next_reassign_steps) {
+					reassignActors();
+					m_next_reassign_steps = total_trained_steps + m_config.actor_reassign_interval_steps.value();
+				} else if (finished) {
+					std::vector<double> weights;
+					for (auto&& learner : m_learners) {
+						weights.push_back(learner.finished ? 0.0 : 1.0);
+					}
+					assignActors(std::move(weights));
+				}
+			}
+			if (!first_trained.has_value() && total_trained_steps > initial_trained_steps) {
+				first_trained.emplace(Clock::now(), total_trained_steps);
+				if (m_resumed) {
+					std::cout << "restart : first trained batch " << std::chrono::duration<double>(first_trained->first - processStartTime()).count() << " s after the process started" << std::endl;
+					m_resumed = false;
+				}
 			}
-			if (trained_steps >= training_steps) {
+			if (std::all_of(m_learners.begin(), m_learners.end(), [training_steps](const Learner& learner) { return learner.trained_steps >= training_steps; })) {
 				std::cout << "training finished" << std::endl;
 				break;
 			}
+			if (time_limit.has_value() && Clock::now() >= deadline) {
+				break;
+			}
+		}
+		TrainResult result{totalTrainedSteps(), 0.0};
+		if (first_trained.has_value()) {
+			auto elapsed = std::chrono::duration<double>(Clock::now() - first_trained->first).count();
+			if (elapsed > 0.0) {
+				result.steps_per_second = static_cast<double>(result.trained_steps - first_trained->second) / elapsed;
+			}
 		}
+		return result;
 	}
 
 private:
+	struct Learner;
 	class Predictor;
 	class Trainer;
 	class Actor;
+	class OfflineReader;
+	class ExternalActors;
+	class ActorWorker;
+	class RemoteActorConnection;
+	class RemoteActorListener;
+	class InferenceWorker;
+
+	struct InferenceWeights
+	{
+		InferenceWeights(ranges::span<const float> weights, std::uint64_t model_version) : weights(weights), model_version(model_version) {}
+
+		const typename InferenceModel::Weights weights;
+		const std::uint64_t model_version;
+	};
+
+	// settings that can be changed through the control socket while training
+	struct TunableSettings
+	{
+		explicit TunableSettings(const TrainConfig& config) noexcept
+		    : min_prediction_batch_size(config.min_prediction_batch_size),
+		      max_prediction_batch_size(config.max_prediction_batch_size),
+		      min_training_batch_size(config.min_training_batch_size),
+		      max_training_batch_size(config.max_training_batch_size),
+		      num_active_actors(config.num_actors),
+		      log_interval_steps(config.log_interval_steps.value_or(0))
+		{}
+
+		std::atomic<std::size_t> min_prediction_batch_size;
+		std::atomic<std::size_t> max_prediction_batch_size;
+		std::atomic<std::size_t> min_training_batch_size;
+		std::atomic<std::size_t> max_training_batch_size;
+		std::atomic<std::size_t> num_active_actors;
+		// 0 disables logging
+		std::atomic<std::size_t> log_interval_steps;
+	};
+
+	std::string handleControlCommand(const std::string& command)
+	{
+		std::istringstream iss{command};
+		std::string name;
+		iss >> name;
+		std::ostringstream oss;
+		if (name == "stats") {
+			using Clock = std::chrono::steady_clock;
+			const auto now = Clock::now();
+			std::size_t env_steps = 0;
+			std::size_t prediction_queue_size = 0;
+			std::size_t training_queue_size = 0;
+			for (auto&& learner : m_learners) {
+				env_steps += learner.env_steps.load();
+				{
+					std::lock_guard lock{learner.prediction_queue_lock};
+					prediction_queue_size += learner.prediction_queue.size();
+				}
+				{
+					std::lock_guard lock{learner.training_queue_lock};
+					training_queue_size += learner.training_queue.size();
+				}
+			}
+			const auto trained_steps = totalTrainedSteps();
+			const auto elapsed = std::chrono::duration<double>(now - m_last_stats_time).count();
+			oss << "prediction_queue " << prediction_queue_size << '\n';
+			oss << "training_queue " << training_queue_size << '\n';
+			oss << "env_steps " << env_steps << '\n';
+			oss << "trained_steps " << trained_steps << '\n';
+			oss << "env_steps_per_second " << static_cast<double>(env_steps - m_last_stats_env_steps) / elapsed << '\n';
+			oss << "trained_steps_per_second " << static_cast<double>(trained_steps - m_last_stats_trained_steps) / elapsed << '\n';
+			if (m_learners.size() == 1) {
+				oss << "model_version " << m_learners.front().model_version.load() << '\n';
+			} else {
+				for (auto&& learner : m_learners) {
+					const auto prefix = "learner" + std::to_string(learner.index) + "_";
+					const auto [episodes, mean_score] = learner.scores();
+					oss << prefix << "model_version " << learner.model_version.load() << '\n';
+					oss << prefix << "env_steps " << learner.env_steps.load() << '\n';
+					oss << prefix << "trained_steps " << learner.trained_steps.load() << '\n';
+					oss << prefix << "actors " << learner.num_actors.load() << '\n';
+					oss << prefix << "episodes " << episodes << '\n';
+					oss << prefix << "mean_score " << mean_score << '\n';
+				}
+			}
+			std::size_t replay_rollouts = 0;
+			std::size_t replayed_steps = 0;
+			for (auto&& learner : m_learners) {
+				replay_rollouts += (learner.replay.has_value() ? learner.replay->size() : 0);
+				replayed_steps += learner.replayed_steps.load();
+			}
+			oss << "replay_rollouts " << replay_rollouts << '\n';
+			oss << "replayed_steps " << replayed_steps << '\n';
+			oss << "resampled_actions " << m_resampled_actions.load() << '\n';
+			oss << "actor_worker_restarts " << m_actor_worker_restarts.load() << '\n';
+			oss << "inference_workers " << m_inference_workers.size() << '\n';
+			oss << "inference_worker_restarts " << m_inference_worker_restarts.load() << '\n';
+			if (m_config.native_inference) {
+				oss << "native_inference_weight_updates " << m_inference_weight_updates.load() << '\n';
+			}
+			if (m_weight_snapshot.has_value()) {
+				const auto& header = m_weight_snapshot->header();
+				oss << "weight_snapshot_model_version " << m_published_model_version.load() << '\n';
+				oss << "weight_snapshot_mean_milliseconds " << static_cast<double>(m_weight_snapshot_nanoseconds.load()) * 1e-6 / static_cast<double>(std::max<std::size_t>(m_weight_snapshots.load(), 1)) << '\n';
+				oss << "weight_snapshot_reads " << header.num_reads.load(std::memory_order_relaxed) << '\n';
+				oss << "weight_snapshot_skipped_versions " << header.skipped_versions.load(std::memory_order_relaxed) << '\n';
+			}
+			oss << "checkpoints " << m_checkpoints.load() << '\n';
+			oss << "checkpoint_stall_mean_milliseconds " << static_cast<double>(m_checkpoint_stall_nanoseconds.load()) * 1e-6 / static_cast<double>(std::max<std::size_t>(m_checkpoints.load(), 1)) << '\n';
+			if (m_checkpoint_writer.has_value()) {
+				oss << "checkpoint_write_mean_milliseconds " << m_checkpoint_writer->meanWriteSeconds() * 1e3 << '\n';
+				oss << "checkpoint_failures " << m_checkpoint_writer->failedCheckpoints() << '\n';
+			}
+			if (!m_offline_readers.empty()) {
+				oss << "offline_rollouts " << m_offline_rollouts.load() << '\n';
+				oss << "offline_epochs " << m_offline_epochs.load() << '\n';
+			}
+			if (m_trajectory_writer.has_value()) {
+				oss << "recorded_rollouts " << m_trajectory_writer->writtenRecords() << '\n';
+				oss << "recorded_bytes " << m_trajectory_writer->writtenBytes() << '\n';
+				oss << "recorded_segments " << m_trajectory_writer->numSegments() << '\n';
+				oss << "dropped_recorded_rollouts " << m_trajectory_writer->droppedRecords() << '\n';
+			}
+			oss << "remote_actor_nodes " << m_remote_actor_nodes.load() << '\n';
+			oss << "remote_bytes_per_env_step " << static_cast<double>(m_remote_bytes.load()) / static_cast<double>(std::max<std::size_t>(m_remote_env_steps.load(), 1)) << '\n';
+			oss << "batch_buffers_in_use " << m_batch_pool.numInUse() << '\n';
+			oss << "batch_buffer_bytes " << m_batch_pool.residentBytes() << '\n';
+			oss << "shared_prediction_batches " << m_batch_pool.numShared() << '\n';
+			oss << "shared_prediction_batch_bytes " << m_batch_pool.sharedBytes() << '\n';
+			oss << "min_prediction_batch_size " << m_tunables.min_prediction_batch_size << '\n';
+			oss << "max_prediction_batch_size " << m_tunables.max_prediction_batch_size << '\n';
+			oss << "min_training_batch_size " << m_tunables.min_training_batch_size << '\n';
+			oss << "max_training_batch_size " << m_tunables.max_training_batch_size << '\n';
+			oss << "active_actors " << m_tunables.num_active_actors << '\n';
+			oss << "log_interval_steps " << m_tunables.log_interval_steps << '\n';
+			m_last_stats_time = now;
+			m_last_stats_env_steps = env_steps;
+			m_last_stats_trained_steps = trained_steps;
+		} else if (name == "set") {
+			std::string key;
+			std::size_t value;
+			if (!(iss >> key >> value)) {
+				return "error usage: set <key> <value>\n";
+			}
+			if (auto error = setTunable(key, value); !error.empty()) {
+				return "error " + error + "\n";
+			}
+		} else {
+			return "error commands: stats, set <key> <value>\n";
+		}
+		oss << "ok\n";
+		return oss.str();
+	}
+
+	std::string setTunable(const std::string& key, std::size_t value)
+	{
+		auto& t = m_tunables;
+		if (key == "min_prediction_batch_size") {
+			if (value == 0 || value > t.max_prediction_batch_size || value > t.num_active_actors + numWorkerEnvs()) {
+				return "min_prediction_batch_size must be in [1, min(max_prediction_batch_size, active_actors + worker environments)]";
+			}
+			if (value * m_learners.size() > t.num_active_actors) {
+				return "min_prediction_batch_size must not exceed active_actors / num_learners";
+			}
+			t.min_prediction_batch_size = value;
+			assignActors();
+		} else if (key == "max_prediction_batch_size") {
+			if (value < t.min_prediction_batch_size) {
+				return "max_prediction_batch_size must not be less than min_prediction_batch_size";
+			}
+			// the rings of the inference workers are sized for the configured maximum
+			if (!m_inference_workers.empty() && value > m_config.max_prediction_batch_size) {
+				return "max_prediction_batch_size must not exceed the configured maximum while inference workers are used";
+			}
+			t.max_prediction_batch_size = value;
+		} else if (key == "min_training_batch_size") {
+			if (value == 0 || value > t.max_training_batch_size) {
+				return "min_training_batch_size must be in [1, max_training_batch_size]";
+			}
+			t.min_training_batch_size = value;
+		} else if (key == "max_training_batch_size") {
+			if (value < t.min_training_batch_size) {
+				return "max_training_batch_size must not be less than min_training_batch_size";
+			}
+			t.max_training_batch_size = value;
+		} else if (key == "active_actors") {
+			if (value + numWorkerEnvs() < t.min_prediction_batch_size || value > m_actors.size()) {
+				return "active_actors must be in [min_prediction_batch_size - worker environments, num_actors]";
+			}
+			if (value < t.min_prediction_batch_size * m_learners.size()) {
+				return "active_actors must not be less than min_prediction_batch_size * num_learners";
+			}
+			t.num_active_actors = value;
+			assignActors();
+			for (auto&& actor : m_actors) {
+				actor.wakeUp();
+			}
+		} else if (key == "log_interval_steps") {
+			t.log_interval_steps = value;
+		} else {
+			return "unknown key " + key;
+		}
+		// thresholds changed, so waiting predictors and trainers have to re-check their conditions
+		for (auto&& learner : m_learners) {
+			{
+				std::lock_guard lock{learner.prediction_queue_lock};
+			}
+			learner.predictor_event.notify_all();
+			{
+				std::lock_guard lock{learner.training_queue_lock};
+			}
+			learner.trainer_event.notify_all();
+		}
+		return {};
+	}
+
+	std::size_t numWorkerEnvs() const noexcept
+	{
+		return m_config.num_actor_workers * m_config.envs_per_actor_worker;
+	}
+
+	static std::string makeSharedMemoryName()
+	{
+		static std::atomic<std::size_t> serial{0};
+		return "/impala-" + std::to_string(::getpid()) + "-" + std::to_string(serial++);
+	}
+
+	void startInferenceWorkers()
+	{
+		// every predictor has at most one batch in flight, and a record that does not fit at the end of a ring
+		// skips the rest of it, hence the factor of two
+		std::vector<Observation> observation(1);
+		ObsBatch row;
+		Environment::makeBatch(observation.cbegin(), observation.cend(), row);
+		std::size_t num_buffers = 0;
+		forEachBuffer([&](const auto&) { ++num_buffers; }, row);
+		const auto batch_bytes = sizeof(InferenceRequestHeader) + num_buffers * sizeof(std::uint64_t) + m_config.max_prediction_batch_size * bufferBytes(row) + 8;
+		const auto response_bytes = sizeof(InferenceResponseHeader) + m_config.max_prediction_batch_size * DiscreteActionTraits<Action>::num_actions * sizeof(float) + 8;
+		for (auto&& i : ranges::view::indices(m_config.num_inference_workers)) {
+			m_inference_workers.emplace_back(*this, i, 2 * m_config.num_predictors * batch_bytes, 2 * m_config.num_predictors * response_bytes);
+		}
+	}
 
+	// on the learner thread, readers copy the snapshot without ever blocking it
+	void publishWeights()
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const auto model_version = m_learners.front().model_version.load(std::memory_order_acquire);
+		m_learners.front().agent->exportWeights(m_weight_buffer);
+		m_weight_snapshot->publish(m_weight_buffer.data(), model_version);
+		m_published_model_version = model_version;
+		m_weight_snapshots.fetch_add(1, std::memory_order_relaxed);
+		m_weight_snapshot_nanoseconds.fetch_add(static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+	}
+
+	// packs the weights on the learner thread, the predictors take the new ones with their next batch
+	void publishInferenceWeights(Learner& learner)
+	{
+		const auto model_version = learner.model_version.load(std::memory_order_acquire);
+		learner.agent->exportWeights(m_weight_buffer);
+		auto weights = std::make_shared<const InferenceWeights>(ranges::span<const float>{m_weight_buffer.data(), static_cast<std::ptrdiff_t>(m_weight_buffer.size())}, model_version);
+		std::atomic_store(&learner.inference_weights, std::move(weights));
+		learner.inference_weights_version = model_version;
+		m_inference_weight_updates.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// predictors and trainers spend their time waiting on the Python pool, only the server loop, the
+	// Python intra-op threads and the batch threads keep a cpu busy
+	static ThreadPlacement makeThreadPlacement(const TrainConfig& config)
+	{
+		return ThreadPlacement{CpuTopology::load(), 1 + config.num_python_threads.value_or(1) + config.num_batch_threads, config.num_inference_workers * config.num_python_threads.value_or(1)};
+	}
+	// batch buffers are first touched by the pinned thread, so they are allocated on the learner node
+	void pinLearnerThread() const
+	{
+		if (m_thread_placement.has_value()) {
+			pinCurrentThread(m_thread_placement->learnerCpus());
+		}
+	}
+
+	static std::vector<std::unique_ptr<Agent>> makeAgents(std::unique_ptr<Agent> agent)
+	{
+		std::vector<std::unique_ptr<Agent>> agents;
+		agents.push_back(std::move(agent));
+		return agents;
+	}
+
+	std::size_t totalTrainedSteps() const
+	{
+		return std::accumulate(m_learners.begin(), m_learners.end(), std::size_t{0}, [](std::size_t sum, const Learner& learner) { return sum + learner.trained_steps.load(); });
+	}
+
+	// Every learner gets a prediction batch of the active actors, the rest is split in proportion to the
+	// learner weights. The learners are interleaved, so that any prefix of the actors is split about the same
+	// way. Actors move at the end of their episode.
+	void assignActors()
+	{
+		std::lock_guard lock{m_assign_mutex};
+		splitActors();
+	}
+	void assignActors(std::vector<double> weights)
+	{
+		std::lock_guard lock{m_assign_mutex};
+		m_learner_weights = std::move(weights);
+		splitActors();
+	}
+	// under the assign mutex
+	void splitActors()
+	{
+		const auto num_learners = m_learners.size();
+		const auto num_active = std::min<std::size_t>(m_tunables.num_active_actors, m_config.num_actors);
+		const auto reserved = std::min(m_tunables.min_prediction_batch_size.load(), num_active / num_learners);
+		const auto rest = num_active - reserved * num_learners;
+		const auto total_weight = std::accumulate(m_learner_weights.begin(), m_learner_weights.end(), 0.0);
+		std::vector<std::size_t> counts(num_learners, reserved);
+		std::vector<std::pair<double, std::size_t>> remainders;
+		std::size_t assigned = 0;
+		for (auto&& k : ranges::view::indices(num_learners)) {
+			const auto exact = (total_weight > 0.0 ? static_cast<double>(rest) * m_learner_weights[k] / total_weight : static_cast<double>(rest) / static_cast<double>(num_learners));
+			const auto share = std::min(static_cast<std::size_t>(exact), rest - assigned);
+			counts[k] += share;
+			assigned += share;
+			remainders.emplace_back(exact - static_cast<double>(share), k);
+		}
+		std::sort(remainders.begin(), remainders.end(), std::greater<>{});
+		for (std::size_t i = 0; assigned < rest; ++i, ++assigned) {
+			++counts[remainders[i % num_learners].second];
+		}
+		// smooth weighted round robin
+		std::vector<std::int64_t> credits(num_learners, 0);
+		for (auto&& i : ranges::view::indices(m_config.num_actors)) {
+			std::size_t learner = i % num_learners;
+			if (i < num_active) {
+				for (auto&& k : ranges::view::indices(num_learners)) {
+					credits[k] += static_cast<std::int64_t>(counts[k]);
+				}
+				learner = static_cast<std::size_t>(std::max_element(credits.begin(), credits.end()) - credits.begin());
+				credits[learner] -= static_cast<std::int64_t>(num_active);
+			}
+			m_actor_learners[i].store(learner, std::memory_order_relaxed);
+		}
+		for (auto&& k : ranges::view::indices(num_learners)) {
+			m_learners[k].num_actors.store(counts[k], std::memory_order_relaxed);
+		}
+	}
+
+	// population based training style: the learners that are not done are ranked by their recent score and get
+	// actors by rank
+	void reassignActors()
+	{
+		std::vector<std::pair<double, std::size_t>> ranking;
+		for (auto&& learner : m_learners) {
+			if (!learner.finished) {
+				ranking.emplace_back(learner.scores().second, learner.index);
+			}
+		}
+		std::stable_sort(ranking.begin(), ranking.end(), [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+		std::vector<double> weights(m_learners.size(), 0.0);
+		for (auto&& [rank, entry] : ranges::view::zip(ranges::view::indices, ranking)) {
+			weights[entry.second] = static_cast<double>(ranking.size() - static_cast<std::size_t>(rank));
+		}
+		assignActors(std::move(weights));
+		std::cout << "actors reassigned :";
+		for (auto&& [score, index] : ranking) {
+			std::cout << " learner " << index << " score " << score << " actors " << m_learners[index].num_actors.load() << " ,";
+		}
+		std::cout << std::endl;
+	}
+
+	// on the learner thread, which waits only for the snapshot when the checkpoints are asynchronous
+	void saveCheckpoint(Learner& learner, std::size_t trained_steps)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		// written after the files of the agent, so that a checkpoint with it is complete
+		CheckpointFile server_state{checkpointDirectory(learner, trained_steps) + "/" + SERVER_STATE_FILE, makeServerState(learner)};
+		if (m_checkpoint_writer.has_value()) {
+			std::vector<CheckpointFile> files;
+			learner.agent->snapshot(static_cast<std::int64_t>(trained_steps), files);
+			files.push_back(std::move(server_state));
+			m_checkpoint_writer->write(std::move(files));
+		} else {
+			learner.agent->save(static_cast<std::int64_t>(trained_steps));
+			try {
+				CheckpointWriter::writeFile(server_state);
+			} catch (const CheckpointError& e) {
+				std::cerr << "checkpoint failed : " << e.what() << std::endl;
+			}
+		}
+		const auto stall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		m_checkpoints.fetch_add(1, std::memory_order_relaxed);
+		m_checkpoint_stall_nanoseconds.fetch_add(static_cast<std::size_t>(stall.count()), std::memory_order_relaxed);
+		const auto prefix = m_learners.size() > 1 ? "learner " + std::to_string(learner.index) + " : " : std::string{};
+		std::cout << prefix << "checkpoint " << trained_steps << " , stall " << static_cast<double>(stall.count()) * 1e-6 << " ms" << std::endl;
+	}
+
+	std::uint64_t makeSeed(std::uint64_t stream) const
+	{
+		return m_config.seed.has_value() ? deriveSeed(m_config.seed.value(), stream) : std::random_device{}();
+	}
+
+	std::string checkpointDirectory(const Learner& learner, std::size_t trained_steps) const
+	{
+		return learner.agent->outputDirectory() + "/" + std::to_string(trained_steps);
+	}
+
+	// the counters of the learner and where the actor threads continue their episodes, see resume
+	std::vector<std::byte> makeServerState(Learner& learner)
+	{
+		static_assert(std::is_trivially_copyable_v<ActorResumeState>);
+		std::vector<ActorResumeState> actor_states;
+		actor_states.reserve(m_actors.size());
+		for (auto&& actor : m_actors) {
+			if (auto state = actor.resumeState(); state.has_value()) {
+				actor_states.push_back(state.value());
+			}
+		}
+		const auto [episodes, mean_score] = learner.scores();
+		const ServerStateHeader header{ServerStateHeader::MAGIC, static_cast<std::uint32_t>(SAVED_LOSS_BYTES), static_cast<std::uint32_t>(sizeof(ActorResumeState)), learner.trained_steps.load(), learner.env_steps.load(), learner.model_version.load(std::memory_order_acquire), episodes, mean_score, actor_states.size()};
+		std::vector<std::byte> data(sizeof(header) + SAVED_LOSS_BYTES + actor_states.size() * sizeof(ActorResumeState));
+		std::memcpy(data.data(), &header, sizeof(header));
+		if constexpr (SAVED_LOSS_BYTES > 0) {
+			std::memcpy(data.data() + sizeof(header), &learner.average_loss, SAVED_LOSS_BYTES);
+		}
+		std::memcpy(data.data() + sizeof(header) + SAVED_LOSS_BYTES, actor_states.data(), actor_states.size() * sizeof(ActorResumeState));
+		return data;
+	}
+
+	// Loads the latest checkpoint of the learner that has a server state and restores the counters saved with it.
+	// The actors are shared, they continue the episodes saved with the first learner that is resumed.
+	void resume(Learner& learner)
+	{
+		const auto prefix = m_learners.size() > 1 ? "learner " + std::to_string(learner.index) + " : " : std::string{};
+		const auto index = latestCheckpoint(learner.agent->outputDirectory(), SERVER_STATE_FILE);
+		if (!index.has_value()) {
+			std::cout << prefix << "no checkpoint to resume in " << learner.agent->outputDirectory() << " , starting from scratch" << std::endl;
+			return;
+		}
+		const auto directory = checkpointDirectory(learner, static_cast<std::size_t>(index.value()));
+		const auto data = readCheckpointFile(directory + "/" + SERVER_STATE_FILE);
+		ServerStateHeader header{};
+		if (data.size() >= sizeof(header)) {
+			std::memcpy(&header, data.data(), sizeof(header));
+		}
+		if (data.size() < sizeof(header) || header.magic != ServerStateHeader::MAGIC || header.loss_bytes != SAVED_LOSS_BYTES || header.actor_state_bytes != sizeof(ActorResumeState) || data.size() != sizeof(header) + SAVED_LOSS_BYTES + header.num_actor_states * sizeof(ActorResumeState)) {
+			throw CheckpointError(directory + "/" + SERVER_STATE_FILE + " is truncated or was written by another build");
+		}
+		learner.agent->load(index.value());
+		learner.trained_steps.store(header.trained_steps);
+		learner.env_steps.store(header.env_steps);
+		learner.model_version.store(header.model_version, std::memory_order_release);
+		learner.log_trained_steps = header.trained_steps;
+		learner.log_env_steps = header.env_steps;
+		learner.log_episodes = header.episodes;
+		m_last_stats_env_steps += header.env_steps;
+		m_last_stats_trained_steps += header.trained_steps;
+		{
+			std::lock_guard lock{learner.score_lock};
+			learner.episodes = header.episodes;
+			learner.mean_score = header.mean_score;
+		}
+		if constexpr (SAVED_LOSS_BYTES > 0) {
+			std::memcpy(&learner.average_loss, data.data() + sizeof(header), SAVED_LOSS_BYTES);
+		}
+		std::size_t resumed_actors = 0;
+		if (!m_resumed) {
+			m_actor_resume_states.assign(m_config.num_actors, std::nullopt);
+			for (auto&& i : ranges::view::indices(header.num_actor_states)) {
+				ActorResumeState state;
+				std::memcpy(&state, data.data() + sizeof(header) + SAVED_LOSS_BYTES + i * sizeof(ActorResumeState), sizeof(state));
+				if (state.actor < m_config.num_actors) {
+					m_actor_resume_states[state.actor] = state;
+					++resumed_actors;
+				}
+			}
+		}
+		m_resumed = true;
+		std::cout << prefix << "resumed from " << directory << " : trained steps " << header.trained_steps << " , env steps " << header.env_steps << " , episodes " << header.episodes << " , actors continuing their episodes " << resumed_actors << std::endl;
+	}
+
+	// on the learner thread, when the trained steps of the learner cross the log interval
+	void logProgress(Learner& learner, std::size_t trained_steps)
+	{
+		const auto prefix = m_learners.size() > 1 ? "learner " + std::to_string(learner.index) + " : " : std::string{};
+		std::cout << prefix << "steps " << trained_steps << " , loss " << learner.average_loss << std::endl;
+		std::cout << prefix << "policy lag " << learner.policy_lag_histogram << " , dropped " << learner.dropped_rollouts.exchange(0) << std::endl;
+		learner.policy_lag_histogram.reset();
+		if (learner.rate_limiter.has_value()) {
+			auto [actor_blocked, learner_blocked] = learner.rate_limiter->takeBlockedSeconds();
+			std::cout << prefix << "rate limiter blocked seconds : actors " << actor_blocked << " , trainers " << learner_blocked << std::endl;
+		}
+		if (learner.replay.has_value()) {
+			std::cout << prefix << "replay rollouts " << learner.replay->size() << " (" << learner.replay->residentBytes() << " bytes) , replayed steps " << learner.replayed_steps << std::endl;
+		}
+		if (m_weight_snapshot.has_value()) {
+			const auto& header = m_weight_snapshot->header();
+			std::cout << "weight snapshots " << m_weight_snapshots << " , mean " << static_cast<double>(m_weight_snapshot_nanoseconds) * 1e-6 / static_cast<double>(std::max<std::size_t>(m_weight_snapshots, 1)) << " ms , reads " << header.num_reads.load(std::memory_order_relaxed) << " , skipped versions " << header.skipped_versions.load(std::memory_order_relaxed) << std::endl;
+		}
+		if (!m_offline_readers.empty()) {
+			std::cout << "offline rollouts " << m_offline_rollouts << " , epochs " << m_offline_epochs << std::endl;
+		}
+		if (m_trajectory_writer.has_value()) {
+			std::cout << "recorded rollouts " << m_trajectory_writer->writtenRecords() << " (" << m_trajectory_writer->writtenBytes() << " bytes in " << m_trajectory_writer->numSegments() << " segments) , dropped " << m_trajectory_writer->droppedRecords() << std::endl;
+		}
+		if (m_config.reuse_encodings) {
+			const auto reused = static_cast<double>(m_reused_encoding_bytes.exchange(0));
+			const auto encoded = static_cast<double>(m_encoded_training_bytes.exchange(0));
+			std::cout << "encoding reuse rate " << reused / std::max(reused + encoded, 1.0) << " , shared prediction batches " << m_batch_pool.numShared() << " (" << m_batch_pool.sharedBytes() << " bytes)" << std::endl;
+		}
+		if (m_learners.size() > 1) {
+			const auto now = std::chrono::steady_clock::now();
+			const auto elapsed = std::chrono::duration<double>(now - learner.log_start).count();
+			const auto env_steps = learner.env_steps.load();
+			const auto [episodes, mean_score] = learner.scores();
+			std::cout << prefix << "env steps per second " << static_cast<double>(env_steps - learner.log_env_steps) / elapsed << " , trained steps per second " << static_cast<double>(trained_steps - learner.log_trained_steps) / elapsed << " , actors " << learner.num_actors << " , episodes " << episodes - learner.log_episodes << " , mean score " << mean_score << std::endl;
+			learner.log_start = now;
+			learner.log_env_steps = env_steps;
+			learner.log_trained_steps = trained_steps;
+			learner.log_episodes = episodes;
+		}
+	}
+
+	struct PredictionBatch
+	{
+		std::size_t size = 0;
+		ObsBatch states;
+		PinnedMemoryVector<float> policy_lists;
+
+		friend std::size_t bufferBytes(const PredictionBatch& batch) noexcept
+		{
+			return bufferBytes(batch.states) + bufferBytes(batch.policy_lists);
+		}
+	};
+	// a row of a prediction batch kept for the training batch, so that the observation is encoded once
+	struct EncodedObservation
+	{
+		std::shared_ptr<const PredictionBatch> batch;
+		std::size_t row = 0;
+	};
+	// receives the sampled action for an observation queued for prediction
+	class ActionReceiver
+	{
+	public:
+		virtual void setNextAction(std::int64_t action_id, float policy, std::uint64_t model_version, EncodedObservation encoded) = 0;
+
+	protected:
+		~ActionReceiver() = default;
+	};
 	struct PredictionData
 	{
 		std::reference_wrapper<std::add_const_t<Observation>> observation;
-		std::reference_wrapper<Actor> actor;
+		std::reference_wrapper<ActionReceiver> actor;
+		// the index of the actor thread, prediction batches are sorted by it in the deterministic mode
+		std::size_t order = 0;
 	};
 	struct StepData
 	{
@@ -173,31 +1004,192 @@ private:
 		Action action;
 		Reward reward;
 		float policy;
+		std::uint64_t model_version;
 		bool next_goal;
-		bool aborted_terminal;
+		EncodedObservation encoded;
 	};
+	using ReplayStep = typename ReplayBuffer<Observation, Reward>::Step;
 	struct TrainingData
 	{
 		std::vector<StepData> steps;
 		Observation terminal;
+		std::uint64_t model_version;
+		// tick * num_actors + actor index in the deterministic mode, the trainer takes rollouts in this order
+		std::uint64_t order = 0;
 	};
+	// rollouts are sorted by length and packed time-major: step t of the first data_sizes[t] rollouts,
+	// followed by the bootstrap observation of every rollout
 	struct TrainingBatch
 	{
-		std::array<std::int64_t, T_MAX> data_sizes;
+		std::vector<std::int64_t> data_sizes;
 		ObsBatch states;
 		PinnedMemoryVector<std::int64_t> actions;
 		PinnedMemoryVector<Reward> rewards;
 		PinnedMemoryVector<float> policies;
 		PinnedMemoryVector<float> discounts;
-		PinnedMemoryVector<float> loss_coefs;
+
+		friend std::size_t bufferBytes(const TrainingBatch& batch) noexcept
+		{
+			return bufferBytes(batch.data_sizes) + bufferBytes(batch.states) + bufferBytes(batch.actions) + bufferBytes(batch.rewards) + bufferBytes(batch.policies) + bufferBytes(batch.discounts);
+		}
+	};
+	// the agent finishes an operation when the next one is issued, so two batches must be able to be in flight
+	static inline constexpr std::size_t MIN_BATCHES_IN_FLIGHT = 2;
+
+	// the batch pool charges the first buffers of each type with these, before any batch has been filled
+	static std::size_t encodedObservationBytes()
+	{
+		std::vector<Observation> observations(1);
+		ObsBatch states;
+		Environment::makeBatch(observations.begin(), observations.end(), states);
+		return bufferBytes(states);
+	}
+	static std::size_t predictionBatchBytes(const TrainConfig& config)
+	{
+		return config.max_prediction_batch_size * (encodedObservationBytes() + DiscreteActionTraits<Action>::num_actions * sizeof(float));
+	}
+	// t_max steps and the bootstrap observation of every rollout, with the longest t_max of the learners
+	static std::size_t trainingBatchBytes(const TrainConfig& config)
+	{
+		std::size_t t_max = 0;
+		for (auto&& i : ranges::view::indices(config.num_learners)) {
+			t_max = std::max(t_max, config.learnerTMax(i));
+		}
+		const auto step_bytes = sizeof(std::int64_t) + sizeof(Reward) + 2 * sizeof(float);
+		return t_max * sizeof(std::int64_t) + config.max_training_batch_size * ((t_max + 1) * encodedObservationBytes() + t_max * step_bytes);
+	}
+	// an agent with an operation in flight and no new batch for this long is synced
+	static inline constexpr std::chrono::milliseconds IDLE_SYNC_DELAY{1};
+	// a checkpoint waits for the disk only when this many are still being written
+	static inline constexpr std::size_t MAX_PENDING_CHECKPOINTS = 2;
+	// recorded rollouts beyond this wait for the disk are dropped
+	static inline constexpr std::size_t MAX_QUEUED_RECORD_BYTES = std::size_t{64} << 20;
+	// seed streams of the predictors and trainers, the actors use their indices
+	static inline constexpr std::uint64_t PREDICTOR_SEED_STREAM = std::uint64_t{1} << 40;
+	static inline constexpr std::uint64_t TRAINER_SEED_STREAM = std::uint64_t{2} << 40;
+	// written last into every checkpoint directory, see makeServerState
+	static inline constexpr const char* SERVER_STATE_FILE = "server_state.bin";
+	// the average loss is restored only if it can be copied as bytes
+	static inline constexpr std::size_t SAVED_LOSS_BYTES = std::is_trivially_copyable_v<Loss> ? sizeof(Loss) : 0;
+
+	// An actor thread continues its episode from here after a restart. Recorded whenever it has sent a rollout,
+	// so that no step is trained twice.
+	struct ActorResumeState
+	{
+		std::uint64_t actor;
+		// the episodes the actor finished before this one
+		std::uint64_t episode;
+		std::uint64_t steps;
+		Reward score;
+		typename Environment::State env;
+	};
+
+	// followed by the average loss (loss_bytes) and num_actor_states ActorResumeStates
+	struct ServerStateHeader
+	{
+		static inline constexpr std::uint64_t MAGIC = 0x696d70616c617373ull;
+
+		std::uint64_t magic;
+		// sizes of this build, a state with others is rejected
+		std::uint32_t loss_bytes;
+		std::uint32_t actor_state_bytes;
+		std::uint64_t trained_steps;
+		std::uint64_t env_steps;
+		std::uint64_t model_version;
+		std::uint64_t episodes;
+		double mean_score;
+		std::uint64_t num_actor_states;
+	};
+
+	// An agent with its own prediction and training queues. The predictors and trainers of a learner only
+	// serve its queues, the actors are assigned to the learners by assignActors.
+	struct Learner
+	{
+		static inline constexpr double SCORE_DECAY = 0.99;
+
+		Learner(std::size_t index, std::unique_ptr<Agent> agent, const TrainConfig& config)
+		    : index(index), agent(std::move(agent)), t_max(config.learnerTMax(index)), discount(config.learnerDiscount(index)), replay_fraction(config.replay_fraction)
+		{
+			if (config.samples_per_insert.has_value()) {
+				rate_limiter.emplace(config.samples_per_insert.value(), config.samples_per_insert_tolerance);
+			}
+			if (replay_fraction > 0.0) {
+				replay.emplace(config.replay_capacity, t_max);
+			}
+		}
+
+		// the fresh rollouts a batch of batch_size rollouts needs, the rest is replayed once there is replay data
+		std::size_t minFreshRollouts(std::size_t batch_size) const
+		{
+			if (!replay.has_value() || replay->size() == 0) {
+				return batch_size;
+			}
+			return std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(static_cast<double>(batch_size) * (1.0 - replay_fraction))));
+		}
+
+		void addEpisode(double score)
+		{
+			std::lock_guard lock{score_lock};
+			mean_score = (episodes == 0 ? score : SCORE_DECAY * mean_score + (1.0 - SCORE_DECAY) * score);
+			++episodes;
+		}
+		// finished episodes and the moving average of their scores
+		std::pair<std::size_t, double> scores()
+		{
+			std::lock_guard lock{score_lock};
+			return {episodes, mean_score};
+		}
+
+		const std::size_t index;
+		const std::unique_ptr<Agent> agent;
+		const std::size_t t_max;
+		const float discount;
+		const double replay_fraction;
+		std::optional<RateLimiter> rate_limiter;
+		std::optional<ReplayBuffer<Observation, Reward>> replay;
+		std::atomic<std::size_t> replayed_steps{0};
+		std::deque<PredictionData> prediction_queue;
+		std::mutex prediction_queue_lock;
+		std::condition_variable predictor_event;
+		std::deque<TrainingData> training_queue;
+		std::mutex training_queue_lock;
+		std::condition_variable trainer_event;
+		// the trainers took rollouts, for the offline reader
+		std::condition_variable queue_space_event;
+		// deterministic mode, under the training queue lock: the predictor starts a tick when all actors wait
+		// for actions and the trainer ends it when it has trained every batch of the rollouts queued so far
+		std::uint64_t lockstep_tick = 0;
+		std::uint64_t lockstep_trained_tick = 0;
+		std::condition_variable lockstep_event;
+		std::atomic<std::uint64_t> model_version{0};
+		std::atomic<std::size_t> trained_steps{0};
+		std::atomic<std::size_t> env_steps{0};
+		std::atomic<std::size_t> num_actors{0};
+		Log2Histogram policy_lag_histogram;
+		std::atomic<std::size_t> dropped_rollouts{0};
+		// native_inference: replaced with std::atomic_store by the learner thread
+		std::shared_ptr<const InferenceWeights> inference_weights;
+		// the rest is only touched by the learner thread, except for the scores
+		std::uint64_t inference_weights_version = 0;
+		Loss average_loss{};
+		bool operation_pending = false;
+		// when the last operation was issued
+		std::chrono::steady_clock::time_point last_issued;
+		bool finished = false;
+		std::chrono::steady_clock::time_point log_start = std::chrono::steady_clock::now();
+		std::size_t log_env_steps = 0;
+		std::size_t log_trained_steps = 0;
+		std::size_t log_episodes = 0;
+		std::mutex score_lock;
+		std::size_t episodes = 0;
+		double mean_score = 0.0;
 	};
 
 	class Predictor
 	{
 	public:
-		explicit Predictor(Server& server) noexcept : m_server(server)
+		Predictor(Server& server, Learner& learner, std::uint64_t seed) noexcept : m_server(server), m_learner(learner), m_random_engine(seed)
 		{
-			m_policy_lists.reserve(MAX_PREDICTION_BATCH_SIZE * DiscreteActionTraits<Action>::num_actions);
 			m_thread = std::thread{[this] {
 				run();
 			}};
@@ -209,23 +1201,29 @@ private:
 
 		void run()
 		{
+			m_server.get().pinLearnerThread();
 			std::vector<std::reference_wrapper<std::add_const_t<Observation>>> observations;
-			std::vector<std::reference_wrapper<Actor>> actors;
-			observations.reserve(MAX_PREDICTION_BATCH_SIZE);
-			actors.reserve(MAX_PREDICTION_BATCH_SIZE);
+			std::vector<std::reference_wrapper<ActionReceiver>> actors;
+			observations.reserve(config().max_prediction_batch_size);
+			actors.reserve(config().max_prediction_batch_size);
 			while (true) {
 				observations.clear();
 				actors.clear();
 				bool data_remain = false;
 				{
-					std::unique_lock lock{m_server.get().m_prediction_queue_lock};
-					m_server.get().m_predictor_event.wait(lock, [this] { return m_server.get().m_prediction_queue.size() >= MIN_PREDICTION_BATCH_SIZE || m_exit_flag; });
+					std::unique_lock lock{learner().prediction_queue_lock};
+					learner().predictor_event.wait(lock, [this] { return learner().prediction_queue.size() >= minBatchSize() || m_exit_flag; });
 					if (m_exit_flag) {
 						break;
 					}
-					auto& queue = m_server.get().m_prediction_queue;
+					auto& queue = learner().prediction_queue;
+					if (config().deterministic) {
+						std::sort(queue.begin(), queue.end(), [](const PredictionData& lhs, const PredictionData& rhs) {
+							return lhs.order < rhs.order;
+						});
+					}
 					while (!queue.empty()) {
-						if (observations.size() >= MAX_PREDICTION_BATCH_SIZE) {
+						if (observations.size() >= tunables().max_prediction_batch_size && !config().deterministic) {
 							break;
 						}
 						auto& data = queue.front();
@@ -233,40 +1231,88 @@ private:
 						actors.emplace_back(data.actor);
 						queue.pop_front();
 					}
-					data_remain = (queue.size() >= MIN_PREDICTION_BATCH_SIZE);
+					data_remain = (queue.size() >= tunables().min_prediction_batch_size);
 				}
 				if (data_remain) {
-					m_server.get().m_predictor_event.notify_one();
+					learner().predictor_event.notify_one();
 				}
-				m_policy_lists.resize(actors.size() * DiscreteActionTraits<Action>::num_actions, boost::container::default_init);
-				Environment::makeBatch(observations.begin(), observations.end(), m_states);
-				{
-					std::lock_guard lock{m_server.get().m_batches_lock};
-					m_server.get().m_prediction_batches.emplace_back(*this);
-					m_processing_flag = true;
+				// the rollouts of the previous tick are trained before this batch is predicted
+				if (config().deterministic && !awaitLockstepTraining()) {
+					break;
 				}
-				m_server.get().m_server_event.notify_one();
-				{
+				m_batch = m_server.get().m_batch_pool.template acquire<PredictionBatch>();
+				if (!m_batch) {
+					break;
+				}
+				m_batch->size = actors.size();
+				m_batch->policy_lists.resize(actors.size() * DiscreteActionTraits<Action>::num_actions, boost::container::default_init);
+				// the native model reads the observations, the encodings are only made for the trainers to reuse
+				if (!config().native_inference || config().reuse_encodings) {
+					Environment::makeBatch(observations.begin(), observations.end(), m_batch->states);
+				}
+				if (config().native_inference) {
+					const auto weights = std::atomic_load(&learner().inference_weights);
+					m_inference_model.predict(weights->weights, observations, {m_batch->policy_lists.data(), static_cast<std::ptrdiff_t>(m_batch->policy_lists.size())});
+					m_model_version = weights->model_version;
+				} else {
+					if (auto& workers = m_server.get().m_inference_workers; !workers.empty()) {
+						{
+							std::lock_guard lock{m_mutex};
+							m_processing_flag = true;
+						}
+						workers[m_server.get().m_next_inference_worker.fetch_add(1, std::memory_order_relaxed) % workers.size()].submit(*this);
+					} else {
+						{
+							std::lock_guard lock{m_server.get().m_batches_lock};
+							m_server.get().m_prediction_batches.emplace_back(*this);
+							m_processing_flag = true;
+						}
+						m_server.get().m_server_event.notify_one();
+					}
 					std::unique_lock lock{m_mutex};
 					m_event.wait(lock, [this] { return !m_processing_flag || m_exit_flag; });
 					if (m_exit_flag) {
 						break;
 					}
 				}
+				const auto batch_size = static_cast<std::ptrdiff_t>(actors.size());
+				m_action_ids.resize(actors.size());
+				m_action_policies.resize(actors.size());
+				sampleActions<DiscreteActionTraits<Action>::num_actions>({m_batch->policy_lists.data(), batch_size * static_cast<std::ptrdiff_t>(DiscreteActionTraits<Action>::num_actions)}, {m_action_ids.data(), batch_size}, {m_action_policies.data(), batch_size}, m_random_engine);
+				std::shared_ptr<const PredictionBatch> shared_batch;
+				if (config().reuse_encodings) {
+					shared_batch = m_server.get().m_batch_pool.share(std::move(m_batch));
+				}
 				for (auto&& [i, actor] : ranges::view::zip(ranges::view::indices, actors)) {
-					actor.get().setNextPolicyList({m_policy_lists.data() + i * DiscreteActionTraits<Action>::num_actions, DiscreteActionTraits<Action>::num_actions});
+					actor.get().setNextAction(m_action_ids[i], m_action_policies[i], m_model_version, {shared_batch, static_cast<std::size_t>(i)});
 				}
+				m_server.get().m_batch_pool.release(std::move(m_batch));
 			}
 		}
 
+		Learner& learner() const
+		{
+			return m_learner.get();
+		}
+
 		ObsBatch& getStates()
 		{
-			return m_states;
+			return m_batch->states;
+		}
+
+		std::size_t getBatchSize() const
+		{
+			return m_batch->size;
 		}
 
 		PinnedMemoryVector<float>& getBufferForPolicies()
 		{
-			return m_policy_lists;
+			return m_batch->policy_lists;
+		}
+
+		void setModelVersion(std::uint64_t model_version)
+		{
+			m_model_version = model_version;
 		}
 
 		void exit()
@@ -288,26 +1334,52 @@ private:
 		}
 
 	private:
+		// every active actor in the deterministic mode
+		std::size_t minBatchSize() const
+		{
+			return config().deterministic ? tunables().num_active_actors.load() : tunables().min_prediction_batch_size.load();
+		}
+
+		// starts a tick and waits until the trainer has trained the rollouts queued so far, false on exit
+		bool awaitLockstepTraining()
+		{
+			std::unique_lock lock{learner().training_queue_lock};
+			const auto tick = ++learner().lockstep_tick;
+			learner().trainer_event.notify_one();
+			learner().lockstep_event.wait(lock, [this, tick] { return learner().lockstep_trained_tick == tick || m_exit_flag; });
+			return !m_exit_flag;
+		}
+
+		const TrainConfig& config() const
+		{
+			return m_server.get().m_config;
+		}
+		TunableSettings& tunables() const
+		{
+			return m_server.get().m_tunables;
+		}
+
 		std::reference_wrapper<Server> m_server;
+		std::reference_wrapper<Learner> m_learner;
 		std::thread m_thread;
 		std::mutex m_mutex;
 		std::condition_variable m_event;
 		bool m_processing_flag = false;
 		bool m_exit_flag = false;
-		ObsBatch m_states;
-		PinnedMemoryVector<float> m_policy_lists;
+		BatchLease<PredictionBatch> m_batch;
+		std::uint64_t m_model_version = 0;
+		std::vector<std::int64_t> m_action_ids;
+		std::vector<float> m_action_policies;
+		FastRandomEngine m_random_engine;
+		// scratch buffers of the native model
+		InferenceModel m_inference_model;
 	};
 
 	class Trainer
 	{
 	public:
-		explicit Trainer(Server& server) noexcept : m_server(server)
+		Trainer(Server& server, Learner& learner, std::uint64_t seed) noexcept : m_server(server), m_learner(learner), m_random_engine(seed)
 		{
-			m_batch.actions.reserve(MAX_TRAINING_BATCH_SIZE * T_MAX);
-			m_batch.rewards.reserve(MAX_TRAINING_BATCH_SIZE * T_MAX);
-			m_batch.policies.reserve(MAX_TRAINING_BATCH_SIZE * T_MAX);
-			m_batch.discounts.reserve(MAX_TRAINING_BATCH_SIZE * T_MAX);
-			m_batch.loss_coefs.reserve(MAX_TRAINING_BATCH_SIZE * T_MAX);
 			m_thread = std::thread{[this] {
 				run();
 			}};
@@ -319,56 +1391,123 @@ private:
 
 		void run()
 		{
+			m_server.get().pinLearnerThread();
 			std::vector<TrainingData> datas;
-			datas.reserve(MAX_TRAINING_BATCH_SIZE);
+			datas.reserve(config().max_training_batch_size);
+			std::vector<TrainingData> stale_datas;
 			std::vector<Observation> observations;
-			observations.reserve(MAX_TRAINING_BATCH_SIZE * (T_MAX + 1));
+			observations.reserve(config().max_training_batch_size * (learner().t_max + 1));
+			std::vector<EncodedObservation> encodings;
 			while (true) {
 				datas.clear();
+				stale_datas.clear();
 				observations.clear();
-				m_batch.actions.clear();
-				m_batch.rewards.clear();
-				m_batch.policies.clear();
-				m_batch.discounts.clear();
-				m_batch.loss_coefs.clear();
 				bool data_remain = false;
+				if (learner().rate_limiter.has_value()) {
+					learner().rate_limiter->awaitSample(tunables().min_training_batch_size * learner().t_max);
+				}
 				{
-					std::unique_lock lock{m_server.get().m_training_queue_lock};
-					m_server.get().m_trainer_event.wait(lock, [this] { return m_server.get().m_training_queue.size() >= MIN_TRAINING_BATCH_SIZE || m_exit_flag; });
+					std::unique_lock lock{learner().training_queue_lock};
+					learner().trainer_event.wait(lock, [this] { return hasWork() || m_exit_flag; });
 					if (m_exit_flag) {
 						break;
 					}
-					auto& queue = m_server.get().m_training_queue;
+					auto& queue = learner().training_queue;
+					if (config().deterministic) {
+						// the rollouts left from earlier ticks come first, then the new ones in the order of the actors
+						std::sort(queue.begin(), queue.end(), [](const TrainingData& lhs, const TrainingData& rhs) {
+							return lhs.order < rhs.order;
+						});
+						if (queue.size() < learner().minFreshRollouts(tunables().min_training_batch_size)) {
+							learner().lockstep_trained_tick = learner().lockstep_tick;
+							learner().lockstep_event.notify_all();
+							continue;
+						}
+					}
+					const auto current_version = learner().model_version.load(std::memory_order_acquire);
+					const auto max_fresh = learner().minFreshRollouts(tunables().max_training_batch_size);
 					while (!queue.empty()) {
-						if (datas.size() >= MAX_TRAINING_BATCH_SIZE) {
+						if (datas.size() >= max_fresh) {
 							break;
 						}
 						auto& data = queue.front();
-						datas.emplace_back(std::move(data));
+						const auto lag = current_version - std::min(current_version, data.model_version);
+						learner().policy_lag_histogram.add(lag);
+						if (config().max_policy_lag.has_value() && lag > config().max_policy_lag.value()) {
+							stale_datas.emplace_back(std::move(data));
+						} else {
+							datas.emplace_back(std::move(data));
+						}
 						queue.pop_front();
 					}
-					data_remain = (queue.size() >= MIN_TRAINING_BATCH_SIZE);
+					data_remain = (queue.size() >= learner().minFreshRollouts(tunables().min_training_batch_size));
 				}
 				if (data_remain) {
-					m_server.get().m_trainer_event.notify_one();
+					learner().trainer_event.notify_one();
+				}
+				if (config().offline_trajectories.has_value()) {
+					learner().queue_space_event.notify_one();
+				}
+				if (config().stale_data_policy == StaleDataPolicy::DEPRIORITIZE) {
+					// stale rollouts only top up batches that would otherwise be short; the freshest ones are used first
+					while (datas.size() < learner().minFreshRollouts(tunables().min_training_batch_size) && !stale_datas.empty()) {
+						datas.emplace_back(std::move(stale_datas.back()));
+						stale_datas.pop_back();
+					}
+				}
+				learner().dropped_rollouts.fetch_add(stale_datas.size(), std::memory_order_relaxed);
+				if (learner().rate_limiter.has_value()) {
+					// dropped rollouts leave the pipeline, so they count as consumed
+					learner().rate_limiter->sample(std::accumulate(stale_datas.begin(), stale_datas.end(), std::size_t{0}, [](std::size_t sum, const TrainingData& data) { return sum + data.steps.size(); }));
+				}
+				if (datas.empty()) {
+					continue;
+				}
+				addReplay(datas);
+				m_batch = m_server.get().m_batch_pool.template acquire<TrainingBatch>();
+				if (!m_batch) {
+					break;
 				}
-				for (auto i : ranges::view::indices(T_MAX)) {
-					m_batch.data_sizes.at(i) = 0;
+				m_batch->actions.clear();
+				m_batch->rewards.clear();
+				m_batch->policies.clear();
+				m_batch->discounts.clear();
+				std::stable_sort(datas.begin(), datas.end(), [](const TrainingData& lhs, const TrainingData& rhs) {
+					return lhs.steps.size() > rhs.steps.size();
+				});
+				const auto max_length = datas.front().steps.size();
+				m_batch->data_sizes.assign(max_length, 0);
+				for (auto i : ranges::view::indices(max_length)) {
 					for (auto& data : datas) {
-						auto& step = data.steps.at(i);
-						observations.emplace_back(std::move(step.observation));
-						m_batch.actions.emplace_back(DiscreteActionTraits<Action>::convertToID(step.action));
-						m_batch.rewards.emplace_back(std::move(step.reward));
-						m_batch.policies.emplace_back(std::move(step.policy));
-						m_batch.discounts.emplace_back(step.next_goal ? 0.0f : DISCOUNT);
-						m_batch.loss_coefs.emplace_back(step.aborted_terminal ? 0.0f : 1.0f);
-						m_batch.data_sizes.at(i) += step.aborted_terminal ? 0 : 1;
+						if (data.steps.size() <= i) {
+							break;
+						}
+						auto& step = data.steps[i];
+						if (config().reuse_encodings) {
+							// replayed steps have no encoding, they are encoded with the bootstrap observations
+							if (!step.encoded.batch) {
+								observations.emplace_back(std::move(step.observation));
+							}
+							encodings.emplace_back(std::move(step.encoded));
+						} else {
+							observations.emplace_back(std::move(step.observation));
+						}
+						m_batch->actions.emplace_back(DiscreteActionTraits<Action>::convertToID(step.action));
+						m_batch->rewards.emplace_back(std::move(step.reward));
+						m_batch->policies.emplace_back(std::move(step.policy));
+						m_batch->discounts.emplace_back(step.next_goal ? 0.0f : learner().discount);
+						++m_batch->data_sizes[i];
 					}
 				}
 				for (auto& data : datas) {
 					observations.emplace_back(std::move(data.terminal));
 				}
-				Environment::makeBatch(observations.cbegin(), observations.cend(), m_batch.states);
+				if (config().reuse_encodings) {
+					gatherStates(encodings, observations);
+					encodings.clear();
+				} else {
+					Environment::makeBatch(observations.cbegin(), observations.cend(), m_batch->states);
+				}
 				{
 					std::lock_guard lock{m_server.get().m_batches_lock};
 					m_server.get().m_training_batches.emplace_back(*this);
@@ -382,12 +1521,18 @@ private:
 						break;
 					}
 				}
+				m_server.get().m_batch_pool.release(std::move(m_batch));
 			}
 		}
 
+		Learner& learner() const
+		{
+			return m_learner.get();
+		}
+
 		TrainingBatch& getBatchData()
 		{
-			return m_batch;
+			return *m_batch;
 		}
 
 		void exit()
@@ -409,24 +1554,127 @@ private:
 		}
 
 	private:
+		// under the training queue lock: enough rollouts, or an unfinished tick in the deterministic mode
+		bool hasWork() const
+		{
+			if (config().deterministic) {
+				return learner().lockstep_trained_tick != learner().lockstep_tick;
+			}
+			return learner().training_queue.size() >= learner().minFreshRollouts(tunables().min_training_batch_size);
+		}
+
+		const TrainConfig& config() const
+		{
+			return m_server.get().m_config;
+		}
+		TunableSettings& tunables() const
+		{
+			return m_server.get().m_tunables;
+		}
+
 		std::reference_wrapper<Server> m_server;
+		std::reference_wrapper<Learner> m_learner;
 		std::thread m_thread;
 		std::mutex m_mutex;
 		std::condition_variable m_event;
 		bool m_processing_flag = false;
 		bool m_exit_flag = false;
-		TrainingBatch m_batch;
+		// copies the rows encoded by the predictors, only the steps without an encoding and the bootstrap
+		// observations, in that order in unencoded, are encoded here
+		void gatherStates(const std::vector<EncodedObservation>& encodings, const std::vector<Observation>& unencoded)
+		{
+			Environment::makeBatch(unencoded.cbegin(), unencoded.cend(), m_bootstrap_states);
+			const auto num_steps = encodings.size();
+			const auto num_unencoded = unencoded.size();
+			// the row of every step in m_bootstrap_states, for the steps without an encoding
+			m_unencoded_rows.clear();
+			std::size_t next_row = 0;
+			for (auto&& encoded : encodings) {
+				m_unencoded_rows.push_back(encoded.batch ? 0 : next_row++);
+			}
+			const auto num_bootstraps = num_unencoded - next_row;
+			std::size_t reused_bytes = 0;
+			std::size_t encoded_bytes = 0;
+			forEachBuffer([&](auto& dest, const auto& bootstrap) {
+				using T = typename std::decay_t<decltype(dest)>::value_type;
+				const auto row_length = bootstrap.size() / num_unencoded;
+				dest.resize((num_steps + num_bootstraps) * row_length, boost::container::default_init);
+				std::copy_n(bootstrap.data() + next_row * row_length, num_bootstraps * row_length, dest.data() + num_steps * row_length);
+				reused_bytes += (num_steps - next_row) * row_length * sizeof(T);
+				encoded_bytes += bootstrap.size() * sizeof(T);
+			},
+			    m_batch->states, m_bootstrap_states);
+			parallelForBatch(num_steps, [&](std::size_t first, std::size_t last) {
+				for (auto i = first; i < last; ++i) {
+					const auto& encoded = encodings[i];
+					if (!encoded.batch) {
+						forEachBuffer([&](auto& dest, const auto& src) {
+							const auto row_length = src.size() / num_unencoded;
+							std::copy_n(src.data() + m_unencoded_rows[i] * row_length, row_length, dest.data() + i * row_length);
+						},
+						    m_batch->states, m_bootstrap_states);
+						continue;
+					}
+					forEachBuffer([&](auto& dest, const auto& src) {
+						const auto row_length = src.size() / encoded.batch->size;
+						std::copy_n(src.data() + encoded.row * row_length, row_length, dest.data() + i * row_length);
+					},
+					    m_batch->states, encoded.batch->states);
+				}
+			});
+			m_server.get().m_reused_encoding_bytes.fetch_add(reused_bytes, std::memory_order_relaxed);
+			m_server.get().m_encoded_training_bytes.fetch_add(encoded_bytes, std::memory_order_relaxed);
+		}
+
+		// keeps the fresh rollouts for replay and appends replayed ones for the replay fraction of the batch
+		void addReplay(std::vector<TrainingData>& datas)
+		{
+			auto& replay = learner().replay;
+			if (!replay.has_value()) {
+				return;
+			}
+			const auto num_fresh = datas.size();
+			for (auto&& data : datas) {
+				m_replay_steps.clear();
+				for (auto&& step : data.steps) {
+					m_replay_steps.push_back({step.observation, static_cast<std::uint8_t>(DiscreteActionTraits<Action>::convertToID(step.action)), step.next_goal, step.reward, step.policy});
+				}
+				replay->add({m_replay_steps.data(), static_cast<std::ptrdiff_t>(m_replay_steps.size())}, data.terminal, data.model_version);
+			}
+			const auto fraction = learner().replay_fraction;
+			const auto wanted = static_cast<std::size_t>(std::lround(static_cast<double>(num_fresh) * fraction / (1.0 - fraction)));
+			const auto max_batch_size = tunables().max_training_batch_size.load();
+			std::size_t replayed_steps = 0;
+			replay->sample(std::min(wanted, max_batch_size - std::min(num_fresh, max_batch_size)), m_random_engine, [&](ranges::span<const ReplayStep> steps, const Observation& terminal, std::uint64_t model_version) {
+				TrainingData data;
+				data.steps.reserve(static_cast<std::size_t>(steps.size()));
+				for (std::ptrdiff_t i = 0; i < steps.size(); ++i) {
+					const auto& step = steps.data()[i];
+					data.steps.push_back({step.observation, DiscreteActionTraits<Action>::convertFromID(step.action_id), step.reward, step.policy, model_version, step.next_goal, EncodedObservation{}});
+				}
+				data.terminal = terminal;
+				data.model_version = model_version;
+				replayed_steps += data.steps.size();
+				datas.emplace_back(std::move(data));
+			});
+			learner().replayed_steps.fetch_add(replayed_steps, std::memory_order_relaxed);
+		}
+
+		BatchLease<TrainingBatch> m_batch;
+		ObsBatch m_bootstrap_states;
+		std::vector<std::size_t> m_unencoded_rows;
+		std::vector<ReplayStep> m_replay_steps;
+		FastRandomEngine m_random_engine;
 	};
 
-	class Actor
+	class Actor : public ActionReceiver
 	{
 	public:
-		explicit Actor(Server& server) noexcept : m_server(server)
+		Actor(Server& server, std::size_t index, std::optional<ActorResumeState> resume_state) noexcept : m_server(server), m_index(index), m_resume_state(resume_state)
 		{
 			m_thread = std::thread{[this] {
 				run();
 			}};
-			m_action_sample_random_engine.seed(std::random_device{}());
 		}
 		~Actor()
 		{
@@ -435,85 +1683,118 @@ private:
 
 		void run()
 		{
+			if (m_server.get().m_thread_placement.has_value()) {
+				pinCurrentThread({m_server.get().m_thread_placement->actorCpu(m_index)});
+			}
+			if (config().seed.has_value()) {
+				m_env.seed(deriveSeed(config().seed.value(), m_index));
+			}
 			std::vector<StepData> step_datas;
-			step_datas.reserve(T_MAX);
 			while (true) {
+				// a rollout that continues into the next episode stays with its learner
+				if (step_datas.empty()) {
+					m_learner = &m_server.get().m_learners[m_server.get().m_actor_learners[m_index].load(std::memory_order_relaxed)];
+					step_datas.reserve(m_learner->t_max);
+				}
 				Reward sum_of_reward = Reward{};
 				std::size_t t = 0;
-				Observation observation = m_env.reset();
+				Observation observation = m_resume_state.has_value() ? resumeEpisode(t, sum_of_reward) : m_env.reset();
+				const auto episode_id = trajectoryEpisodeId(m_index, m_episodes++);
 				while (true) {
-					{
-						bool enough_predictor_data = false;
-						{
-							std::lock_guard lock{m_server.get().m_prediction_queue_lock};
-							m_server.get().m_prediction_queue.emplace_back(PredictionData{std::cref(observation), *this});
-							m_predicting_flag = true;
-							enough_predictor_data = m_server.get().m_prediction_queue.size() >= MIN_PREDICTION_BATCH_SIZE;
-						}
-						if (enough_predictor_data) {
-							m_server.get().m_predictor_event.notify_one();
-						}
-					}
-					{
+					if (m_index >= tunables().num_active_actors) {
 						std::unique_lock lock{m_mutex};
-						m_event.wait(lock, [this] { return !m_predicting_flag || m_exit_flag; });
+						m_event.wait(lock, [this] { return m_index < tunables().num_active_actors || m_exit_flag; });
 						if (m_exit_flag) {
 							return;
 						}
 					}
 					Action next_action;
-					float policy;
 					while (true) {
-						auto action_id = std::discrete_distribution<std::int64_t>(m_policy_list.begin(), m_policy_list.end())(m_action_sample_random_engine);
-						next_action = DiscreteActionTraits<Action>::convertFromID(action_id);
+						bool enough_predictor_data = false;
+						{
+							std::lock_guard lock{m_learner->prediction_queue_lock};
+							m_learner->prediction_queue.emplace_back(PredictionData{std::cref(observation), *this, m_index});
+							m_predicting_flag = true;
+							enough_predictor_data = m_learner->prediction_queue.size() >= tunables().min_prediction_batch_size;
+						}
+						if (enough_predictor_data) {
+							m_learner->predictor_event.notify_one();
+						}
+						{
+							std::unique_lock lock{m_mutex};
+							m_event.wait(lock, [this] { return !m_predicting_flag || m_exit_flag; });
+							if (m_exit_flag) {
+								return;
+							}
+						}
+						next_action = DiscreteActionTraits<Action>::convertFromID(m_next_action_id);
 						if (m_env.isValidAction(next_action)) {
-							policy = m_policy_list[action_id];
 							break;
 						}
+						// only happens when the model does not mask invalid actions; predicting again keeps rejection sampling semantics
+						m_server.get().m_resampled_actions.fetch_add(1, std::memory_order_relaxed);
 					}
+					const float policy = m_next_action_policy;
 					if (isMainActor()) {
 						m_env.render();
 					}
 					auto&& [next_obs, current_reward, status] = m_env.step(next_action);
 					++t;
+					m_learner->env_steps.fetch_add(1, std::memory_order_relaxed);
 					sum_of_reward += current_reward;
-					step_datas.push_back({std::move(observation), next_action, current_reward, policy, status == EnvState::FINISHED, false});
+					if (step_datas.empty()) {
+						m_rollout_episode_id = episode_id;
+					}
+					step_datas.push_back({std::move(observation), next_action, current_reward, policy, m_policy_version, status == EnvState::FINISHED, std::move(m_encoded)});
 					auto addTrainingData = [&] {
-						if constexpr (NUM_TRAINERS > 0) {
-							TrainingData data{std::move(step_datas), next_obs.clone()};
+						recordRollout(step_datas, next_obs);
+						if (config().num_trainers > 0) {
+							const auto model_version = step_datas.front().model_version;
+							TrainingData data{std::move(step_datas), next_obs.clone(), model_version};
+							if (m_learner->rate_limiter.has_value()) {
+								m_learner->rate_limiter->awaitInsert();
+								m_learner->rate_limiter->insert(data.steps.size());
+							}
 							bool enough_trainer_data = false;
 							{
-								std::lock_guard lock{m_server.get().m_training_queue_lock};
-								auto& queue = m_server.get().m_training_queue;
+								std::lock_guard lock{m_learner->training_queue_lock};
+								auto& queue = m_learner->training_queue;
+								data.order = m_learner->lockstep_tick * config().num_actors + m_index;
 								queue.emplace_back(std::move(data));
-								enough_trainer_data = (queue.size() >= MIN_TRAINING_BATCH_SIZE);
+								enough_trainer_data = (queue.size() >= m_learner->minFreshRollouts(tunables().min_training_batch_size));
 							}
 							if (enough_trainer_data) {
-								m_server.get().m_trainer_event.notify_one();
+								m_learner->trainer_event.notify_one();
 							}
 						}
 						step_datas.clear();
-						step_datas.reserve(T_MAX);
+						step_datas.reserve(m_learner->t_max);
 					};
-					if (step_datas.size() == T_MAX) {
+					if (step_datas.size() == m_learner->t_max) {
 						addTrainingData();
 					}
 					if (status == EnvState::FINISHED) {
+						// the last step ends the episode, so the rollout can be sent early if the actor moves to another learner
+						if (!step_datas.empty() && m_learner->index != m_server.get().m_actor_learners[m_index].load(std::memory_order_relaxed)) {
+							addTrainingData();
+						}
 						break;
 					}
-					if constexpr (MAX_EPISODE_LENGTH.has_value()) {
-						if (t >= MAX_EPISODE_LENGTH.value()) {
+					if (config().max_episode_length.has_value()) {
+						if (t >= config().max_episode_length.value()) {
+							// the truncated rollout is sent as is and bootstraps from next_obs
 							if (!step_datas.empty()) {
-								step_datas.push_back({next_obs.clone(), Action{}, Reward{}, 1.0f, true, true});
-								if (step_datas.size() == T_MAX) {
-									addTrainingData();
-								}
+								addTrainingData();
 							}
 							break;
 						}
 					}
+					if (step_datas.empty()) {
+						saveResumeState(t, sum_of_reward);
+					}
 					observation = std::move(next_obs);
 				}
+				m_learner->addEpisode(static_cast<double>(sum_of_reward));
 				if (isMainActor()) {
 					std::cout << "finish episode : " << t << " " << std::setprecision(5) << sum_of_reward << std::endl;
 				}
@@ -529,47 +1810,946 @@ private:
 			m_event.notify_one();
 		}
 
-		void setNextPolicyList(ranges::span<float> policy_list)
+		void setNextAction(std::int64_t action_id, float policy, std::uint64_t model_version, EncodedObservation encoded) override
 		{
 			{
 				std::lock_guard lock{m_mutex};
-				ranges::copy(policy_list, m_policy_list.begin());
+				m_next_action_id = action_id;
+				m_next_action_policy = policy;
+				m_policy_version = model_version;
+				m_encoded = std::move(encoded);
 				m_predicting_flag = false;
 			}
 			m_event.notify_one();
 		}
 
+		void wakeUp()
+		{
+			{
+				std::lock_guard lock{m_mutex};
+			}
+			m_event.notify_one();
+		}
+
 		bool isMainActor() const
 		{
 			return this == &m_server.get().m_actors.front();
 		}
 
+		std::optional<ActorResumeState> resumeState()
+		{
+			std::lock_guard lock{m_saved_state_lock};
+			return m_saved_state;
+		}
+
 	private:
+		Observation resumeEpisode(std::size_t& t, Reward& sum_of_reward)
+		{
+			const auto state = std::exchange(m_resume_state, std::nullopt).value();
+			m_episodes = state.episode;
+			t = static_cast<std::size_t>(state.steps);
+			sum_of_reward = state.score;
+			return m_env.restore(state.env);
+		}
+
+		// at a rollout boundary, between the steps of an episode that is not over
+		void saveResumeState(std::size_t t, const Reward& sum_of_reward)
+		{
+			ActorResumeState state{m_index, m_episodes - 1, t, sum_of_reward, m_env.state()};
+			std::lock_guard lock{m_saved_state_lock};
+			m_saved_state = state;
+		}
+
+		void recordRollout(const std::vector<StepData>& step_datas, const Observation& terminal)
+		{
+			auto& writer = m_server.get().m_trajectory_writer;
+			if (!writer.has_value()) {
+				return;
+			}
+			m_record_builder.begin(m_record, step_datas.size(), m_rollout_episode_id, m_learner->index, step_datas.front().model_version, terminal);
+			for (auto&& step : step_datas) {
+				m_record_builder.addStep(step.observation, static_cast<std::uint8_t>(DiscreteActionTraits<Action>::convertToID(step.action)), step.next_goal, step.reward, step.policy);
+			}
+			m_record_builder.end();
+			writer->append(m_record);
+		}
+
+		const TrainConfig& config() const
+		{
+			return m_server.get().m_config;
+		}
+		TunableSettings& tunables() const
+		{
+			return m_server.get().m_tunables;
+		}
+
 		std::reference_wrapper<Server> m_server;
+		std::size_t m_index;
+		Learner* m_learner = nullptr;
 		std::thread m_thread;
 		std::mutex m_mutex;
 		std::condition_variable m_event;
-		std::array<float, DiscreteActionTraits<Action>::num_actions> m_policy_list;
+		std::int64_t m_next_action_id = 0;
+		float m_next_action_policy = 0.0f;
+		std::uint64_t m_policy_version = 0;
+		EncodedObservation m_encoded;
 		bool m_predicting_flag = false;
 		bool m_exit_flag = false;
 		Environment m_env;
-		std::mt19937 m_action_sample_random_engine;
+		std::uint64_t m_episodes = 0;
+		std::optional<ActorResumeState> m_resume_state;
+		std::mutex m_saved_state_lock;
+		std::optional<ActorResumeState> m_saved_state;
+		std::uint64_t m_rollout_episode_id = 0;
+		TrajectoryRecordBuilder<Observation, Reward> m_record_builder;
+		std::vector<std::byte> m_record;
+	};
+
+	// Streams recorded rollouts into the training queue of a learner in place of the actors: the segments in the
+	// order they were written, from the start again when they are exhausted. Keeps a few batches of rollouts
+	// queued and has the kernel read the next segment ahead. Rollouts longer than the t_max of the learner are
+	// split, and their model version is the version of the learner when they are queued, so that the policy lag
+	// measures the time in the queue.
+	class OfflineReader
+	{
+	public:
+		OfflineReader(Server& server, Learner& learner) : m_server(server), m_learner(learner)
+		{
+			m_thread = std::thread{[this] {
+				run();
+			}};
+		}
+		~OfflineReader()
+		{
+			m_thread.join();
+		}
+
+		void exit()
+		{
+			{
+				std::lock_guard lock{m_learner.get().training_queue_lock};
+				m_exit_flag = true;
+			}
+			m_learner.get().queue_space_event.notify_one();
+		}
+
+		// returns the segments of the directory after checking that they were recorded with this environment
+		static std::vector<std::string> listSegments(const std::string& directory)
+		{
+			auto paths = TrajectorySegment::list(directory);
+			if (paths.empty()) {
+				throw TrajectoryLogError("no trajectory segments in " + directory);
+			}
+			for (auto&& path : paths) {
+				const auto header = TrajectorySegment::readHeader(path);
+				if (header.observation_bytes != sizeof(Observation) || header.reward_bytes != sizeof(Reward)) {
+					throw TrajectoryLogError(path + " was recorded with another environment");
+				}
+			}
+			return paths;
+		}
+
+	private:
+		using RecordView = TrajectoryRecordView<Observation, Reward>;
+
+		void run()
+		{
+			m_server.get().pinLearnerThread();
+			auto& learner = m_learner.get();
+			const auto& config = m_server.get().m_config;
+			const auto& paths = m_server.get().m_offline_paths;
+			const auto prefetch = MIN_BATCHES_IN_FLIGHT * config.num_trainers * config.max_training_batch_size;
+			try {
+				auto next = std::make_unique<TrajectorySegment>(paths.front());
+				next->adviseSequential();
+				for (std::size_t i = 0;; ++i) {
+					const auto& path = paths[i % paths.size()];
+					auto segment = std::move(next);
+					next = std::make_unique<TrajectorySegment>(paths[(i + 1) % paths.size()]);
+					next->adviseSequential();
+					for (auto offset : segment->recordOffsets()) {
+						const RecordView record{segment->record(offset)};
+						for (std::size_t first = 0; first < record.numSteps(); first += learner.t_max) {
+							if (!queueRollout(path, record, first, std::min(record.numSteps(), first + learner.t_max), prefetch)) {
+								return;
+							}
+						}
+					}
+					if ((i + 1) % paths.size() == 0) {
+						m_server.get().m_offline_epochs.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			} catch (const TrajectoryLogError&) {
+				// the learner would wait for rollouts forever, train() throws the error instead
+				{
+					std::lock_guard lock{m_server.get().m_batches_lock};
+					m_server.get().m_offline_error = std::current_exception();
+				}
+				m_server.get().m_server_event.notify_one();
+			}
+		}
+
+		// returns false on exit
+		bool queueRollout(const std::string& path, const RecordView& record, std::size_t first, std::size_t last, std::size_t prefetch)
+		{
+			auto& learner = m_learner.get();
+			TrainingData data;
+			data.steps.reserve(last - first);
+			for (auto i = first; i < last; ++i) {
+				const auto step = record.step(i);
+				if (step.action_id >= DiscreteActionTraits<Action>::num_actions) {
+					throw TrajectoryLogError(path + " has action id " + std::to_string(step.action_id) + ", the environment has " + std::to_string(DiscreteActionTraits<Action>::num_actions) + " actions");
+				}
+				data.steps.push_back({step.observation, DiscreteActionTraits<Action>::convertFromID(step.action_id), step.reward, step.policy, 0, step.next_goal, EncodedObservation{}});
+			}
+			data.terminal = (last < record.numSteps()) ? record.step(last).observation : record.terminal();
+			if (learner.rate_limiter.has_value()) {
+				learner.rate_limiter->awaitInsert();
+				learner.rate_limiter->insert(data.steps.size());
+			}
+			bool enough_trainer_data = false;
+			{
+				std::unique_lock lock{learner.training_queue_lock};
+				auto& queue = learner.training_queue;
+				learner.queue_space_event.wait(lock, [&] { return queue.size() < prefetch || m_exit_flag; });
+				if (m_exit_flag) {
+					return false;
+				}
+				data.model_version = learner.model_version.load(std::memory_order_acquire);
+				for (auto&& step : data.steps) {
+					step.model_version = data.model_version;
+				}
+				queue.emplace_back(std::move(data));
+				enough_trainer_data = (queue.size() >= learner.minFreshRollouts(m_server.get().m_tunables.min_training_batch_size));
+			}
+			if (enough_trainer_data) {
+				learner.trainer_event.notify_one();
+			}
+			m_server.get().m_offline_rollouts.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		std::reference_wrapper<Server> m_server;
+		std::reference_wrapper<Learner> m_learner;
+		// under the training queue lock of the learner
+		bool m_exit_flag = false;
+		std::thread m_thread;
+	};
+
+	// Environments stepped outside of the actor threads, by actor worker processes or remote actor nodes.
+	// Each environment has a proxy that is queued for prediction in its place and hands the sampled action to
+	// sendAction. Proxies are kept after their environments are gone, because queued requests refer to them.
+	class ExternalActors
+	{
+	public:
+		ExternalActors(Server& server, std::size_t num_envs) : m_server(server), m_num_envs(num_envs)
+		{
+			m_generations.emplace_back();
+			for (auto slot : ranges::view::indices(m_num_envs)) {
+				m_generations.back().emplace_back(*this, slot, m_generation);
+			}
+		}
+
+	protected:
+		~ExternalActors() = default;
+
+		// called with the response mutex held
+		virtual void sendAction(std::size_t slot, std::int64_t action_id, float policy, std::uint64_t model_version) = 0;
+
+		std::size_t numEnvs() const noexcept
+		{
+			return m_num_envs;
+		}
+
+		// copies the observation into the proxy of the slot, queuePredictions hands the added requests to the predictors
+		void addRequest(std::size_t slot, const Observation& observation, bool retry)
+		{
+			auto& proxy = m_generations.back()[slot];
+			if (retry && config().reuse_encodings) {
+				std::lock_guard lock{m_response_mutex};
+				if (!proxy.encodings.empty()) {
+					proxy.encodings.pop_back();
+				}
+			}
+			proxy.observation = observation;
+			m_predictions.push_back(PredictionData{std::cref(proxy.observation), proxy});
+		}
+		void queuePredictions()
+		{
+			if (m_predictions.empty()) {
+				return;
+			}
+			bool enough_predictor_data = false;
+			{
+				std::lock_guard lock{learner().prediction_queue_lock};
+				auto& queue = learner().prediction_queue;
+				queue.insert(queue.end(), m_predictions.begin(), m_predictions.end());
+				enough_predictor_data = queue.size() >= tunables().min_prediction_batch_size;
+			}
+			if (enough_predictor_data) {
+				learner().predictor_event.notify_one();
+			}
+			m_predictions.clear();
+		}
+
+		// the steps get the encodings of the slot in the order in which its actions were sent
+		void addTrainingData(std::size_t slot, TrainingData&& data)
+		{
+			learner().env_steps.fetch_add(data.steps.size(), std::memory_order_relaxed);
+			if (config().num_trainers == 0) {
+				return;
+			}
+			if (config().reuse_encodings) {
+				auto& proxy = m_generations.back()[slot];
+				std::lock_guard lock{m_response_mutex};
+				for (auto& step : data.steps) {
+					if (!proxy.encodings.empty()) {
+						step.encoded = std::move(proxy.encodings.front());
+						proxy.encodings.pop_front();
+					}
+				}
+			}
+			if (learner().rate_limiter.has_value()) {
+				learner().rate_limiter->awaitInsert();
+				learner().rate_limiter->insert(data.steps.size());
+			}
+			bool enough_trainer_data = false;
+			{
+				std::lock_guard lock{learner().training_queue_lock};
+				auto& queue = learner().training_queue;
+				queue.emplace_back(std::move(data));
+				enough_trainer_data = (queue.size() >= learner().minFreshRollouts(tunables().min_training_batch_size));
+			}
+			if (enough_trainer_data) {
+				learner().trainer_event.notify_one();
+			}
+		}
+
+		// answers to the requests made so far are dropped and the slots get fresh proxies
+		void resetProxies()
+		{
+			std::lock_guard lock{m_response_mutex};
+			for (auto&& proxy : m_generations.back()) {
+				proxy.encodings.clear();
+			}
+			++m_generation;
+			m_generations.emplace_back();
+			for (auto slot : ranges::view::indices(m_num_envs)) {
+				m_generations.back().emplace_back(*this, slot, m_generation);
+			}
+		}
+
+		const TrainConfig& config() const
+		{
+			return m_server.get().m_config;
+		}
+		// external actors need num_learners = 1
+		Learner& learner() const
+		{
+			return m_server.get().m_learners.front();
+		}
+		TunableSettings& tunables() const
+		{
+			return m_server.get().m_tunables;
+		}
+
+		std::reference_wrapper<Server> m_server;
+		std::mutex m_response_mutex;
+
+	private:
+		class Proxy : public ActionReceiver
+		{
+		public:
+			Proxy(ExternalActors& owner, std::size_t slot, std::uint64_t generation) noexcept : m_owner(owner), m_slot(slot), m_generation(generation) {}
+
+			void setNextAction(std::int64_t action_id, float policy, std::uint64_t model_version, EncodedObservation encoded) override
+			{
+				std::lock_guard lock{m_owner.get().m_response_mutex};
+				if (m_generation != m_owner.get().m_generation) {
+					return;
+				}
+				if (encoded.batch) {
+					encodings.emplace_back(std::move(encoded));
+				}
+				m_owner.get().sendAction(m_slot, action_id, policy, model_version);
+			}
+
+			Observation observation;
+			// encodings of the steps not yet received in a rollout, guarded by the response mutex
+			std::deque<EncodedObservation> encodings;
+
+		private:
+			std::reference_wrapper<ExternalActors> m_owner;
+			std::size_t m_slot;
+			std::uint64_t m_generation;
+		};
+
+		std::size_t m_num_envs;
+		std::vector<PredictionData> m_predictions;
+		std::uint64_t m_generation = 0;
+		std::deque<std::deque<Proxy>> m_generations;
+	};
+
+	// Server side of an actor worker process. Requests and rollouts are read from the rings of the worker and
+	// the sampled actions are written back to it. A worker that dies is started again with fresh environments.
+	class ActorWorker : public ExternalActors
+	{
+	public:
+		using Channels = ActorWorkerChannels<Observation, Reward>;
+		using Protocol = typename Channels::Protocol;
+
+		ActorWorker(Server& server, std::size_t index)
+		    : ExternalActors(server, server.m_config.envs_per_actor_worker), m_index(index), m_channels(Channels::create(makeSharedMemoryName(), this->numEnvs(), this->learner().t_max, this->config().max_episode_length.value_or(0)))
+		{
+			spawn();
+			m_thread = std::thread{[this] {
+				run();
+			}};
+		}
+		~ActorWorker()
+		{
+			m_thread.join();
+			m_channels.header().exit_flag.store(1, std::memory_order_release);
+			stopProcess(m_pid, std::chrono::seconds(1));
+		}
+
+		void exit()
+		{
+			m_exit_flag.store(true, std::memory_order_release);
+		}
+
+	private:
+		void sendAction(std::size_t slot, std::int64_t action_id, float policy, std::uint64_t model_version) override
+		{
+			const typename Protocol::Response response{static_cast<std::uint32_t>(slot), action_id, policy, model_version};
+			// every environment has at most one request in flight, so the ring always has room
+			m_channels.responses().tryPush(response);
+		}
+
+		void spawn()
+		{
+			const auto& placement = this->m_server.get().m_thread_placement;
+			m_pid = spawnSelf({std::string(ACTOR_WORKER_FLAG) + m_channels.name()}, placement.has_value() ? placement->actorCpus() : std::vector<int>{});
+		}
+
+		void restart()
+		{
+			this->m_server.get().m_actor_worker_restarts.fetch_add(1, std::memory_order_relaxed);
+			std::cerr << "actor worker " << m_index << " exited, restarting" << std::endl;
+			// no response is pushed after this, so the rings can be reset
+			this->resetProxies();
+			m_channels.reset();
+			// a worker that keeps crashing is not restarted in a busy loop
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			spawn();
+		}
+
+		void run()
+		{
+			this->m_server.get().pinLearnerThread();
+			typename Protocol::Request request;
+			std::vector<std::byte> rollout;
+			while (!m_exit_flag.load(std::memory_order_acquire)) {
+				bool received = false;
+				while (m_channels.requests().tryPop(request)) {
+					this->addRequest(request.slot, request.observation, request.retry != 0);
+					received = true;
+				}
+				this->queuePredictions();
+				while (const auto size = m_channels.rollouts().peekSize()) {
+					rollout.resize(size);
+					m_channels.rollouts().pop(rollout.data(), size);
+					addRollout(rollout);
+					received = true;
+				}
+				if (reapProcess(m_pid)) {
+					restart();
+				} else if (!received) {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+		}
+
+		void addRollout(const std::vector<std::byte>& rollout)
+		{
+			typename Protocol::RolloutHeader header;
+			std::memcpy(&header, rollout.data(), sizeof(header));
+			TrainingData data;
+			data.steps.reserve(header.num_steps);
+			for (auto i : ranges::view::indices(header.num_steps)) {
+				typename Protocol::Step step;
+				std::memcpy(&step, rollout.data() + sizeof(header) + i * sizeof(step), sizeof(step));
+				data.steps.push_back({step.observation, DiscreteActionTraits<Action>::convertFromID(step.action_id), step.reward, step.policy, step.model_version, step.next_goal, EncodedObservation{}});
+			}
+			data.terminal = header.terminal;
+			data.model_version = data.steps.front().model_version;
+			this->addTrainingData(header.slot, std::move(data));
+		}
+
+		std::size_t m_index;
+		Channels m_channels;
+		::pid_t m_pid = -1;
+		std::thread m_thread;
+		std::atomic<bool> m_exit_flag{false};
+	};
+
+	// Server side of an inference worker process. Predictors submit their batch and wait for it as they wait for
+	// the learner, and the response thread hands the policies back to them. The worker takes its weights from
+	// the weight snapshot. A worker that dies is started again, and the batches it had not answered are submitted
+	// again.
+	class InferenceWorker
+	{
+	public:
+		InferenceWorker(Server& server, std::size_t index, std::size_t request_capacity, std::size_t response_capacity)
+		    : m_server(server), m_index(index), m_channels(InferenceWorkerChannels::create(makeSharedMemoryName(), server.m_weight_snapshot->name(), DiscreteActionTraits<Action>::num_actions, request_capacity, response_capacity))
+		{
+			spawn();
+			m_thread = std::thread{[this] {
+				run();
+			}};
+		}
+		~InferenceWorker()
+		{
+			exit();
+			m_channels.header().exit_flag.store(1, std::memory_order_release);
+			stopProcess(m_pid, std::chrono::seconds(1));
+		}
+
+		// stops the response thread, so that no predictor is touched after this returns
+		void exit()
+		{
+			m_exit_flag.store(true, std::memory_order_release);
+			if (m_thread.joinable()) {
+				m_thread.join();
+			}
+		}
+
+		void submit(Predictor& predictor)
+		{
+			std::lock_guard lock{m_submit_mutex};
+			const auto sequence = m_next_sequence++;
+			{
+				std::lock_guard in_flight_lock{m_in_flight_mutex};
+				m_in_flight.emplace_back(sequence, predictor);
+			}
+			pushBatch(sequence, predictor);
+		}
+
+	private:
+		void spawn()
+		{
+			auto args = processArguments();
+			args.insert(args.begin(), std::string(INFERENCE_WORKER_FLAG) + m_channels.name());
+			const auto& placement = m_server.get().m_thread_placement;
+			m_pid = spawnSelf(args, placement.has_value() ? placement->inferenceCpus() : std::vector<int>{});
+		}
+
+		// waits for room unless the worker is gone or exiting, a restart pushes the record again
+		void push(const SpscRing::Piece* pieces, std::size_t num_pieces)
+		{
+			while (!m_channels.requests().tryPush(pieces, num_pieces)) {
+				if (m_restart_flag.load(std::memory_order_acquire) || m_exit_flag.load(std::memory_order_acquire)) {
+					return;
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		}
+
+		// under the submit mutex
+		void pushBatch(std::uint64_t sequence, Predictor& predictor)
+		{
+			const InferenceRequestHeader header{sequence, predictor.getBatchSize()};
+			auto& states = predictor.getStates();
+			m_buffer_bytes.clear();
+			forEachBuffer([&](const auto& buffer) { m_buffer_bytes.push_back(buffer.size() * sizeof(*buffer.data())); }, states);
+			m_pieces.clear();
+			m_pieces.push_back({&header, sizeof(header)});
+			std::size_t i = 0;
+			forEachBuffer(
+			    [&](const auto& buffer) {
+				    const auto& bytes = m_buffer_bytes[i++];
+				    m_pieces.push_back({&bytes, sizeof(bytes)});
+				    m_pieces.push_back({buffer.data(), bytes});
+			    },
+			    states);
+			push(m_pieces.data(), m_pieces.size());
+		}
+
+		void restart()
+		{
+			m_server.get().m_inference_worker_restarts.fetch_add(1, std::memory_order_relaxed);
+			std::cerr << "inference worker " << m_index << " exited, restarting" << std::endl;
+			// makes a submitter waiting for room give up, the batch is in flight and is pushed again below
+			m_restart_flag.store(true, std::memory_order_release);
+			std::lock_guard lock{m_submit_mutex};
+			m_channels.reset();
+			// a worker that keeps crashing is not restarted in a busy loop
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			spawn();
+			m_restart_flag.store(false, std::memory_order_release);
+			// the request ring has room for a batch of every predictor
+			std::lock_guard in_flight_lock{m_in_flight_mutex};
+			for (auto&& [sequence, predictor] : m_in_flight) {
+				pushBatch(sequence, predictor);
+			}
+		}
+
+		void run()
+		{
+			m_server.get().pinLearnerThread();
+			while (!m_exit_flag.load(std::memory_order_acquire)) {
+				std::size_t size = 0;
+				if (const auto* record = m_channels.responses().peek(size)) {
+					InferenceResponseHeader response;
+					std::memcpy(&response, record, sizeof(response));
+					std::optional<std::reference_wrapper<Predictor>> predictor;
+					{
+						std::lock_guard lock{m_in_flight_mutex};
+						auto it = std::find_if(m_in_flight.begin(), m_in_flight.end(), [&](const auto& entry) { return entry.first == response.sequence; });
+						if (it != m_in_flight.end()) {
+							predictor.emplace(it->second);
+							m_in_flight.erase(it);
+						}
+					}
+					if (predictor.has_value()) {
+						std::memcpy(predictor->get().getBufferForPolicies().data(), record + sizeof(response), size - sizeof(response));
+						predictor->get().setModelVersion(response.model_version);
+						predictor->get().processFinished();
+					}
+					m_channels.responses().discard();
+				} else if (reapProcess(m_pid)) {
+					restart();
+				} else {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+		}
+
+		std::reference_wrapper<Server> m_server;
+		std::size_t m_index;
+		InferenceWorkerChannels m_channels;
+		::pid_t m_pid = -1;
+		std::thread m_thread;
+		std::atomic<bool> m_exit_flag{false};
+		std::atomic<bool> m_restart_flag{false};
+		std::mutex m_submit_mutex;
+		std::uint64_t m_next_sequence = 0;
+		std::vector<std::uint64_t> m_buffer_bytes;
+		std::vector<SpscRing::Piece> m_pieces;
+		std::mutex m_in_flight_mutex;
+		std::deque<std::pair<std::uint64_t, std::reference_wrapper<Predictor>>> m_in_flight;
+	};
+
+	// Server side of the TCP connection of a remote actor node, see remote_actor.hpp for the messages.
+	// Actions are collected under the response mutex and sent as one frame by the connection thread.
+	class RemoteActorConnection : public ExternalActors
+	{
+	public:
+		RemoteActorConnection(Server& server, SocketStream&& stream, std::size_t num_envs)
+		    : ExternalActors(server, num_envs), m_stream(std::move(stream)), m_awaiting_action(num_envs, false),
+		      m_max_frame_size(std::max(remotePredictSize<Observation>(num_envs), remoteRolloutSize<Observation, Reward>(this->learner().t_max)))
+		{
+			m_wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			m_thread = std::thread{[this] {
+				run();
+			}};
+		}
+		~RemoteActorConnection()
+		{
+			m_thread.join();
+			::close(m_wake_fd);
+		}
+
+		void exit()
+		{
+			m_exit_flag.store(true, std::memory_order_release);
+		}
+
+	private:
+		struct PendingAction
+		{
+			std::uint32_t slot;
+			std::uint8_t action_id;
+			float policy;
+			std::uint64_t model_version;
+		};
+
+		void sendAction(std::size_t slot, std::int64_t action_id, float policy, std::uint64_t model_version) override
+		{
+			m_awaiting_action[slot] = false;
+			m_pending_actions.push_back({static_cast<std::uint32_t>(slot), static_cast<std::uint8_t>(action_id), policy, model_version});
+			if (m_pending_actions.size() == 1) {
+				const std::uint64_t one = 1;
+				[[maybe_unused]] auto ret = ::write(m_wake_fd, &one, sizeof(one));
+			}
+		}
+
+		void run()
+		{
+			auto& server = this->m_server.get();
+			server.pinLearnerThread();
+			server.m_remote_actor_nodes.fetch_add(1, std::memory_order_relaxed);
+			try {
+				RemoteFrameWriter writer;
+				writer.begin(RemoteMessage::CONFIG);
+				writer.append(static_cast<std::uint32_t>(this->learner().t_max));
+				writer.append(static_cast<std::uint32_t>(this->config().max_episode_length.value_or(0)));
+				writer.end();
+				writer.send(m_stream);
+				std::vector<std::byte> input;
+				std::vector<PendingAction> actions;
+				while (!m_exit_flag.load(std::memory_order_acquire)) {
+					::pollfd pfds[2] = {{m_stream.fd(), POLLIN, 0}, {m_wake_fd, POLLIN, 0}};
+					if (::poll(pfds, 2, 100) <= 0) {
+						continue;
+					}
+					if (pfds[0].revents != 0) {
+						const auto offset = input.size();
+						input.resize(offset + RECEIVE_CHUNK_SIZE);
+						const auto received = m_stream.receiveSome(input.data() + offset, RECEIVE_CHUNK_SIZE);
+						input.resize(offset + received);
+						if (received == 0) {
+							break;
+						}
+						server.m_remote_bytes.fetch_add(received, std::memory_order_relaxed);
+						parseFrames(input);
+					}
+					if (pfds[1].revents != 0) {
+						std::uint64_t count;
+						[[maybe_unused]] auto ret = ::read(m_wake_fd, &count, sizeof(count));
+						{
+							std::lock_guard lock{this->m_response_mutex};
+							std::swap(actions, m_pending_actions);
+						}
+						writer.begin(RemoteMessage::ACTIONS);
+						writer.append(static_cast<std::uint32_t>(actions.size()));
+						for (auto&& action : actions) {
+							writer.append(action.slot);
+							writer.append(action.action_id);
+							writer.append(action.policy);
+							writer.append(action.model_version);
+						}
+						writer.end();
+						server.m_remote_bytes.fetch_add(writer.size(), std::memory_order_relaxed);
+						writer.send(m_stream);
+						actions.clear();
+					}
+				}
+			} catch (const SocketError& e) {
+				std::cerr << "remote actor node : " << e.what() << std::endl;
+			}
+			// the connection is kept until the server exits, the node learns now that it was dropped
+			::shutdown(m_stream.fd(), SHUT_RDWR);
+			this->resetProxies();
+			server.m_remote_actor_nodes.fetch_sub(1, std::memory_order_relaxed);
+			std::cout << "remote actor node with " << this->numEnvs() << " environments disconnected" << std::endl;
+		}
+
+		// handles the complete frames at the front of input and keeps the rest. The node is not trusted: a frame that
+		// does not fit the environments and t_max of the connection throws RemoteFrameError
+		void parseFrames(std::vector<std::byte>& input)
+		{
+			std::size_t offset = 0;
+			RemoteFrameHeader header;
+			while (input.size() - offset >= sizeof(header)) {
+				std::memcpy(&header, input.data() + offset, sizeof(header));
+				// before the frame is buffered
+				if (header.size > m_max_frame_size) {
+					throw RemoteFrameError("frame larger than any frame of the connection");
+				}
+				if (input.size() - offset - sizeof(header) < header.size) {
+					break;
+				}
+				RemoteFrameReader reader{input.data() + offset + sizeof(header), header.size};
+				if (header.type == RemoteMessage::PREDICT) {
+					addRequests(reader, header.size);
+				} else if (header.type == RemoteMessage::ROLLOUT) {
+					addRollout(reader, header.size);
+				} else {
+					throw RemoteFrameError("unexpected message");
+				}
+				offset += sizeof(header) + header.size;
+			}
+			input.erase(input.begin(), input.begin() + static_cast<std::ptrdiff_t>(offset));
+		}
+
+		void addRequests(RemoteFrameReader& reader, std::size_t size)
+		{
+			const auto count = reader.template read<std::uint32_t>();
+			if (count > this->numEnvs() || size != remotePredictSize<Observation>(count)) {
+				throw RemoteFrameError("malformed PREDICT frame");
+			}
+			for (std::uint32_t i = 0; i < count; ++i) {
+				const auto slot = reader.template read<std::uint32_t>();
+				const auto retry = reader.template read<std::uint8_t>();
+				auto observation = reader.template read<Observation>();
+				// the proxy of a slot must not change while its request is queued
+				{
+					std::lock_guard lock{this->m_response_mutex};
+					if (slot >= this->numEnvs() || m_awaiting_action[slot]) {
+						throw RemoteFrameError("PREDICT frame for an unknown or busy environment");
+					}
+					m_awaiting_action[slot] = true;
+				}
+				this->addRequest(slot, observation, retry != 0);
+			}
+			this->queuePredictions();
+		}
+
+		void addRollout(RemoteFrameReader& reader, std::size_t size)
+		{
+			const auto slot = reader.template read<std::uint32_t>();
+			const auto num_steps = reader.template read<std::uint32_t>();
+			if (slot >= this->numEnvs() || num_steps == 0 || num_steps > this->learner().t_max || size != remoteRolloutSize<Observation, Reward>(num_steps)) {
+				throw RemoteFrameError("malformed ROLLOUT frame");
+			}
+			TrainingData data;
+			data.model_version = reader.template read<std::uint64_t>();
+			data.terminal = reader.template read<Observation>();
+			data.steps.reserve(num_steps);
+			for (std::uint32_t i = 0; i < num_steps; ++i) {
+				auto observation = reader.template read<Observation>();
+				const auto action = reader.template read<std::uint8_t>();
+				auto reward = reader.template read<Reward>();
+				const auto policy = reader.template read<float>();
+				const auto action_id = static_cast<std::uint8_t>(action & ~REMOTE_NEXT_GOAL_FLAG);
+				if (action_id >= DiscreteActionTraits<Action>::num_actions) {
+					throw RemoteFrameError("ROLLOUT frame with an unknown action");
+				}
+				// the node only sends the model version of the first step
+				data.steps.push_back({observation, DiscreteActionTraits<Action>::convertFromID(action_id), reward, policy, data.model_version, (action & REMOTE_NEXT_GOAL_FLAG) != 0, EncodedObservation{}});
+			}
+			this->m_server.get().m_remote_env_steps.fetch_add(num_steps, std::memory_order_relaxed);
+			this->addTrainingData(slot, std::move(data));
+		}
+
+		static inline constexpr std::size_t RECEIVE_CHUNK_SIZE = 1 << 16;
+
+		SocketStream m_stream;
+		int m_wake_fd = -1;
+		std::thread m_thread;
+		std::atomic<bool> m_exit_flag{false};
+		// guarded by the response mutex
+		std::vector<PendingAction> m_pending_actions;
+		// slots with a queued request, guarded by the response mutex
+		std::vector<bool> m_awaiting_action;
+		std::size_t m_max_frame_size;
+	};
+
+	// Accepts remote actor nodes. Connections are kept until the server exits, because queued prediction
+	// requests may still refer to their proxies after the node has disconnected.
+	class RemoteActorListener
+	{
+	public:
+		RemoteActorListener(Server& server, std::uint16_t port) : m_server(server), m_listener(port)
+		{
+			std::cout << "listening for remote actor nodes on port " << m_listener.port() << std::endl;
+			m_thread = std::thread{[this] {
+				run();
+			}};
+		}
+		~RemoteActorListener()
+		{
+			m_exit_flag.store(true, std::memory_order_release);
+			m_thread.join();
+			for (auto&& connection : m_connections) {
+				connection.exit();
+			}
+			m_connections.clear();
+		}
+
+	private:
+		void run()
+		{
+			RemoteFrameHeader header;
+			std::vector<std::byte> payload;
+			while (!m_exit_flag.load(std::memory_order_acquire)) {
+				auto stream = m_listener.accept(std::chrono::milliseconds(200));
+				if (!stream.has_value()) {
+					continue;
+				}
+				// a peer that connects and sends nothing holds up the next accepts at most this long
+				try {
+					if (!receiveFrameBefore(stream.value(), header, payload, REMOTE_HELLO_SIZE, std::chrono::steady_clock::now() + HANDSHAKE_TIMEOUT) || header.type != RemoteMessage::HELLO || payload.size() != REMOTE_HELLO_SIZE) {
+						continue;
+					}
+				} catch (const SocketError&) {
+					continue;
+				}
+				RemoteFrameReader reader{payload.data(), payload.size()};
+				const auto magic = reader.template read<std::uint64_t>();
+				const auto observation_bytes = reader.template read<std::uint32_t>();
+				const auto num_envs = reader.template read<std::uint32_t>();
+				if (magic != REMOTE_ACTOR_MAGIC || observation_bytes != sizeof(Observation) || num_envs == 0 || num_envs > REMOTE_MAX_ENVS) {
+					std::cerr << "rejected a remote actor node with an incompatible environment" << std::endl;
+					continue;
+				}
+				m_connections.emplace_back(m_server.get(), std::move(stream.value()), num_envs);
+				std::cout << "remote actor node with " << num_envs << " environments connected" << std::endl;
+			}
+		}
+
+		static inline constexpr std::chrono::seconds HANDSHAKE_TIMEOUT{1};
+
+		std::reference_wrapper<Server> m_server;
+		TcpListener m_listener;
+		std::thread m_thread;
+		std::atomic<bool> m_exit_flag{false};
+		std::deque<RemoteActorConnection> m_connections;
 	};
 
-	std::unique_ptr<Agent> m_agent;
-	boost::container::static_vector<Predictor, NUM_PREDICTORS> m_predictors;
-	boost::container::static_vector<Trainer, NUM_TRAINERS> m_trainers;
-	boost::container::static_vector<Actor, NUM_ACTORS> m_actors;
-	std::deque<PredictionData> m_prediction_queue;
-	std::mutex m_prediction_queue_lock;
-	std::condition_variable m_predictor_event;
-	std::deque<TrainingData> m_training_queue;
-	std::mutex m_training_queue_lock;
-	std::condition_variable m_trainer_event;
+	TrainConfig m_config;
+	TunableSettings m_tunables{m_config};
+	std::optional<ThreadPlacement> m_thread_placement;
+	std::optional<ThreadPool> m_batch_threads;
+	BatchPool<PredictionBatch, TrainingBatch> m_batch_pool{m_config.batch_memory_budget, MIN_BATCHES_IN_FLIGHT};
+	std::deque<Learner> m_learners;
+	// the learner of every actor thread, and the weights assignActors splits the actors by
+	std::unique_ptr<std::atomic<std::size_t>[]> m_actor_learners;
+	std::vector<double> m_learner_weights;
+	std::mutex m_assign_mutex;
+	std::size_t m_next_reassign_steps = 0;
+	std::deque<Predictor> m_predictors;
+	std::deque<Trainer> m_trainers;
+	std::deque<Actor> m_actors;
+	std::vector<std::string> m_offline_paths;
+	std::deque<OfflineReader> m_offline_readers;
+	std::atomic<std::size_t> m_offline_rollouts{0};
+	std::atomic<std::size_t> m_offline_epochs{0};
+	std::deque<ActorWorker> m_actor_workers;
+	std::deque<InferenceWorker> m_inference_workers;
+	std::atomic<std::size_t> m_next_inference_worker{0};
+	std::optional<WeightSnapshotWriter> m_weight_snapshot;
+	std::vector<float> m_weight_buffer;
+	std::atomic<std::uint64_t> m_published_model_version{0};
+	std::atomic<std::size_t> m_weight_snapshots{0};
+	std::atomic<std::size_t> m_weight_snapshot_nanoseconds{0};
+	std::optional<RemoteActorListener> m_remote_actors;
+	std::optional<TrajectoryWriter> m_trajectory_writer;
+	std::optional<CheckpointWriter> m_checkpoint_writer;
+	std::vector<std::optional<ActorResumeState>> m_actor_resume_states;
+	bool m_resumed = false;
+	std::atomic<std::size_t> m_checkpoints{0};
+	std::atomic<std::size_t> m_checkpoint_stall_nanoseconds{0};
 	std::vector<std::reference_wrapper<Predictor>> m_prediction_batches;
 	std::vector<std::reference_wrapper<Trainer>> m_training_batches;
 	std::mutex m_batches_lock;
 	std::condition_variable m_server_event;
+	// under m_batches_lock: the failure of an offline reader, thrown by train()
+	std::exception_ptr m_offline_error;
+	std::chrono::steady_clock::time_point m_last_stats_time = std::chrono::steady_clock::now();
+	std::size_t m_last_stats_env_steps = 0;
+	std::size_t m_last_stats_trained_steps = 0;
+	std::optional<ControlSocket> m_control_socket;
+	std::atomic<std::size_t> m_resampled_actions{0};
+	std::atomic<std::size_t> m_actor_worker_restarts{0};
+	std::atomic<std::size_t> m_inference_worker_restarts{0};
+	std::atomic<std::size_t> m_inference_weight_updates{0};
+	std::atomic<std::size_t> m_remote_actor_nodes{0};
+	std::atomic<std::size_t> m_remote_bytes{0};
+	std::atomic<std::size_t> m_remote_env_steps{0};
+	std::atomic<std::size_t> m_reused_encoding_bytes{0};
+	std::atomic<std::size_t> m_encoded_training_bytes{0};
 };
 
 }  // namespace impala
@@ -0,0 +1,215 @@
+#include "shm_ring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace impala
+{
+
+namespace
+{
+
+// records are a 4 byte length followed by the payload, padded to 8 bytes
+constexpr std::uint32_t WRAP_MARKER = 0xffffffffu;
+
+constexpr std::uint64_t recordBytes(std::size_t size) noexcept
+{
+	return (sizeof(std::uint32_t) + size + 7) / 8 * 8;
+}
+
+}  // namespace
+
+SharedMemory SharedMemory::create(const std::string& name, std::size_t size)
+{
+	int fd = ::shm_open(name.data(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) {
+		throw SharedMemoryError("shm_open " + name + " : " + std::strerror(errno));
+	}
+	if (::ftruncate(fd, static_cast<::off_t>(size)) != 0) {
+		auto message = std::string(std::strerror(errno));
+		::close(fd);
+		::shm_unlink(name.data());
+		throw SharedMemoryError("ftruncate " + name + " : " + message);
+	}
+	void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		::shm_unlink(name.data());
+		throw SharedMemoryError("mmap " + name + " : " + std::strerror(errno));
+	}
+	return SharedMemory{name, data, size, true};
+}
+
+SharedMemory SharedMemory::open(const std::string& name)
+{
+	int fd = ::shm_open(name.data(), O_RDWR, 0600);
+	if (fd < 0) {
+		throw SharedMemoryError("shm_open " + name + " : " + std::strerror(errno));
+	}
+	struct ::stat st;
+	if (::fstat(fd, &st) != 0) {
+		auto message = std::string(std::strerror(errno));
+		::close(fd);
+		throw SharedMemoryError("fstat " + name + " : " + message);
+	}
+	const auto size = static_cast<std::size_t>(st.st_size);
+	void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		throw SharedMemoryError("mmap " + name + " : " + std::strerror(errno));
+	}
+	return SharedMemory{name, data, size, false};
+}
+
+void SharedMemory::remove(const std::string& name) noexcept
+{
+	::shm_unlink(name.data());
+}
+
+SharedMemory::SharedMemory(std::string name, void* data, std::size_t size, bool owner) noexcept
+    : m_name(std::move(name)), m_data(data), m_size(size), m_owner(owner)
+{}
+
+SharedMemory::SharedMemory(SharedMemory&& other) noexcept
+    : m_name(std::move(other.m_name)), m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)), m_owner(std::exchange(other.m_owner, false))
+{}
+
+SharedMemory& SharedMemory::operator=(SharedMemory&& other) noexcept
+{
+	std::swap(m_name, other.m_name);
+	std::swap(m_data, other.m_data);
+	std::swap(m_size, other.m_size);
+	std::swap(m_owner, other.m_owner);
+	return *this;
+}
+
+SharedMemory::~SharedMemory()
+{
+	if (m_data != nullptr) {
+		::munmap(m_data, m_size);
+	}
+	if (m_owner) {
+		::shm_unlink(m_name.data());
+	}
+}
+
+std::size_t SpscRing::requiredBytes(std::size_t capacity) noexcept
+{
+	return sizeof(Header) + capacity;
+}
+
+SpscRing::SpscRing(void* memory, std::size_t capacity, bool initialize) noexcept
+    : m_header(static_cast<Header*>(memory)), m_buffer(static_cast<std::byte*>(memory) + sizeof(Header))
+{
+	if (initialize) {
+		new (m_header) Header{};
+		m_header->capacity = capacity;
+	}
+}
+
+void SpscRing::reset() noexcept
+{
+	m_header->head.store(0, std::memory_order_relaxed);
+	m_header->tail.store(0, std::memory_order_release);
+}
+
+bool SpscRing::tryPush(const void* data, std::size_t size) noexcept
+{
+	const Piece piece{data, size};
+	return tryPush(&piece, 1);
+}
+
+bool SpscRing::tryPush(const Piece* pieces, std::size_t num_pieces) noexcept
+{
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < num_pieces; ++i) {
+		size += pieces[i].size;
+	}
+	const auto capacity = m_header->capacity;
+	const auto bytes = recordBytes(size);
+	const auto head = m_header->head.load(std::memory_order_relaxed);
+	const auto tail = m_header->tail.load(std::memory_order_acquire);
+	auto offset = head % capacity;
+	// a record never wraps around, the rest of the buffer is skipped instead
+	const auto skip = (offset + bytes > capacity) ? capacity - offset : 0;
+	if (bytes > capacity || head + skip + bytes - tail > capacity) {
+		return false;
+	}
+	if (skip > 0) {
+		std::memcpy(m_buffer + offset, &WRAP_MARKER, sizeof(WRAP_MARKER));
+		offset = 0;
+	}
+	const auto length = static_cast<std::uint32_t>(size);
+	std::memcpy(m_buffer + offset, &length, sizeof(length));
+	offset += sizeof(length);
+	for (std::size_t i = 0; i < num_pieces; ++i) {
+		std::memcpy(m_buffer + offset, pieces[i].data, pieces[i].size);
+		offset += pieces[i].size;
+	}
+	m_header->head.store(head + skip + bytes, std::memory_order_release);
+	return true;
+}
+
+std::size_t SpscRing::peekSize() noexcept
+{
+	const auto capacity = m_header->capacity;
+	auto tail = m_header->tail.load(std::memory_order_relaxed);
+	const auto head = m_header->head.load(std::memory_order_acquire);
+	if (tail == head) {
+		return 0;
+	}
+	std::uint32_t length;
+	std::memcpy(&length, m_buffer + tail % capacity, sizeof(length));
+	if (length == WRAP_MARKER) {
+		tail += capacity - tail % capacity;
+		m_header->tail.store(tail, std::memory_order_release);
+		if (tail == head) {
+			return 0;
+		}
+		std::memcpy(&length, m_buffer + tail % capacity, sizeof(length));
+	}
+	return length;
+}
+
+std::size_t SpscRing::pop(void* data, std::size_t max_size) noexcept
+{
+	const auto size = peekSize();
+	if (size == 0) {
+		return 0;
+	}
+	const auto capacity = m_header->capacity;
+	const auto tail = m_header->tail.load(std::memory_order_relaxed);
+	std::memcpy(data, m_buffer + tail % capacity + sizeof(std::uint32_t), std::min(size, max_size));
+	m_header->tail.store(tail + recordBytes(size), std::memory_order_release);
+	return size;
+}
+
+const std::byte* SpscRing::peek(std::size_t& size) noexcept
+{
+	size = peekSize();
+	if (size == 0) {
+		return nullptr;
+	}
+	const auto tail = m_header->tail.load(std::memory_order_relaxed);
+	return m_buffer + tail % m_header->capacity + sizeof(std::uint32_t);
+}
+
+void SpscRing::discard() noexcept
+{
+	const auto size = peekSize();
+	if (size == 0) {
+		return;
+	}
+	const auto tail = m_header->tail.load(std::memory_order_relaxed);
+	m_header->tail.store(tail + recordBytes(size), std::memory_order_release);
+}
+
+}  // namespace impala
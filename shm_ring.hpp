@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace impala
+{
+
+class SharedMemoryError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+// A POSIX shared memory object mapped into this process. The creator unlinks the name on destruction.
+class SharedMemory
+{
+public:
+	static SharedMemory create(const std::string& name, std::size_t size);
+	static SharedMemory open(const std::string& name);
+	// removes a name left behind by a process that was killed
+	static void remove(const std::string& name) noexcept;
+
+	SharedMemory(SharedMemory&& other) noexcept;
+	SharedMemory& operator=(SharedMemory&& other) noexcept;
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+	~SharedMemory();
+
+	void* data() const noexcept
+	{
+		return m_data;
+	}
+	std::size_t size() const noexcept
+	{
+		return m_size;
+	}
+	const std::string& name() const noexcept
+	{
+		return m_name;
+	}
+
+private:
+	SharedMemory(std::string name, void* data, std::size_t size, bool owner) noexcept;
+
+	std::string m_name;
+	void* m_data = nullptr;
+	std::size_t m_size = 0;
+	bool m_owner = false;
+};
+
+// Single-producer single-consumer ring of variable-length, non-empty records placed in (shared) memory.
+// The indices are lock-free atomics, so producer and consumer may live in different processes.
+class SpscRing
+{
+public:
+	static std::size_t requiredBytes(std::size_t capacity) noexcept;
+
+	// capacity must be a multiple of 8; initialize resets the ring, which is only safe while nobody uses it
+	SpscRing(void* memory, std::size_t capacity, bool initialize) noexcept;
+
+	struct Piece
+	{
+		const void* data;
+		std::size_t size;
+	};
+
+	// returns false if the ring has no room for the record
+	bool tryPush(const void* data, std::size_t size) noexcept;
+	// writes one record made of several pieces
+	bool tryPush(const Piece* pieces, std::size_t num_pieces) noexcept;
+	template <class T>
+	bool tryPush(const T& value) noexcept
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		return tryPush(&value, sizeof(T));
+	}
+
+	// size of the next record, or 0 if the ring is empty
+	std::size_t peekSize() noexcept;
+	// copies the next record (at most max_size bytes of it) and removes it
+	std::size_t pop(void* data, std::size_t max_size) noexcept;
+	// the next record in place, or nullptr if the ring is empty; it stays valid until discard()
+	const std::byte* peek(std::size_t& size) noexcept;
+	void discard() noexcept;
+	template <class T>
+	bool tryPop(T& value) noexcept
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		if (peekSize() == 0) {
+			return false;
+		}
+		pop(&value, sizeof(T));
+		return true;
+	}
+
+	void reset() noexcept;
+
+private:
+	struct alignas(64) Header
+	{
+		std::atomic<std::uint64_t> head;
+		alignas(64) std::atomic<std::uint64_t> tail;
+		alignas(64) std::uint64_t capacity;
+	};
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+	Header* m_header;
+	std::byte* m_buffer;
+};
+
+}  // namespace impala
@@ -0,0 +1,248 @@
+#include "socket.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace impala
+{
+
+namespace
+{
+
+std::string errorMessage(const std::string& what)
+{
+	return what + " : " + std::strerror(errno);
+}
+
+void setNoDelay(int fd)
+{
+	int flag = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+}  // namespace
+
+SocketStream SocketStream::connectTcp(const std::string& host, std::uint16_t port)
+{
+	::addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	::addrinfo* addresses = nullptr;
+	if (int error = ::getaddrinfo(host.data(), std::to_string(port).data(), &hints, &addresses); error != 0) {
+		throw SocketError("cannot resolve " + host + " : " + ::gai_strerror(error));
+	}
+	std::string message = "no address";
+	for (auto* address = addresses; address != nullptr; address = address->ai_next) {
+		int fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+		if (fd < 0) {
+			message = errorMessage("socket");
+			continue;
+		}
+		if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+			::freeaddrinfo(addresses);
+			setNoDelay(fd);
+			return SocketStream{fd};
+		}
+		message = errorMessage("connect");
+		::close(fd);
+	}
+	::freeaddrinfo(addresses);
+	throw SocketError("cannot connect to " + host + ":" + std::to_string(port) + " : " + message);
+}
+
+SocketStream SocketStream::connectLocal(const std::string& path)
+{
+	::sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		throw SocketError("socket path too long : " + path);
+	}
+	path.copy(address.sun_path, path.size());
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw SocketError(errorMessage("socket"));
+	}
+	if (::connect(fd, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) != 0) {
+		auto message = errorMessage("cannot connect to " + path);
+		::close(fd);
+		throw SocketError(message);
+	}
+	return SocketStream{fd};
+}
+
+SocketStream::SocketStream(int fd) : m_fd(fd) {}
+
+SocketStream::SocketStream(SocketStream&& other) noexcept : m_fd(std::exchange(other.m_fd, -1)) {}
+
+SocketStream& SocketStream::operator=(SocketStream&& other) noexcept
+{
+	std::swap(m_fd, other.m_fd);
+	return *this;
+}
+
+SocketStream::~SocketStream()
+{
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+}
+
+void SocketStream::sendAll(const void* data, std::size_t size)
+{
+	std::size_t sent = 0;
+	while (sent < size) {
+		auto ret = ::send(m_fd, static_cast<const char*>(data) + sent, size - sent, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw SocketError(errorMessage("send"));
+		}
+		sent += static_cast<std::size_t>(ret);
+	}
+}
+
+std::size_t SocketStream::sendSome(const void* data, std::size_t size)
+{
+	while (true) {
+		auto ret = ::send(m_fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret >= 0) {
+			return static_cast<std::size_t>(ret);
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno != EINTR) {
+			throw SocketError(errorMessage("send"));
+		}
+	}
+}
+
+bool SocketStream::receiveAll(void* data, std::size_t size)
+{
+	std::size_t received = 0;
+	while (received < size) {
+		auto ret = receiveSome(static_cast<char*>(data) + received, size - received);
+		if (ret == 0) {
+			return false;
+		}
+		received += ret;
+	}
+	return true;
+}
+
+std::size_t SocketStream::receiveSome(void* data, std::size_t size)
+{
+	while (true) {
+		auto ret = ::recv(m_fd, data, size, 0);
+		if (ret >= 0) {
+			return static_cast<std::size_t>(ret);
+		}
+		if (errno == ECONNRESET) {
+			return 0;
+		}
+		if (errno != EINTR) {
+			throw SocketError(errorMessage("recv"));
+		}
+	}
+}
+
+bool SocketStream::waitForInput(std::chrono::milliseconds timeout)
+{
+	::pollfd pfd{m_fd, POLLIN, 0};
+	return ::poll(&pfd, 1, static_cast<int>(timeout.count())) > 0;
+}
+
+TcpListener::TcpListener(std::uint16_t port)
+{
+	m_fd = ::socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) {
+		throw SocketError(errorMessage("socket"));
+	}
+	int flag = 1;
+	::setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+	// accepts IPv4 connections as well
+	flag = 0;
+	::setsockopt(m_fd, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(flag));
+	::sockaddr_in6 address{};
+	address.sin6_family = AF_INET6;
+	address.sin6_addr = in6addr_any;
+	address.sin6_port = htons(port);
+	if (::bind(m_fd, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_fd, 64) != 0) {
+		auto message = errorMessage("cannot listen on port " + std::to_string(port));
+		::close(m_fd);
+		throw SocketError(message);
+	}
+	::socklen_t length = sizeof(address);
+	::getsockname(m_fd, reinterpret_cast<::sockaddr*>(&address), &length);
+	m_port = ntohs(address.sin6_port);
+}
+
+TcpListener::~TcpListener()
+{
+	::close(m_fd);
+}
+
+std::optional<SocketStream> TcpListener::accept(std::chrono::milliseconds timeout)
+{
+	::pollfd pfd{m_fd, POLLIN, 0};
+	if (::poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) {
+		return std::nullopt;
+	}
+	int fd = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd < 0) {
+		return std::nullopt;
+	}
+	setNoDelay(fd);
+	return SocketStream{fd};
+}
+
+LocalListener::LocalListener(std::string path) : m_path(std::move(path))
+{
+	::sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (m_path.size() >= sizeof(address.sun_path)) {
+		throw SocketError("socket path too long : " + m_path);
+	}
+	m_path.copy(address.sun_path, m_path.size());
+	m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) {
+		throw SocketError(errorMessage("socket"));
+	}
+	::unlink(m_path.data());
+	if (::bind(m_fd, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_fd, 64) != 0) {
+		auto message = errorMessage("cannot listen on " + m_path);
+		::close(m_fd);
+		throw SocketError(message);
+	}
+}
+
+LocalListener::~LocalListener()
+{
+	::close(m_fd);
+	::unlink(m_path.data());
+}
+
+std::optional<SocketStream> LocalListener::accept(std::chrono::milliseconds timeout)
+{
+	::pollfd pfd{m_fd, POLLIN, 0};
+	if (::poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) {
+		return std::nullopt;
+	}
+	int fd = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd < 0) {
+		return std::nullopt;
+	}
+	return SocketStream{fd};
+}
+
+}  // namespace impala
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace impala
+{
+
+class SocketError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+// A connected stream socket. TCP streams have Nagle's algorithm disabled, messages are batched by the callers
+// instead.
+class SocketStream
+{
+public:
+	static SocketStream connectTcp(const std::string& host, std::uint16_t port);
+	// a Unix-domain socket
+	static SocketStream connectLocal(const std::string& path);
+
+	explicit SocketStream(int fd);
+	SocketStream(SocketStream&& other) noexcept;
+	SocketStream& operator=(SocketStream&& other) noexcept;
+	SocketStream(const SocketStream&) = delete;
+	SocketStream& operator=(const SocketStream&) = delete;
+	~SocketStream();
+
+	int fd() const noexcept
+	{
+		return m_fd;
+	}
+
+	void sendAll(const void* data, std::size_t size);
+	// sends what the socket buffer takes without blocking, returns the number of bytes sent
+	std::size_t sendSome(const void* data, std::size_t size);
+	// returns false if the peer closed the connection before size bytes arrived
+	bool receiveAll(void* data, std::size_t size);
+	// returns the number of bytes received, 0 if the peer closed the connection
+	std::size_t receiveSome(void* data, std::size_t size);
+	// returns false if nothing arrived within timeout
+	bool waitForInput(std::chrono::milliseconds timeout);
+
+private:
+	int m_fd = -1;
+};
+
+class TcpListener
+{
+public:
+	// port 0 picks a free port
+	explicit TcpListener(std::uint16_t port);
+	TcpListener(const TcpListener&) = delete;
+	TcpListener& operator=(const TcpListener&) = delete;
+	~TcpListener();
+
+	std::uint16_t port() const noexcept
+	{
+		return m_port;
+	}
+
+	// returns nullopt if nobody connected within timeout
+	std::optional<SocketStream> accept(std::chrono::milliseconds timeout);
+
+private:
+	int m_fd = -1;
+	std::uint16_t m_port = 0;
+};
+
+// Listens on a Unix-domain socket, the path is replaced if it exists and removed on destruction.
+class LocalListener
+{
+public:
+	explicit LocalListener(std::string path);
+	LocalListener(const LocalListener&) = delete;
+	LocalListener& operator=(const LocalListener&) = delete;
+	~LocalListener();
+
+	// returns nullopt if nobody connected within timeout
+	std::optional<SocketStream> accept(std::chrono::milliseconds timeout);
+
+private:
+	std::string m_path;
+	int m_fd = -1;
+};
+
+}  // namespace impala
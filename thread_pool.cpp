@@ -0,0 +1,115 @@
+#include "thread_pool.hpp"
+
+namespace impala
+{
+
+namespace
+{
+
+std::atomic<ThreadPool*> g_batch_thread_pool{nullptr};
+std::atomic<std::size_t> g_min_batch_chunk_size{0};
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t num_threads, std::function<void()> on_start) : m_on_start(std::move(on_start))
+{
+	for (std::size_t i = 0; i < num_threads; ++i) {
+		m_workers.emplace_back(std::make_unique<Worker>());
+	}
+	for (std::size_t i = 0; i < num_threads; ++i) {
+		m_workers[i]->thread = std::thread{[this, i] {
+			run(i);
+		}};
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock{m_mutex};
+		m_exit_flag = true;
+	}
+	m_event.notify_all();
+	for (auto&& worker : m_workers) {
+		worker->thread.join();
+	}
+}
+
+void ThreadPool::submit(Task task)
+{
+	auto& worker = *m_workers[m_next_worker++ % m_workers.size()];
+	{
+		std::lock_guard lock{worker.mutex};
+		worker.tasks.emplace_back(std::move(task));
+	}
+	{
+		std::lock_guard lock{m_mutex};
+		++m_num_pending;
+	}
+	m_event.notify_one();
+}
+
+bool ThreadPool::tryPop(std::size_t index, Task& task)
+{
+	{
+		auto& own = *m_workers[index];
+		std::lock_guard lock{own.mutex};
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+	for (std::size_t i = 1; i < m_workers.size(); ++i) {
+		auto& victim = *m_workers[(index + i) % m_workers.size()];
+		std::lock_guard lock{victim.mutex};
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(std::size_t index)
+{
+	if (m_on_start) {
+		m_on_start();
+	}
+	Task task;
+	while (true) {
+		{
+			std::unique_lock lock{m_mutex};
+			m_event.wait(lock, [this] { return m_num_pending > 0 || m_exit_flag; });
+			if (m_exit_flag) {
+				return;
+			}
+			// claim one task, it is in some deque until it is popped
+			--m_num_pending;
+		}
+		while (!tryPop(index, task)) {
+			std::this_thread::yield();
+		}
+		task();
+		task = nullptr;
+	}
+}
+
+void setBatchThreadPool(ThreadPool* pool, std::size_t min_chunk_size) noexcept
+{
+	g_min_batch_chunk_size = min_chunk_size;
+	g_batch_thread_pool = pool;
+}
+
+void parallelForBatch(std::size_t size, const std::function<void(std::size_t, std::size_t)>& func)
+{
+	auto* pool = g_batch_thread_pool.load();
+	if (pool == nullptr) {
+		func(0, size);
+		return;
+	}
+	pool->parallelFor(size, g_min_batch_chunk_size.load(), func);
+}
+
+}  // namespace impala
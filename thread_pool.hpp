@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace impala
+{
+
+// Each worker owns a task deque, pops from its back and steals from the front of the others when it runs dry.
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	// on_start runs at the beginning of every worker thread, e.g. to pin it
+	explicit ThreadPool(std::size_t num_threads, std::function<void()> on_start = {});
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	std::size_t numThreads() const noexcept
+	{
+		return m_workers.size();
+	}
+
+	void submit(Task task);
+
+	// runs func(first, last) over chunks of [0, size) on the workers and the calling thread, and returns when all are done
+	template <class Func>
+	void parallelFor(std::size_t size, std::size_t min_chunk_size, Func&& func)
+	{
+		const auto num_chunks = std::min(std::max<std::size_t>(size / std::max<std::size_t>(min_chunk_size, 1), 1), 4 * (numThreads() + 1));
+		if (num_chunks <= 1 || numThreads() == 0) {
+			func(std::size_t{0}, size);
+			return;
+		}
+		struct State
+		{
+			std::atomic<std::size_t> next_chunk{0};
+			std::size_t finished_chunks = 0;
+			std::mutex mutex;
+			std::condition_variable event;
+		};
+		auto state = std::make_shared<State>();
+		auto run_chunks = [state, size, num_chunks, &func] {
+			std::size_t finished = 0;
+			for (auto chunk = state->next_chunk++; chunk < num_chunks; chunk = state->next_chunk++) {
+				func(size * chunk / num_chunks, size * (chunk + 1) / num_chunks);
+				++finished;
+			}
+			if (finished > 0) {
+				{
+					std::lock_guard lock{state->mutex};
+					state->finished_chunks += finished;
+				}
+				state->event.notify_one();
+			}
+		};
+		// helpers that start after every chunk is taken return immediately, so func is not touched after this returns
+		for (std::size_t i = 0, n = std::min(numThreads(), num_chunks - 1); i < n; ++i) {
+			submit(run_chunks);
+		}
+		run_chunks();
+		std::unique_lock lock{state->mutex};
+		state->event.wait(lock, [&] { return state->finished_chunks == num_chunks; });
+	}
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	void run(std::size_t index);
+	bool tryPop(std::size_t index, Task& task);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::function<void()> m_on_start;
+	std::atomic<std::size_t> m_next_worker{0};
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	std::size_t m_num_pending = 0;
+	bool m_exit_flag = false;
+};
+
+// makeBufferForBatch splits batches into chunks of at least min_chunk_size over this pool, nullptr makes it serial
+void setBatchThreadPool(ThreadPool* pool, std::size_t min_chunk_size) noexcept;
+
+// runs func(first, last) over [0, size), in parallel when a batch thread pool is set and size spans several chunks
+void parallelForBatch(std::size_t size, const std::function<void(std::size_t, std::size_t)>& func);
+
+}  // namespace impala
@@ -0,0 +1,142 @@
+#pragma once
+
+#ifdef IMPALA_USE_LIBTORCH
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <range/v3/span.hpp>
+#include <torch/script.h>
+
+#include "agent.hpp"
+#include "environment.hpp"
+
+namespace impala
+{
+
+// An inference model (see agent.hpp) that runs a TorchScript trace of the Python model with LibTorch, so that the
+// predictors run the model of any agent concurrently without the GIL while training stays in Python. The agent
+// traces its policy once, with exportTorchScript, and every weight update copies the exported weights into a clone
+// of the trace. The observations are encoded with Environment::makeBatch and handed over as one [batch, -1] tensor
+// per buffer of the ObsBatch, on the device of the traced parameters.
+//
+// LibTorch must be the one the Python torch module was built with (see the USE_LIBTORCH option of CMakeLists.txt),
+// since both are loaded into the same process.
+template <class Environment>
+class TorchScriptModel
+{
+public:
+	using Observation = typename Environment::Observation;
+	using ObsBatch = typename Environment::ObsBatch;
+
+	// the trace is written next to the checkpoints of the agent
+	static inline constexpr const char* TRACE_FILE = "policy.pt";
+
+	// called by the server before the first weights, traces the policy of the agent and loads the trace
+	template <class Agent>
+	static void prepare(Agent& agent)
+	{
+		Environment env;
+		std::vector<Observation> observations;
+		observations.push_back(env.reset());
+		observations.push_back(env.reset());
+		ObsBatch batch;
+		Environment::makeBatch(observations.begin(), observations.end(), batch);
+		const auto path = agent.outputDirectory() + "/" + TRACE_FILE;
+		agent.exportTorchScript(path, batch, observations.size());
+		try {
+			auto module = std::make_shared<torch::jit::Module>(torch::jit::load(path));
+			module->eval();
+			trace() = std::move(module);
+		} catch (const c10::Error& e) {
+			throw InferenceModelError("cannot load the TorchScript trace " + path + " : " + e.what_without_backtrace());
+		}
+	}
+
+	// a clone of the trace with the weights, shared read-only by the predictors
+	class Weights
+	{
+	public:
+		explicit Weights(ranges::span<const float> weights)
+		{
+			if (!trace()) {
+				throw InferenceModelError("TorchScriptModel needs prepare before weights");
+			}
+			torch::NoGradGuard no_grad;
+			m_module = trace()->clone();
+			const float* next = weights.data();
+			const float* end = weights.data() + weights.size();
+			for (auto parameter : m_module.parameters()) {
+				const auto size = static_cast<std::ptrdiff_t>(parameter.numel());
+				if (end - next < size) {
+					throw InferenceModelError("the TorchScript trace has more parameters than the exported weights");
+				}
+				// from_blob does not write to the weights
+				auto source = torch::from_blob(const_cast<float*>(next), parameter.sizes(), torch::kFloat32);
+				parameter.copy_(source);
+				m_device = parameter.device();
+				next += size;
+			}
+			if (next != end) {
+				throw InferenceModelError("the TorchScript trace has fewer parameters than the exported weights");
+			}
+		}
+
+		torch::jit::Module& module() const noexcept
+		{
+			return m_module;
+		}
+		const torch::Device& device() const noexcept
+		{
+			return m_device;
+		}
+
+	private:
+		// forward does not change the module, but is not const
+		mutable torch::jit::Module m_module;
+		torch::Device m_device{torch::kCPU};
+	};
+
+	void predict(const Weights& weights, const std::vector<std::reference_wrapper<const Observation>>& observations, ranges::span<float> policies)
+	{
+		torch::NoGradGuard no_grad;
+		Environment::makeBatch(observations.begin(), observations.end(), m_batch);
+		const auto batch_size = static_cast<std::int64_t>(observations.size());
+		std::vector<torch::jit::IValue> inputs;
+		std::apply(
+		    [&](auto&... buffers) {
+			    (inputs.emplace_back(toTensor(buffers, batch_size).to(weights.device())), ...);
+		    },
+		    m_batch);
+		const auto probs = weights.module().forward(inputs).toTensor().to(torch::kCPU, torch::kFloat32).contiguous();
+		std::memcpy(policies.data(), probs.template data_ptr<float>(), static_cast<std::size_t>(policies.size()) * sizeof(float));
+	}
+
+private:
+	static std::shared_ptr<torch::jit::Module>& trace()
+	{
+		static std::shared_ptr<torch::jit::Module> module;
+		return module;
+	}
+
+	template <class Buffer>
+	static torch::Tensor toTensor(Buffer& buffer, std::int64_t batch_size)
+	{
+		using T = typename Buffer::value_type;
+		const auto row_size = static_cast<std::int64_t>(buffer.size()) / batch_size;
+		return torch::from_blob(buffer.data(), {batch_size, row_size}, torch::TensorOptions{}.dtype(c10::CppTypeToScalarType<T>::value));
+	}
+
+	ObsBatch m_batch;
+};
+
+}  // namespace impala
+
+#endif
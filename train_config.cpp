@@ -0,0 +1,364 @@
+#include "train_config.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+namespace impala
+{
+
+namespace
+{
+
+template <class Config, class Visitor>
+void visitFields(Config& config, Visitor&& visitor)
+{
+	visitor("num_actors", config.num_actors);
+	visitor("num_predictors", config.num_predictors);
+	visitor("num_trainers", config.num_trainers);
+	visitor("min_prediction_batch_size", config.min_prediction_batch_size);
+	visitor("max_prediction_batch_size", config.max_prediction_batch_size);
+	visitor("min_training_batch_size", config.min_training_batch_size);
+	visitor("max_training_batch_size", config.max_training_batch_size);
+	visitor("t_max", config.t_max);
+	visitor("max_episode_length", config.max_episode_length);
+	visitor("discount", config.discount);
+	visitor("learning_rate", config.learning_rate);
+	visitor("num_learners", config.num_learners);
+	visitor("actor_reassign_interval_steps", config.actor_reassign_interval_steps);
+	visitor("max_policy_lag", config.max_policy_lag);
+	visitor("stale_data_policy", config.stale_data_policy);
+	visitor("replay_capacity", config.replay_capacity);
+	visitor("replay_fraction", config.replay_fraction);
+	visitor("samples_per_insert", config.samples_per_insert);
+	visitor("samples_per_insert_tolerance", config.samples_per_insert_tolerance);
+	visitor("num_actor_workers", config.num_actor_workers);
+	visitor("envs_per_actor_worker", config.envs_per_actor_worker);
+	visitor("num_inference_workers", config.num_inference_workers);
+	visitor("weight_publish_interval", config.weight_publish_interval);
+	visitor("pin_threads", config.pin_threads);
+	visitor("num_python_threads", config.num_python_threads);
+	visitor("num_batch_threads", config.num_batch_threads);
+	visitor("min_batch_chunk_size", config.min_batch_chunk_size);
+	visitor("batch_memory_budget", config.batch_memory_budget);
+	visitor("reuse_encodings", config.reuse_encodings);
+	visitor("average_loss_decay", config.average_loss_decay);
+	visitor("log_interval_steps", config.log_interval_steps);
+	visitor("save_interval_steps", config.save_interval_steps);
+	visitor("control_socket", config.control_socket);
+	visitor("remote_actor_port", config.remote_actor_port);
+	visitor("weight_snapshot", config.weight_snapshot);
+	visitor("learner_t_max", config.learner_t_max);
+	visitor("learner_discount", config.learner_discount);
+	visitor("learner_learning_rate", config.learner_learning_rate);
+	visitor("record_trajectories", config.record_trajectories);
+	visitor("record_segment_bytes", config.record_segment_bytes);
+	visitor("offline_trajectories", config.offline_trajectories);
+	visitor("async_checkpoints", config.async_checkpoints);
+	visitor("resume", config.resume);
+	visitor("seed", config.seed);
+	visitor("deterministic", config.deterministic);
+	visitor("native_inference", config.native_inference);
+}
+
+std::string trim(const std::string& str)
+{
+	auto first = std::find_if_not(str.begin(), str.end(), [](unsigned char c) { return std::isspace(c); });
+	auto last = std::find_if_not(str.rbegin(), str.rend(), [](unsigned char c) { return std::isspace(c); }).base();
+	return first < last ? std::string(first, last) : std::string{};
+}
+
+void parseValue(const std::string& str, std::size_t& value)
+{
+	std::size_t pos = 0;
+	auto parsed = std::stoull(str, &pos);
+	if (pos != str.size() || str.front() == '-') {
+		throw std::invalid_argument(str);
+	}
+	value = static_cast<std::size_t>(parsed);
+}
+void parseValue(const std::string& str, double& value)
+{
+	std::size_t pos = 0;
+	value = std::stod(str, &pos);
+	if (pos != str.size()) {
+		throw std::invalid_argument(str);
+	}
+}
+void parseValue(const std::string& str, float& value)
+{
+	double temp;
+	parseValue(str, temp);
+	value = static_cast<float>(temp);
+}
+void parseValue(const std::string& str, bool& value)
+{
+	if (str == "true" || str == "1" || str == "on") {
+		value = true;
+	} else if (str == "false" || str == "0" || str == "off") {
+		value = false;
+	} else {
+		throw std::invalid_argument(str);
+	}
+}
+void parseValue(const std::string& str, std::string& value)
+{
+	value = str;
+}
+void parseValue(const std::string& str, StaleDataPolicy& value)
+{
+	if (str == "drop") {
+		value = StaleDataPolicy::DROP;
+	} else if (str == "deprioritize") {
+		value = StaleDataPolicy::DEPRIORITIZE;
+	} else {
+		throw std::invalid_argument(str);
+	}
+}
+template <class T>
+void parseValue(const std::string& str, std::optional<T>& value)
+{
+	if (str == "none") {
+		value = std::nullopt;
+	} else {
+		T temp;
+		parseValue(str, temp);
+		value = temp;
+	}
+}
+
+template <class T>
+void parseValue(const std::string& str, std::vector<T>& values)
+{
+	values.clear();
+	if (str.empty()) {
+		return;
+	}
+	std::istringstream iss{str};
+	std::string item;
+	while (std::getline(iss, item, ',')) {
+		T temp;
+		parseValue(trim(item), temp);
+		values.push_back(temp);
+	}
+}
+
+template <class T>
+void formatValue(std::ostream& os, const T& value)
+{
+	os << value;
+}
+void formatValue(std::ostream& os, bool value)
+{
+	os << (value ? "true" : "false");
+}
+void formatValue(std::ostream& os, StaleDataPolicy value)
+{
+	os << (value == StaleDataPolicy::DROP ? "drop" : "deprioritize");
+}
+template <class T>
+void formatValue(std::ostream& os, const std::optional<T>& value)
+{
+	if (value.has_value()) {
+		formatValue(os, value.value());
+	} else {
+		os << "none";
+	}
+}
+template <class T>
+void formatValue(std::ostream& os, const std::vector<T>& values)
+{
+	for (std::size_t i = 0; i < values.size(); ++i) {
+		os << (i > 0 ? "," : "");
+		formatValue(os, values[i]);
+	}
+}
+
+}  // namespace
+
+void TrainConfig::set(const std::string& key, const std::string& value)
+{
+	bool found = false;
+	visitFields(*this, [&](const char* name, auto& field) {
+		if (key != name) {
+			return;
+		}
+		found = true;
+		try {
+			parseValue(trim(value), field);
+		} catch (const std::logic_error&) {
+			throw ConfigError("invalid value for " + key + " : " + value);
+		}
+	});
+	if (!found) {
+		throw ConfigError("unknown config key : " + key);
+	}
+}
+
+void TrainConfig::load(const std::string& path)
+{
+	std::ifstream ifs{path};
+	if (!ifs) {
+		throw ConfigError("cannot open " + path);
+	}
+	std::string line;
+	while (std::getline(ifs, line)) {
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty()) {
+			continue;
+		}
+		auto eq = line.find('=');
+		if (eq == std::string::npos) {
+			throw ConfigError("invalid line in " + path + " : " + line);
+		}
+		set(trim(line.substr(0, eq)), line.substr(eq + 1));
+	}
+}
+
+void TrainConfig::save(const std::string& path) const
+{
+	std::ofstream ofs{path};
+	if (!ofs) {
+		throw ConfigError("cannot open " + path);
+	}
+	ofs << *this;
+}
+
+void TrainConfig::validate() const
+{
+	if (num_predictors == 0) {
+		throw ConfigError("num_predictors must be positive");
+	}
+	if (min_batch_chunk_size == 0) {
+		throw ConfigError("min_batch_chunk_size must be positive");
+	}
+	if (t_max == 0) {
+		throw ConfigError("t_max must be positive");
+	}
+	if (min_prediction_batch_size == 0 || min_prediction_batch_size > max_prediction_batch_size) {
+		throw ConfigError("prediction batch sizes must satisfy 0 < min <= max");
+	}
+	if (min_training_batch_size == 0 || min_training_batch_size > max_training_batch_size) {
+		throw ConfigError("training batch sizes must satisfy 0 < min <= max");
+	}
+	if (num_actor_workers > 0 && envs_per_actor_worker == 0) {
+		throw ConfigError("envs_per_actor_worker must be positive");
+	}
+	if (!(replay_fraction >= 0.0 && replay_fraction < 1.0)) {
+		throw ConfigError("replay_fraction must be in [0, 1)");
+	}
+	if (replay_fraction > 0.0 && replay_capacity == 0) {
+		throw ConfigError("replay_fraction needs a positive replay_capacity");
+	}
+	if (samples_per_insert.has_value()) {
+		if (!(samples_per_insert.value() > 0.0)) {
+			throw ConfigError("samples_per_insert must be positive");
+		}
+		// every fresh step is trained once, so only replay lets the trainers sample more steps than the actors insert
+		if (samples_per_insert.value() * (1.0 - replay_fraction) > 1.0) {
+			throw ConfigError("samples_per_insert can be at most 1 / (1 - replay_fraction)");
+		}
+		// otherwise the smallest training batch can never be taken
+		if (!(samples_per_insert_tolerance >= static_cast<double>(min_training_batch_size * t_max))) {
+			throw ConfigError("samples_per_insert_tolerance must be at least min_training_batch_size * t_max");
+		}
+	}
+	if (weight_publish_interval == 0) {
+		throw ConfigError("weight_publish_interval must be positive");
+	}
+	if (weight_snapshot.has_value() && (weight_snapshot->size() < 2 || weight_snapshot->size() > 63 || weight_snapshot->front() != '/' || weight_snapshot->find('/', 1) != std::string::npos)) {
+		throw ConfigError("weight_snapshot must be a name like /impala-weights of at most 63 characters");
+	}
+	if (record_segment_bytes < (std::size_t{1} << 20)) {
+		throw ConfigError("record_segment_bytes must be at least 1 MiB");
+	}
+	if (remote_actor_port.has_value() && remote_actor_port.value() > 65535) {
+		throw ConfigError("remote_actor_port must be a TCP port");
+	}
+	if (offline_trajectories.has_value()) {
+		if (num_actors > 0 || num_actor_workers > 0 || remote_actor_port.has_value()) {
+			throw ConfigError("offline_trajectories replaces the actors, set num_actors = 0");
+		}
+		if (num_trainers == 0) {
+			throw ConfigError("offline_trajectories needs trainers");
+		}
+	}
+	if (num_learners == 0) {
+		throw ConfigError("num_learners must be positive");
+	}
+	if (deterministic) {
+		if (!seed.has_value()) {
+			throw ConfigError("deterministic needs a seed");
+		}
+		// only the actor threads step in lock-step with the predictor
+		if (num_learners != 1 || num_predictors != 1 || num_trainers != 1) {
+			throw ConfigError("deterministic needs one learner, one predictor and one trainer");
+		}
+		if (num_actors == 0 || num_actor_workers > 0 || remote_actor_port.has_value() || num_inference_workers > 0 || offline_trajectories.has_value()) {
+			throw ConfigError("deterministic needs actor threads only, no actor workers, remote actors, inference workers or offline_trajectories");
+		}
+		if (samples_per_insert.has_value()) {
+			throw ConfigError("deterministic replaces samples_per_insert");
+		}
+		if (max_prediction_batch_size < num_actors) {
+			throw ConfigError("deterministic needs max_prediction_batch_size >= num_actors");
+		}
+	}
+	if (native_inference) {
+		if (num_inference_workers > 0) {
+			throw ConfigError("native_inference replaces the inference workers, set num_inference_workers = 0");
+		}
+		// the weights a batch sees depend on when the learner thread publishes them
+		if (deterministic) {
+			throw ConfigError("deterministic runs predict on the learner thread, unset native_inference");
+		}
+	}
+	if (actor_reassign_interval_steps.has_value() && actor_reassign_interval_steps.value() == 0) {
+		throw ConfigError("actor_reassign_interval_steps must be positive");
+	}
+	if (save_interval_steps.has_value() && save_interval_steps.value() == 0) {
+		throw ConfigError("save_interval_steps must be positive");
+	}
+	if (!learner_t_max.empty() && learner_t_max.size() != num_learners) {
+		throw ConfigError("learner_t_max must have num_learners values");
+	}
+	if (std::find(learner_t_max.begin(), learner_t_max.end(), std::size_t{0}) != learner_t_max.end()) {
+		throw ConfigError("learner_t_max values must be positive");
+	}
+	if (!learner_discount.empty() && learner_discount.size() != num_learners) {
+		throw ConfigError("learner_discount must have num_learners values");
+	}
+	if (!learner_learning_rate.empty() && learner_learning_rate.size() != num_learners) {
+		throw ConfigError("learner_learning_rate must have num_learners values");
+	}
+	if (!(learning_rate > 0.0f) || std::any_of(learner_learning_rate.begin(), learner_learning_rate.end(), [](float rate) { return !(rate > 0.0f); })) {
+		throw ConfigError("learning rates must be positive");
+	}
+	if (num_learners > 1) {
+		// worker processes and remote nodes are tied to one model, only the actor threads are shared
+		if (num_actor_workers > 0 || remote_actor_port.has_value() || num_inference_workers > 0 || weight_snapshot.has_value()) {
+			throw ConfigError("actor workers, remote actors, inference workers and weight_snapshot need num_learners = 1");
+		}
+		// every learner keeps at least a prediction batch of actors
+		if (!offline_trajectories.has_value() && num_learners * min_prediction_batch_size > num_actors) {
+			throw ConfigError("num_learners * min_prediction_batch_size must not exceed num_actors");
+		}
+	}
+	// remote actor nodes come and go, so only the local environments are checked
+	if (!remote_actor_port.has_value() && !offline_trajectories.has_value() && min_prediction_batch_size > num_actors + num_actor_workers * envs_per_actor_worker) {
+		throw ConfigError("min_prediction_batch_size must not exceed num_actors + num_actor_workers * envs_per_actor_worker");
+	}
+}
+
+std::ostream& operator<<(std::ostream& os, const TrainConfig& config)
+{
+	visitFields(config, [&os](const char* name, const auto& field) {
+		os << name << " = ";
+		formatValue(os, field);
+		os << '\n';
+	});
+	return os;
+}
+
+}  // namespace impala
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace impala
+{
+
+enum class StaleDataPolicy : std::uint8_t
+{
+	DROP,
+	DEPRIORITIZE
+};
+
+class ConfigError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+struct TrainConfig
+{
+	std::size_t num_actors;
+	std::size_t num_predictors;
+	std::size_t num_trainers;
+
+	std::size_t min_prediction_batch_size;
+	std::size_t max_prediction_batch_size;
+	std::size_t min_training_batch_size;
+	std::size_t max_training_batch_size;
+
+	std::size_t t_max;
+	std::optional<std::size_t> max_episode_length;
+	float discount;
+	// of the optimizer of the agent
+	float learning_rate;
+
+	std::size_t num_learners;
+	std::optional<std::size_t> actor_reassign_interval_steps;
+
+	std::optional<std::size_t> max_policy_lag;
+	StaleDataPolicy stale_data_policy;
+
+	std::size_t replay_capacity;
+	double replay_fraction;
+
+	std::optional<double> samples_per_insert;
+	double samples_per_insert_tolerance;
+
+	std::size_t num_actor_workers;
+	std::size_t envs_per_actor_worker;
+
+	std::size_t num_inference_workers;
+	std::size_t weight_publish_interval;
+
+	bool pin_threads;
+	std::optional<std::size_t> num_python_threads;
+
+	std::size_t num_batch_threads;
+	std::size_t min_batch_chunk_size;
+	std::optional<std::size_t> batch_memory_budget;
+	bool reuse_encodings;
+
+	double average_loss_decay;
+	std::optional<std::size_t> log_interval_steps;
+	std::optional<std::size_t> save_interval_steps;
+
+	// not backed by the parameter structs
+	std::optional<std::string> control_socket = std::nullopt;
+	// TCP port on which remote actor nodes connect, 0 picks a free one
+	std::optional<std::size_t> remote_actor_port = std::nullopt;
+	// shared memory object (e.g. /impala-weights) the weights are published to for other processes
+	std::optional<std::string> weight_snapshot = std::nullopt;
+	// per learner values, comma separated, empty lists give every learner t_max, discount and learning_rate
+	std::vector<std::size_t> learner_t_max = {};
+	std::vector<float> learner_discount = {};
+	std::vector<float> learner_learning_rate = {};
+	// directory the rollouts of the actor threads are recorded to, see trajectory_log.hpp
+	std::optional<std::string> record_trajectories = std::nullopt;
+	std::size_t record_segment_bytes = std::size_t{256} << 20;
+	// checkpoints are serialized on the learner thread and written by a background thread
+	bool async_checkpoints = true;
+	// continue from the latest checkpoint of every learner: model, optimizer, counters and the actor episodes
+	bool resume = false;
+	// seeds the environments and the action sampling of every actor, replay sampling and the model
+	std::optional<std::size_t> seed = std::nullopt;
+	// lock-step schedule: every prediction batch has all actors in order and the rollouts are trained in the
+	// order of the actors between prediction batches, so that runs with the same seed are identical
+	bool deterministic = false;
+	// directory of recorded rollouts the learners train on instead of rollouts of actors (num_actors = 0)
+	std::optional<std::string> offline_trajectories = std::nullopt;
+	// the predictors run the native model of the agent on their own threads instead of queueing batches for the
+	// Python thread, with the weights of every weight_publish_interval model versions
+	bool native_inference = false;
+
+	// the compile-time parameter structs provide the defaults
+	template <class Parameters>
+	static TrainConfig fromParameters()
+	{
+		TrainConfig config;
+		config.num_actors = Parameters::NUM_ACTORS;
+		config.num_predictors = Parameters::NUM_PREDICTORS;
+		config.num_trainers = Parameters::NUM_TRAINERS;
+		config.min_prediction_batch_size = Parameters::MIN_PREDICTION_BATCH_SIZE;
+		config.max_prediction_batch_size = Parameters::MAX_PREDICTION_BATCH_SIZE;
+		config.min_training_batch_size = Parameters::MIN_TRAINING_BATCH_SIZE;
+		config.max_training_batch_size = Parameters::MAX_TRAINING_BATCH_SIZE;
+		config.t_max = Parameters::T_MAX;
+		config.max_episode_length = Parameters::MAX_EPISODE_LENGTH;
+		config.discount = Parameters::DISCOUNT;
+		config.learning_rate = Parameters::LEARNING_RATE;
+		config.num_learners = Parameters::NUM_LEARNERS;
+		config.actor_reassign_interval_steps = Parameters::ACTOR_REASSIGN_INTERVAL_STEPS;
+		config.max_policy_lag = Parameters::MAX_POLICY_LAG;
+		config.stale_data_policy = Parameters::STALE_DATA_POLICY;
+		config.replay_capacity = Parameters::REPLAY_CAPACITY;
+		config.replay_fraction = Parameters::REPLAY_FRACTION;
+		config.samples_per_insert = Parameters::SAMPLES_PER_INSERT;
+		config.samples_per_insert_tolerance = Parameters::SAMPLES_PER_INSERT_TOLERANCE;
+		config.num_actor_workers = Parameters::NUM_ACTOR_WORKERS;
+		config.envs_per_actor_worker = Parameters::ENVS_PER_ACTOR_WORKER;
+		config.num_inference_workers = Parameters::NUM_INFERENCE_WORKERS;
+		config.weight_publish_interval = Parameters::WEIGHT_PUBLISH_INTERVAL;
+		config.pin_threads = Parameters::PIN_THREADS;
+		config.num_python_threads = Parameters::NUM_PYTHON_THREADS;
+		config.num_batch_threads = Parameters::NUM_BATCH_THREADS;
+		config.min_batch_chunk_size = Parameters::MIN_BATCH_CHUNK_SIZE;
+		config.batch_memory_budget = Parameters::BATCH_MEMORY_BUDGET;
+		config.reuse_encodings = Parameters::REUSE_ENCODINGS;
+		config.average_loss_decay = Parameters::AVERAGE_LOSS_DECAY;
+		config.log_interval_steps = Parameters::LOG_INTERVAL_STEPS;
+		config.save_interval_steps = Parameters::SAVE_INTERVAL_STEPS;
+		return config;
+	}
+
+	// keys are the lower case names of the members, optional values accept "none"
+	void set(const std::string& key, const std::string& value);
+	// "key = value" per line, '#' starts a comment
+	void load(const std::string& path);
+	void save(const std::string& path) const;
+	void validate() const;
+
+	std::size_t learnerTMax(std::size_t learner) const noexcept
+	{
+		return learner_t_max.empty() ? t_max : learner_t_max[learner];
+	}
+	float learnerDiscount(std::size_t learner) const noexcept
+	{
+		return learner_discount.empty() ? discount : learner_discount[learner];
+	}
+	float learnerLearningRate(std::size_t learner) const noexcept
+	{
+		return learner_learning_rate.empty() ? learning_rate : learner_learning_rate[learner];
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, const TrainConfig& config);
+};
+
+}  // namespace impala
@@ -0,0 +1,405 @@
+#include "trajectory_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+namespace impala
+{
+
+namespace
+{
+
+constexpr const char* SEGMENT_EXTENSION = ".traj";
+constexpr const char* INDEX_EXTENSION = ".idx";
+
+std::string segmentPath(const std::string& directory, std::size_t index)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "segment-%06zu", index);
+	return (boost::filesystem::path(directory) / name).string() + SEGMENT_EXTENSION;
+}
+
+// the NNNNNN of segment-NNNNNN.traj, none for a name segmentPath does not produce
+std::optional<std::size_t> segmentIndex(const std::string& segment_path)
+{
+	const auto stem = boost::filesystem::path(segment_path).stem().string();
+	if (stem.size() <= 8 || !std::all_of(stem.begin() + 8, stem.end(), [](char c) { return '0' <= c && c <= '9'; })) {
+		return std::nullopt;
+	}
+	try {
+		return static_cast<std::size_t>(std::stoull(stem.substr(8)));
+	} catch (const std::out_of_range&) {
+		return std::nullopt;
+	}
+}
+
+std::string indexPath(const std::string& segment_path)
+{
+	return segment_path.substr(0, segment_path.size() - std::strlen(SEGMENT_EXTENSION)) + INDEX_EXTENSION;
+}
+
+void writeAll(int fd, const void* data, std::size_t size, const std::string& path)
+{
+	const auto* bytes = static_cast<const char*>(data);
+	while (size > 0) {
+		const auto written = ::write(fd, bytes, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw TrajectoryLogError("write " + path + " : " + std::strerror(errno));
+		}
+		bytes += written;
+		size -= static_cast<std::size_t>(written);
+	}
+}
+
+// returns nullptr for an empty file
+void* mapFile(const std::string& path, std::size_t& size)
+{
+	int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw TrajectoryLogError("open " + path + " : " + std::strerror(errno));
+	}
+	struct ::stat st;
+	if (::fstat(fd, &st) != 0) {
+		auto message = std::string(std::strerror(errno));
+		::close(fd);
+		throw TrajectoryLogError("fstat " + path + " : " + message);
+	}
+	size = static_cast<std::size_t>(st.st_size);
+	if (size == 0) {
+		::close(fd);
+		return nullptr;
+	}
+	void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		throw TrajectoryLogError("mmap " + path + " : " + std::strerror(errno));
+	}
+	return data;
+}
+
+bool episodeLess(const TrajectoryIndexEntry& lhs, const TrajectoryIndexEntry& rhs) noexcept
+{
+	return lhs.episode_id < rhs.episode_id;
+}
+
+}  // namespace
+
+TrajectoryWriter::TrajectoryWriter(const std::string& directory, std::size_t segment_bytes, std::size_t max_queued_bytes, std::size_t observation_bytes, std::size_t reward_bytes)
+    : m_directory(directory),
+      m_segment_bytes(segment_bytes),
+      m_max_queued_bytes(max_queued_bytes),
+      m_observation_bytes(static_cast<std::uint32_t>(observation_bytes)),
+      m_reward_bytes(static_cast<std::uint32_t>(reward_bytes))
+{
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(directory, ec);
+	if (ec) {
+		throw TrajectoryLogError("create_directories " + directory + " : " + ec.message());
+	}
+	// a directory recorded to before keeps its segments, the new ones follow the highest of them even if some were removed
+	for (auto&& path : TrajectorySegment::list(directory)) {
+		if (const auto index = segmentIndex(path)) {
+			m_segment_index = std::max(m_segment_index, index.value() + 1);
+		}
+	}
+	m_thread = std::thread{[this] {
+		run();
+	}};
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	{
+		std::lock_guard lock{m_mutex};
+		m_exit_flag = true;
+	}
+	m_event.notify_one();
+	m_thread.join();
+}
+
+bool TrajectoryWriter::append(std::vector<std::byte>& record)
+{
+	{
+		std::lock_guard lock{m_mutex};
+		if (m_queued_bytes + record.size() > m_max_queued_bytes) {
+			m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		m_queued_bytes += record.size();
+		m_queue.emplace_back(std::move(record));
+		if (m_free_buffers.empty()) {
+			record = std::vector<std::byte>{};
+		} else {
+			record = std::move(m_free_buffers.back());
+			m_free_buffers.pop_back();
+		}
+	}
+	m_event.notify_one();
+	return true;
+}
+
+void TrajectoryWriter::run()
+{
+	std::deque<std::vector<std::byte>> records;
+	bool failed = false;
+	while (true) {
+		{
+			std::unique_lock lock{m_mutex};
+			for (auto&& record : records) {
+				record.clear();
+				m_free_buffers.emplace_back(std::move(record));
+			}
+			records.clear();
+			m_event.wait(lock, [this] { return !m_queue.empty() || m_exit_flag; });
+			if (m_queue.empty()) {
+				break;
+			}
+			records.swap(m_queue);
+			m_queued_bytes = 0;
+		}
+		for (auto&& record : records) {
+			if (failed) {
+				m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			try {
+				write(record);
+			} catch (const TrajectoryLogError& e) {
+				// training goes on without recording
+				std::cerr << e.what() << std::endl;
+				failed = true;
+				m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+	try {
+		closeSegment();
+	} catch (const TrajectoryLogError& e) {
+		std::cerr << e.what() << std::endl;
+	}
+}
+
+void TrajectoryWriter::write(const std::vector<std::byte>& record)
+{
+	if (m_fd >= 0 && m_segment_records > 0 && m_segment_offset + record.size() > m_segment_bytes) {
+		closeSegment();
+	}
+	if (m_fd < 0) {
+		openSegment();
+	}
+	TrajectoryRecordHeader header;
+	std::memcpy(&header, record.data(), sizeof(header));
+	writeAll(m_fd, record.data(), record.size(), segmentPath(m_directory, m_segment_index));
+	for (std::uint32_t i = 0; i < header.num_episodes; ++i) {
+		m_index.push_back({header.first_episode_id + i, m_segment_offset});
+	}
+	m_segment_offset += record.size();
+	++m_segment_records;
+	m_written_records.fetch_add(1, std::memory_order_relaxed);
+	m_written_bytes.fetch_add(record.size(), std::memory_order_relaxed);
+}
+
+void TrajectoryWriter::openSegment()
+{
+	const auto path = segmentPath(m_directory, m_segment_index);
+	m_fd = ::open(path.data(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (m_fd < 0) {
+		throw TrajectoryLogError("open " + path + " : " + std::strerror(errno));
+	}
+	TrajectorySegmentHeader header{TrajectorySegmentHeader::MAGIC, TrajectorySegmentHeader::VERSION, m_observation_bytes, m_reward_bytes, 0, 0, 0};
+	writeAll(m_fd, &header, sizeof(header), path);
+	m_segment_offset = sizeof(header);
+	m_segment_records = 0;
+	m_index.clear();
+	m_num_segments.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TrajectoryWriter::closeSegment()
+{
+	if (m_fd < 0) {
+		return;
+	}
+	const auto path = segmentPath(m_directory, m_segment_index);
+	TrajectorySegmentHeader header{TrajectorySegmentHeader::MAGIC, TrajectorySegmentHeader::VERSION, m_observation_bytes, m_reward_bytes, 0, m_segment_offset - sizeof(TrajectorySegmentHeader), m_segment_records};
+	const auto written = ::pwrite(m_fd, &header, sizeof(header), 0);
+	const auto pwrite_errno = errno;
+	::close(m_fd);
+	m_fd = -1;
+	++m_segment_index;
+	if (written != static_cast<::ssize_t>(sizeof(header))) {
+		throw TrajectoryLogError("pwrite " + path + " : " + std::strerror(pwrite_errno));
+	}
+
+	// the entries of an episode keep the order of its records
+	std::stable_sort(m_index.begin(), m_index.end(), episodeLess);
+	// written under a temporary name, so that an index file is always complete
+	const auto index_path = indexPath(path);
+	const auto temp_path = index_path + ".tmp";
+	int fd = ::open(temp_path.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		throw TrajectoryLogError("open " + temp_path + " : " + std::strerror(errno));
+	}
+	try {
+		TrajectoryIndexHeader index_header{TrajectoryIndexHeader::MAGIC, m_index.size()};
+		writeAll(fd, &index_header, sizeof(index_header), temp_path);
+		writeAll(fd, m_index.data(), m_index.size() * sizeof(TrajectoryIndexEntry), temp_path);
+	} catch (const TrajectoryLogError&) {
+		::close(fd);
+		throw;
+	}
+	::close(fd);
+	if (::rename(temp_path.data(), index_path.data()) != 0) {
+		throw TrajectoryLogError("rename " + temp_path + " : " + std::strerror(errno));
+	}
+}
+
+TrajectorySegment::TrajectorySegment(const std::string& path)
+{
+	m_data = mapFile(path, m_size);
+	if (m_size < sizeof(TrajectorySegmentHeader) || header().magic != TrajectorySegmentHeader::MAGIC || header().version != TrajectorySegmentHeader::VERSION) {
+		unmap();
+		throw TrajectoryLogError(path + " is not a trajectory segment");
+	}
+	// the records of a segment that was not closed end where the last complete one ends
+	const auto end = (header().data_bytes != 0) ? std::min<std::uint64_t>(m_size, sizeof(TrajectorySegmentHeader) + header().data_bytes) : m_size;
+	// the layout of TrajectoryRecordBuilder: the terminal observation, then observation, action id, reward and policy per step
+	const std::uint64_t observation_bytes = header().observation_bytes;
+	const std::uint64_t step_bytes = observation_bytes + sizeof(std::uint8_t) + header().reward_bytes + sizeof(float);
+	std::uint64_t offset = sizeof(TrajectorySegmentHeader);
+	while (offset + sizeof(TrajectoryRecordHeader) <= end) {
+		TrajectoryRecordHeader record_header;
+		std::memcpy(&record_header, record(offset), sizeof(record_header));
+		if (record_header.size < sizeof(TrajectoryRecordHeader) + observation_bytes + record_header.num_steps * step_bytes || record_header.size % 8 != 0 || offset + record_header.size > end) {
+			break;
+		}
+		m_record_offsets.push_back(offset);
+		offset += record_header.size;
+	}
+
+	const auto index_path = indexPath(path);
+	if (header().data_bytes != 0 && boost::filesystem::exists(index_path)) {
+		m_index_data = mapFile(index_path, m_index_size);
+		const auto* index_header = static_cast<const TrajectoryIndexHeader*>(m_index_data);
+		if (m_index_size < sizeof(TrajectoryIndexHeader) || index_header->magic != TrajectoryIndexHeader::MAGIC || m_index_size < sizeof(TrajectoryIndexHeader) + index_header->num_entries * sizeof(TrajectoryIndexEntry)) {
+			unmap();
+			throw TrajectoryLogError(index_path + " is not a trajectory index");
+		}
+		return;
+	}
+	for (auto record_offset : m_record_offsets) {
+		TrajectoryRecordHeader record_header;
+		std::memcpy(&record_header, record(record_offset), sizeof(record_header));
+		for (std::uint32_t i = 0; i < record_header.num_episodes; ++i) {
+			m_scanned_index.push_back({record_header.first_episode_id + i, record_offset});
+		}
+	}
+	std::stable_sort(m_scanned_index.begin(), m_scanned_index.end(), episodeLess);
+}
+
+TrajectorySegment::TrajectorySegment(TrajectorySegment&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_index_data(std::exchange(other.m_index_data, nullptr)),
+      m_index_size(std::exchange(other.m_index_size, 0)),
+      m_scanned_index(std::move(other.m_scanned_index)),
+      m_record_offsets(std::move(other.m_record_offsets))
+{}
+
+TrajectorySegment& TrajectorySegment::operator=(TrajectorySegment&& other) noexcept
+{
+	if (this != &other) {
+		unmap();
+		m_data = std::exchange(other.m_data, nullptr);
+		m_size = std::exchange(other.m_size, 0);
+		m_index_data = std::exchange(other.m_index_data, nullptr);
+		m_index_size = std::exchange(other.m_index_size, 0);
+		m_scanned_index = std::move(other.m_scanned_index);
+		m_record_offsets = std::move(other.m_record_offsets);
+	}
+	return *this;
+}
+
+TrajectorySegment::~TrajectorySegment()
+{
+	unmap();
+}
+
+std::vector<std::string> TrajectorySegment::list(const std::string& directory)
+{
+	std::vector<std::string> paths;
+	boost::system::error_code ec;
+	for (auto&& entry : boost::filesystem::directory_iterator(directory, ec)) {
+		const auto name = entry.path().filename().string();
+		if (name.compare(0, 8, "segment-") == 0 && entry.path().extension() == SEGMENT_EXTENSION) {
+			paths.push_back(entry.path().string());
+		}
+	}
+	std::sort(paths.begin(), paths.end());
+	return paths;
+}
+
+TrajectorySegmentHeader TrajectorySegment::readHeader(const std::string& path)
+{
+	int fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw TrajectoryLogError("open " + path + " : " + std::strerror(errno));
+	}
+	TrajectorySegmentHeader header;
+	const auto size = ::pread(fd, &header, sizeof(header), 0);
+	::close(fd);
+	if (size != static_cast<::ssize_t>(sizeof(header)) || header.magic != TrajectorySegmentHeader::MAGIC || header.version != TrajectorySegmentHeader::VERSION) {
+		throw TrajectoryLogError(path + " is not a trajectory segment");
+	}
+	return header;
+}
+
+void TrajectorySegment::adviseSequential() const noexcept
+{
+	::madvise(m_data, m_size, MADV_SEQUENTIAL);
+	::madvise(m_data, m_size, MADV_WILLNEED);
+}
+
+std::vector<std::uint64_t> TrajectorySegment::episodeRecords(std::uint64_t episode_id) const
+{
+	const TrajectoryIndexEntry* first = m_scanned_index.data();
+	const TrajectoryIndexEntry* last = first + m_scanned_index.size();
+	if (m_index_data != nullptr) {
+		const auto* index_header = static_cast<const TrajectoryIndexHeader*>(m_index_data);
+		first = reinterpret_cast<const TrajectoryIndexEntry*>(index_header + 1);
+		last = first + index_header->num_entries;
+	}
+	auto [begin, end] = std::equal_range(first, last, TrajectoryIndexEntry{episode_id, 0}, episodeLess);
+	std::vector<std::uint64_t> offsets;
+	for (auto it = begin; it != end; ++it) {
+		offsets.push_back(it->offset);
+	}
+	return offsets;
+}
+
+void TrajectorySegment::unmap() noexcept
+{
+	if (m_data != nullptr) {
+		::munmap(m_data, m_size);
+		m_data = nullptr;
+	}
+	if (m_index_data != nullptr) {
+		::munmap(m_index_data, m_index_size);
+		m_index_data = nullptr;
+	}
+}
+
+}  // namespace impala
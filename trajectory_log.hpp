@@ -0,0 +1,313 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace impala
+{
+
+// Recorded rollouts are appended to segment files DIR/segment-NNNNNN.traj. A segment is a
+// TrajectorySegmentHeader followed by records, each a TrajectoryRecordHeader, the terminal observation and
+// per step the observation, action id | next goal flag, reward and policy, written back to back without
+// padding and padded to 8 bytes at the end of the record. When a segment is closed its header gets the number
+// of data bytes and DIR/segment-NNNNNN.idx gets a TrajectoryIndexHeader followed by a TrajectoryIndexEntry per
+// (episode, record) sorted by episode id, so that both files can be used in place after mmap. A segment that
+// was not closed (the process was killed) is indexed by walking its records.
+class TrajectoryLogError : public std::runtime_error
+{
+public:
+	using runtime_error::runtime_error;
+};
+
+struct TrajectorySegmentHeader
+{
+	static inline constexpr std::uint64_t MAGIC = 0x696d70616c617472ull;
+	static inline constexpr std::uint32_t VERSION = 1;
+
+	std::uint64_t magic;
+	std::uint32_t version;
+	std::uint32_t observation_bytes;
+	std::uint32_t reward_bytes;
+	std::uint32_t reserved;
+	// 0 while the segment is open
+	std::uint64_t data_bytes;
+	std::uint64_t num_records;
+};
+
+struct TrajectoryRecordHeader
+{
+	// of the whole record, a multiple of 8
+	std::uint32_t size;
+	std::uint32_t num_steps;
+	// the episode of the first step, the next goal flags of the steps start the following ones
+	std::uint64_t first_episode_id;
+	std::uint32_t num_episodes;
+	std::uint32_t learner;
+	// of the weights that chose the first action
+	std::uint64_t model_version;
+};
+
+struct TrajectoryIndexHeader
+{
+	static inline constexpr std::uint64_t MAGIC = 0x696d70616c617469ull;
+
+	std::uint64_t magic;
+	std::uint64_t num_entries;
+};
+
+struct TrajectoryIndexEntry
+{
+	std::uint64_t episode_id;
+	// of the record in the segment
+	std::uint64_t offset;
+};
+
+// episode ids are unique per run: the actor index in the upper bits and the episodes the actor played
+inline constexpr std::uint64_t trajectoryEpisodeId(std::size_t actor, std::uint64_t episode) noexcept
+{
+	return (static_cast<std::uint64_t>(actor) << 40) | episode;
+}
+
+// the next goal flag shares the byte with the action id
+inline constexpr std::uint8_t TRAJECTORY_NEXT_GOAL_FLAG = 0x80;
+
+template <class Observation, class Reward>
+struct TrajectoryStep
+{
+	static_assert(std::is_trivially_copyable_v<Observation> && std::is_trivially_copyable_v<Reward>);
+	static inline constexpr std::size_t BYTES = sizeof(Observation) + sizeof(std::uint8_t) + sizeof(Reward) + sizeof(float);
+
+	Observation observation;
+	std::uint8_t action_id;
+	bool next_goal;
+	Reward reward;
+	float policy;
+};
+
+// builds one record in a reusable buffer
+template <class Observation, class Reward>
+class TrajectoryRecordBuilder
+{
+public:
+	using Step = TrajectoryStep<Observation, Reward>;
+
+	void begin(std::vector<std::byte>& buffer, std::size_t num_steps, std::uint64_t first_episode_id, std::size_t learner, std::uint64_t model_version, const Observation& terminal)
+	{
+		m_buffer = &buffer;
+		m_num_episodes = 1;
+		m_previous_goal = false;
+		buffer.resize((sizeof(TrajectoryRecordHeader) + sizeof(Observation) + num_steps * Step::BYTES + 7) / 8 * 8);
+		m_header = TrajectoryRecordHeader{static_cast<std::uint32_t>(buffer.size()), static_cast<std::uint32_t>(num_steps), first_episode_id, 0, static_cast<std::uint32_t>(learner), model_version};
+		m_position = sizeof(TrajectoryRecordHeader);
+		append(terminal);
+	}
+	void addStep(const Observation& observation, std::uint8_t action_id, bool next_goal, const Reward& reward, float policy)
+	{
+		append(observation);
+		append(static_cast<std::uint8_t>(action_id | (next_goal ? TRAJECTORY_NEXT_GOAL_FLAG : 0)));
+		append(reward);
+		append(policy);
+		// the step after the end of an episode starts the next one
+		if (m_previous_goal) {
+			++m_num_episodes;
+		}
+		m_previous_goal = next_goal;
+	}
+	void end()
+	{
+		m_header.num_episodes = m_num_episodes;
+		std::memcpy(m_buffer->data(), &m_header, sizeof(m_header));
+		std::memset(m_buffer->data() + m_position, 0, m_buffer->size() - m_position);
+	}
+
+private:
+	template <class T>
+	void append(const T& value)
+	{
+		std::memcpy(m_buffer->data() + m_position, &value, sizeof(T));
+		m_position += sizeof(T);
+	}
+
+	std::vector<std::byte>* m_buffer = nullptr;
+	TrajectoryRecordHeader m_header{};
+	std::size_t m_position = 0;
+	std::uint32_t m_num_episodes = 1;
+	bool m_previous_goal = false;
+};
+
+// reads the fields of a record in place
+template <class Observation, class Reward>
+class TrajectoryRecordView
+{
+public:
+	using Step = TrajectoryStep<Observation, Reward>;
+
+	explicit TrajectoryRecordView(const std::byte* record) noexcept : m_record(record)
+	{
+		std::memcpy(&m_header, record, sizeof(m_header));
+	}
+
+	const TrajectoryRecordHeader& header() const noexcept
+	{
+		return m_header;
+	}
+	std::size_t numSteps() const noexcept
+	{
+		return m_header.num_steps;
+	}
+	Observation terminal() const noexcept
+	{
+		Observation terminal;
+		std::memcpy(&terminal, m_record + sizeof(TrajectoryRecordHeader), sizeof(Observation));
+		return terminal;
+	}
+	Step step(std::size_t i) const noexcept
+	{
+		const auto* data = m_record + sizeof(TrajectoryRecordHeader) + sizeof(Observation) + i * Step::BYTES;
+		Step step;
+		std::memcpy(&step.observation, data, sizeof(Observation));
+		data += sizeof(Observation);
+		std::uint8_t action;
+		std::memcpy(&action, data, sizeof(action));
+		data += sizeof(action);
+		step.action_id = static_cast<std::uint8_t>(action & ~TRAJECTORY_NEXT_GOAL_FLAG);
+		step.next_goal = (action & TRAJECTORY_NEXT_GOAL_FLAG) != 0;
+		std::memcpy(&step.reward, data, sizeof(Reward));
+		data += sizeof(Reward);
+		std::memcpy(&step.policy, data, sizeof(float));
+		return step;
+	}
+
+private:
+	const std::byte* m_record;
+	TrajectoryRecordHeader m_header;
+};
+
+// Appends records to the segments of a directory on its own thread, so that the actors never wait for the disk.
+// Records beyond max_queued_bytes are dropped instead of blocking the actor that appends them.
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter(const std::string& directory, std::size_t segment_bytes, std::size_t max_queued_bytes, std::size_t observation_bytes, std::size_t reward_bytes);
+	TrajectoryWriter(const TrajectoryWriter&) = delete;
+	TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+	// writes the queued records and closes the open segment
+	~TrajectoryWriter();
+
+	// takes the record and leaves an empty buffer in its place, returns false if the record was dropped
+	bool append(std::vector<std::byte>& record);
+
+	std::size_t writtenRecords() const noexcept
+	{
+		return m_written_records.load(std::memory_order_relaxed);
+	}
+	std::size_t writtenBytes() const noexcept
+	{
+		return m_written_bytes.load(std::memory_order_relaxed);
+	}
+	std::size_t droppedRecords() const noexcept
+	{
+		return m_dropped_records.load(std::memory_order_relaxed);
+	}
+	std::size_t numSegments() const noexcept
+	{
+		return m_num_segments.load(std::memory_order_relaxed);
+	}
+	const std::string& directory() const noexcept
+	{
+		return m_directory;
+	}
+
+private:
+	void run();
+	void write(const std::vector<std::byte>& record);
+	void openSegment();
+	void closeSegment();
+
+	const std::string m_directory;
+	const std::size_t m_segment_bytes;
+	const std::size_t m_max_queued_bytes;
+	const std::uint32_t m_observation_bytes;
+	const std::uint32_t m_reward_bytes;
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	std::deque<std::vector<std::byte>> m_queue;
+	// buffers handed back to the actors
+	std::vector<std::vector<std::byte>> m_free_buffers;
+	std::size_t m_queued_bytes = 0;
+	bool m_exit_flag = false;
+	std::atomic<std::size_t> m_written_records{0};
+	std::atomic<std::size_t> m_written_bytes{0};
+	std::atomic<std::size_t> m_dropped_records{0};
+	std::atomic<std::size_t> m_num_segments{0};
+	// only touched by the writer thread
+	int m_fd = -1;
+	std::size_t m_segment_index = 0;
+	std::uint64_t m_segment_offset = 0;
+	std::uint64_t m_segment_records = 0;
+	std::vector<TrajectoryIndexEntry> m_index;
+	std::thread m_thread;
+};
+
+// A segment and its index mapped read-only. A segment without an index file is indexed by walking its records.
+class TrajectorySegment
+{
+public:
+	explicit TrajectorySegment(const std::string& path);
+	TrajectorySegment(TrajectorySegment&& other) noexcept;
+	TrajectorySegment& operator=(TrajectorySegment&& other) noexcept;
+	TrajectorySegment(const TrajectorySegment&) = delete;
+	TrajectorySegment& operator=(const TrajectorySegment&) = delete;
+	~TrajectorySegment();
+
+	// the segment files of a directory in the order they were written
+	static std::vector<std::string> list(const std::string& directory);
+	// reads only the header, to check a segment without mapping it
+	static TrajectorySegmentHeader readHeader(const std::string& path);
+
+	const TrajectorySegmentHeader& header() const noexcept
+	{
+		return *static_cast<const TrajectorySegmentHeader*>(m_data);
+	}
+	const std::byte* record(std::uint64_t offset) const noexcept
+	{
+		return static_cast<const std::byte*>(m_data) + offset;
+	}
+	// the offsets of all records, in the order they were written
+	const std::vector<std::uint64_t>& recordOffsets() const noexcept
+	{
+		return m_record_offsets;
+	}
+	// the offsets of the records with steps of the episode, in the order they were written
+	std::vector<std::uint64_t> episodeRecords(std::uint64_t episode_id) const;
+	std::size_t size() const noexcept
+	{
+		return m_size;
+	}
+	// lets the kernel read the segment ahead of a sequential pass
+	void adviseSequential() const noexcept;
+
+private:
+	void unmap() noexcept;
+
+	void* m_data = nullptr;
+	std::size_t m_size = 0;
+	void* m_index_data = nullptr;
+	std::size_t m_index_size = 0;
+	// entries built by walking the records when there is no index file
+	std::vector<TrajectoryIndexEntry> m_scanned_index;
+	std::vector<std::uint64_t> m_record_offsets;
+};
+
+}  // namespace impala
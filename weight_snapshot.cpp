@@ -0,0 +1,83 @@
+#include "weight_snapshot.hpp"
+
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace impala
+{
+
+namespace
+{
+
+float* weightsOf(WeightSnapshotHeader& header) noexcept
+{
+	return reinterpret_cast<float*>(&header + 1);
+}
+
+SharedMemory createSnapshotMemory(const std::string& name, std::size_t num_weights)
+{
+	SharedMemory::remove(name);
+	return SharedMemory::create(name, sizeof(WeightSnapshotHeader) + num_weights * sizeof(float));
+}
+
+}  // namespace
+
+WeightSnapshotWriter::WeightSnapshotWriter(const std::string& name, std::size_t num_weights)
+    : m_memory(createSnapshotMemory(name, num_weights))
+{
+	auto* header = new (m_memory.data()) WeightSnapshotHeader{};
+	header->magic = WeightSnapshotHeader::MAGIC;
+	header->num_weights = num_weights;
+}
+
+void WeightSnapshotWriter::publish(const float* weights, std::uint64_t model_version) noexcept
+{
+	auto& h = header();
+	const auto sequence = h.sequence.load(std::memory_order_relaxed);
+	h.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(weightsOf(h), weights, numWeights() * sizeof(float));
+	h.model_version.store(model_version, std::memory_order_relaxed);
+	h.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+WeightSnapshotReader::WeightSnapshotReader(const std::string& name) : m_memory(SharedMemory::open(name))
+{
+	const auto* h = static_cast<const WeightSnapshotHeader*>(m_memory.data());
+	if (m_memory.size() < sizeof(WeightSnapshotHeader) || h->magic != WeightSnapshotHeader::MAGIC || m_memory.size() < sizeof(WeightSnapshotHeader) + h->num_weights * sizeof(float)) {
+		throw SharedMemoryError(name + " is not a weight snapshot");
+	}
+}
+
+bool WeightSnapshotReader::tryRead(std::vector<float>& weights, std::uint64_t& model_version)
+{
+	auto& h = header();
+	weights.resize(static_cast<std::size_t>(h.num_weights));
+	while (true) {
+		const auto sequence = h.sequence.load(std::memory_order_acquire);
+		if (sequence == m_last_sequence) {
+			return false;
+		}
+		if (sequence % 2 != 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		std::memcpy(weights.data(), weightsOf(h), weights.size() * sizeof(float));
+		const auto version = h.model_version.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (h.sequence.load(std::memory_order_relaxed) != sequence) {
+			continue;
+		}
+		// the first copy of a reader does not count the publications before it attached
+		if (m_last_sequence != 0) {
+			h.skipped_versions.fetch_add((sequence - m_last_sequence) / 2 - 1, std::memory_order_relaxed);
+		}
+		h.num_reads.fetch_add(1, std::memory_order_relaxed);
+		m_last_sequence = sequence;
+		model_version = version;
+		return true;
+	}
+}
+
+}  // namespace impala
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shm_ring.hpp"
+
+namespace impala
+{
+
+// A flat copy of the model parameters in shared memory, published by the learner and read by any number of
+// processes. The sequence is a seqlock: it is odd while the learner writes, and a reader retries a copy during
+// which it changed, so that the learner never waits for a reader.
+struct alignas(64) WeightSnapshotHeader
+{
+	static inline constexpr std::uint64_t MAGIC = 0x696d70616c617773ull;
+
+	std::uint64_t magic;
+	std::uint64_t num_weights;
+	// 2 * the number of publications
+	alignas(64) std::atomic<std::uint64_t> sequence;
+	std::atomic<std::uint64_t> model_version;
+	// updated by the readers
+	alignas(64) std::atomic<std::uint64_t> num_reads;
+	// publications that a reader never copied because a newer one was already there
+	std::atomic<std::uint64_t> skipped_versions;
+};
+
+class WeightSnapshotWriter
+{
+public:
+	WeightSnapshotWriter(const std::string& name, std::size_t num_weights);
+
+	// weights must hold num_weights floats
+	void publish(const float* weights, std::uint64_t model_version) noexcept;
+
+	WeightSnapshotHeader& header() const noexcept
+	{
+		return *static_cast<WeightSnapshotHeader*>(m_memory.data());
+	}
+	std::size_t numWeights() const noexcept
+	{
+		return static_cast<std::size_t>(header().num_weights);
+	}
+	const std::string& name() const noexcept
+	{
+		return m_memory.name();
+	}
+
+private:
+	SharedMemory m_memory;
+};
+
+class WeightSnapshotReader
+{
+public:
+	explicit WeightSnapshotReader(const std::string& name);
+
+	// copies the snapshot if it was published after the last one read, returns false otherwise
+	bool tryRead(std::vector<float>& weights, std::uint64_t& model_version);
+
+private:
+	WeightSnapshotHeader& header() const noexcept
+	{
+		return *static_cast<WeightSnapshotHeader*>(m_memory.data());
+	}
+
+	SharedMemory m_memory;
+	std::uint64_t m_last_sequence = 0;
+};
+
+}  // namespace impala
@@ -0,0 +1,103 @@
+#include "worker_process.hpp"
+
+#include "affinity.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace impala
+{
+
+namespace
+{
+
+const auto g_process_start_time = std::chrono::steady_clock::now();
+
+}  // namespace
+
+std::chrono::steady_clock::time_point processStartTime() noexcept
+{
+	return g_process_start_time;
+}
+
+std::vector<std::string> processArguments()
+{
+	std::ifstream ifs{"/proc/self/cmdline", std::ios::binary};
+	std::string cmdline{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+	std::vector<std::string> args;
+	for (std::size_t first = 0; first < cmdline.size();) {
+		auto last = cmdline.find('\0', first);
+		if (last == std::string::npos) {
+			last = cmdline.size();
+		}
+		args.emplace_back(cmdline.substr(first, last - first));
+		first = last + 1;
+	}
+	if (!args.empty()) {
+		args.erase(args.begin());
+	}
+	return args;
+}
+
+::pid_t spawnSelf(const std::vector<std::string>& args, const std::vector<int>& cpus)
+{
+	std::string executable = "/proc/self/exe";
+	std::vector<std::string> storage{args};
+	if (!cpus.empty()) {
+		storage.push_back(WORKER_CPUS_FLAG + formatCpuList(cpus));
+	}
+	std::vector<char*> argv{executable.data()};
+	for (auto&& arg : storage) {
+		argv.push_back(arg.data());
+	}
+	argv.push_back(nullptr);
+	::pid_t pid = -1;
+	if (int error = ::posix_spawn(&pid, executable.data(), nullptr, nullptr, argv.data(), environ); error != 0) {
+		std::cerr << "posix_spawn failed : " << std::strerror(error) << std::endl;
+		return -1;
+	}
+	return pid;
+}
+
+bool reapProcess(::pid_t& pid)
+{
+	if (pid <= 0) {
+		return true;
+	}
+	int status = 0;
+	if (::waitpid(pid, &status, WNOHANG) != pid) {
+		return false;
+	}
+	pid = -1;
+	return true;
+}
+
+void stopProcess(::pid_t& pid, std::chrono::milliseconds timeout)
+{
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!reapProcess(pid) && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	if (pid > 0) {
+		::kill(pid, SIGKILL);
+		::waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+}
+
+bool bindToParentProcess()
+{
+	::prctl(PR_SET_PDEATHSIG, SIGKILL);
+	return ::getppid() != 1;
+}
+
+}  // namespace impala
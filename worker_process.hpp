@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace impala
+{
+
+// the arguments this process was started with, without the executable
+std::vector<std::string> processArguments();
+
+// taken while the static objects are initialized, before main
+std::chrono::steady_clock::time_point processStartTime() noexcept;
+
+// command line flag that hands a worker process the cpus it runs on, a spawned process would keep the cpus of the server thread
+inline constexpr const char* WORKER_CPUS_FLAG = "--worker-cpus=";
+
+// starts this executable again with args, followed by WORKER_CPUS_FLAG unless cpus is empty;
+// returns -1 (and reports the error) if that fails
+::pid_t spawnSelf(const std::vector<std::string>& args, const std::vector<int>& cpus = {});
+
+// returns true and clears pid if the process has exited (or pid is not a process), does not block
+bool reapProcess(::pid_t& pid);
+
+// waits up to timeout for the process to exit by itself, then kills it
+void stopProcess(::pid_t& pid, std::chrono::milliseconds timeout);
+
+// the worker must not outlive the server, even if the server is killed; returns false if the server is already gone
+bool bindToParentProcess();
+
+}  // namespace impala